@@ -0,0 +1,417 @@
+#include "async_log_callback.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <signal.h>
+#include <sys/uio.h>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+namespace
+{
+
+constexpr std::string_view prefixes[] = { "[DEBUG] "sv, "[INFO] "sv, "[ERROR] "sv };
+
+// Every line is stored as a header followed by the formatted text, padded to
+// a multiple of the header size. A line never wraps around the end of the
+// buffer; the space left there is skipped with a padding header instead, so
+// that every line can be handed to writev() as a single iovec.
+struct LineHeader
+{
+	uint32_t size;
+	uint32_t stream;
+};
+
+constexpr size_t header_size = sizeof(LineHeader);
+constexpr uint32_t padding = UINT32_MAX;
+
+inline size_t aligned(size_t size)
+{
+	return (size + header_size - 1) & ~(header_size - 1);
+}
+
+// Single producer, single consumer: the owning thread appends at head, the
+// writer thread consumes from tail
+struct Ring
+{
+	explicit Ring(size_t size) : buffer(new char[size]), capacity(size) {}
+
+	// Space for total bytes at the head, refreshing the view of tail only when
+	// the cached one says the ring is full
+	bool has_space(uint64_t head, size_t total)
+	{
+		if (capacity - (head - cached_tail) >= total)
+			return true;
+		cached_tail = tail.load(std::memory_order_acquire);
+		return capacity - (head - cached_tail) >= total;
+	}
+
+	std::unique_ptr<char[]> buffer;
+	size_t const capacity;
+
+	alignas(64) std::atomic<uint64_t> head {0};
+	uint64_t cached_tail = 0;
+	std::atomic<uint64_t> dropped {0};
+
+	alignas(64) std::atomic<uint64_t> tail {0};
+
+	// Free for another thread once the owner exits
+	std::atomic<bool> in_use {false};
+	// Set when the callback goes away
+	std::atomic<bool> closed {false};
+};
+
+// The rings of the current thread, one per callback it logged to. Handed back
+// on thread exit so the next thread can continue in them.
+struct ThreadRings
+{
+	~ThreadRings()
+	{
+		for (auto & entry : rings)
+			entry.second->in_use.store(false, std::memory_order_release);
+	}
+
+	std::vector<std::pair<uint64_t,std::shared_ptr<Ring>>> rings;
+};
+
+thread_local ThreadRings g_thread_rings;
+std::atomic<uint64_t> g_next_instance {1};
+
+bool write_all(int fd, iovec * iov, size_t count)
+{
+	while (count > 0)
+	{
+		ssize_t written = ::writev(fd, iov, int(std::min<size_t>(count, IOV_MAX)));
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		size_t remaining = written;
+		while (count > 0 && remaining >= iov->iov_len)
+		{
+			remaining -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+			iov->iov_len -= remaining;
+		}
+	}
+	return true;
+}
+
+}
+
+
+class fcgiserver::AsyncLogCallbackPrivate
+{
+public:
+	AsyncLogCallbackPrivate(AsyncLogCallback::OverflowPolicy policy, size_t ring_size, int out_fd, int err_fd)
+	    : id(g_next_instance.fetch_add(1))
+	    , policy(policy)
+	    , ring_size(std::max<size_t>(ring_size, 256) & ~(header_size - 1))
+	    , fds{out_fd, err_fd}
+	    , sleeping(false)
+	    , stop(false)
+	    , wake_pending(false)
+	    , passes(0)
+	    , reported_dropped(0)
+	{
+	}
+
+	Ring & thread_ring()
+	{
+		ThreadRings & local = g_thread_rings;
+		for (auto const& entry : local.rings)
+			if (entry.first == id)
+				return *entry.second;
+
+		// Forget the rings of callbacks that are gone
+		local.rings.erase(std::remove_if(local.rings.begin(), local.rings.end(), [] (auto const& entry) { return entry.second->closed.load(std::memory_order_relaxed); }), local.rings.end());
+
+		local.rings.emplace_back(id, acquire_ring());
+		return *local.rings.back().second;
+	}
+
+	std::shared_ptr<Ring> acquire_ring()
+	{
+		std::lock_guard<std::mutex> guard(rings_lock);
+		for (auto const& ring : rings)
+		{
+			bool expected = false;
+			if (!ring->in_use.load(std::memory_order_relaxed) && ring->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+				return ring;
+		}
+
+		rings.push_back(std::make_shared<Ring>(ring_size));
+		rings.back()->in_use.store(true);
+		return rings.back();
+	}
+
+	void wake()
+	{
+		{
+			std::lock_guard<std::mutex> guard(wake_lock);
+			wake_pending = true;
+		}
+		wake_cv.notify_one();
+	}
+
+	// Waits for the writer to complete passes passes from now
+	void wait_for_passes(uint64_t count)
+	{
+		std::unique_lock<std::mutex> guard(wake_lock);
+		uint64_t target = passes + count;
+		wake_pending = true;
+		wake_cv.notify_one();
+		pass_cv.wait(guard, [&] { return passes >= target || stop; });
+	}
+
+	bool pending() const
+	{
+		std::lock_guard<std::mutex> guard(rings_lock);
+		for (auto const& ring : rings)
+			if (ring->head.load() != ring->tail.load(std::memory_order_relaxed))
+				return true;
+		return false;
+	}
+
+	void writer_function()
+	{
+		// Signals are for the server threads to handle
+		sigset_t sigset;
+		sigfillset(&sigset);
+		pthread_sigmask(SIG_SETMASK, &sigset, nullptr);
+
+		std::unique_lock<std::mutex> guard(wake_lock);
+		while (true)
+		{
+			bool stopping = stop;
+			wake_pending = false;
+			guard.unlock();
+
+			bool written = drain();
+			report_dropped();
+
+			guard.lock();
+			++passes;
+			pass_cv.notify_all();
+
+			if (stopping)
+				break;
+			if (written || wake_pending || stop)
+				continue;
+
+			// Loggers only take the lock to wake us once we announced that we
+			// sleep, so check the rings once more after doing so
+			sleeping.store(true);
+			if (!pending())
+				wake_cv.wait_for(guard, std::chrono::milliseconds(100), [this] { return wake_pending || stop; });
+			sleeping.store(false);
+		}
+	}
+
+	// One pass over all rings, true if anything was written
+	bool drain()
+	{
+		{
+			std::lock_guard<std::mutex> guard(rings_lock);
+			pass_rings.assign(rings.begin(), rings.end());
+		}
+
+		bool written = false;
+		for (auto const& ring : pass_rings)
+		{
+			uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+			uint64_t head = ring->head.load(std::memory_order_acquire);
+			if (tail == head)
+				continue;
+
+			while (tail < head)
+			{
+				size_t offset = tail % ring->capacity;
+				LineHeader header;
+				std::memcpy(&header, ring->buffer.get() + offset, header_size);
+
+				if (header.size == padding)
+				{
+					tail += ring->capacity - offset;
+					continue;
+				}
+
+				iovecs[header.stream].push_back(iovec{ring->buffer.get() + offset + header_size, header.size});
+				tail += header_size + aligned(header.size);
+
+				if (iovecs[header.stream].size() >= IOV_MAX)
+				{
+					consumed.emplace_back(ring.get(), tail);
+					commit();
+				}
+			}
+
+			consumed.emplace_back(ring.get(), tail);
+			written = true;
+		}
+
+		commit();
+		pass_rings.clear();
+		return written;
+	}
+
+	// Write out the collected lines and hand their space back to the loggers
+	void commit()
+	{
+		for (size_t stream = 0; stream < 2; ++stream)
+		{
+			write_all(fds[stream], iovecs[stream].data(), iovecs[stream].size());
+			iovecs[stream].clear();
+		}
+
+		for (auto const& entry : consumed)
+			entry.first->tail.store(entry.second, std::memory_order_release);
+		consumed.clear();
+	}
+
+	uint64_t dropped() const
+	{
+		uint64_t total = 0;
+		std::lock_guard<std::mutex> guard(rings_lock);
+		for (auto const& ring : rings)
+			total += ring->dropped.load(std::memory_order_relaxed);
+		return total;
+	}
+
+	void report_dropped()
+	{
+		uint64_t total = dropped();
+		if (total == reported_dropped)
+			return;
+
+		std::string line = "[ERROR] " + std::to_string(total - reported_dropped) + " log lines dropped\n";
+		iovec iov {line.data(), line.size()};
+		write_all(fds[1], &iov, 1);
+		reported_dropped = total;
+	}
+
+	uint64_t const id;
+	AsyncLogCallback::OverflowPolicy const policy;
+	size_t const ring_size;
+	int const fds[2];
+
+	mutable std::mutex rings_lock;
+	std::vector<std::shared_ptr<Ring>> rings;
+
+	std::mutex wake_lock;
+	std::condition_variable wake_cv;
+	std::condition_variable pass_cv;
+	std::atomic<bool> sleeping;
+	bool stop;
+	bool wake_pending;
+	uint64_t passes;
+	std::thread writer;
+
+	// Only used by the writer thread
+	std::vector<std::shared_ptr<Ring>> pass_rings;
+	std::vector<iovec> iovecs[2];
+	std::vector<std::pair<Ring*,uint64_t>> consumed;
+	uint64_t reported_dropped;
+};
+
+
+AsyncLogCallback::AsyncLogCallback(OverflowPolicy policy, size_t ring_size, int out_fd, int err_fd)
+    : m_private(new AsyncLogCallbackPrivate(policy, ring_size, out_fd, err_fd))
+{
+	m_private->writer = std::thread(&AsyncLogCallbackPrivate::writer_function, m_private);
+}
+
+AsyncLogCallback::~AsyncLogCallback()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_private->wake_lock);
+		m_private->stop = true;
+	}
+	m_private->wake_cv.notify_one();
+	m_private->writer.join();
+
+	for (auto const& ring : m_private->rings)
+		ring->closed.store(true);
+
+	delete m_private;
+}
+
+void AsyncLogCallback::log_message(LogLevel level, std::string_view const& message)
+{
+	Ring & ring = m_private->thread_ring();
+
+	std::string_view prefix = prefixes[size_t(level)];
+	std::string_view line = message.substr(0, m_private->ring_size / 4 - header_size - prefix.size() - 1);
+
+	LineHeader header;
+	header.size = prefix.size() + line.size() + 1;
+	header.stream = level == LogLevel::Error ? 1 : 0;
+
+	uint64_t head = ring.head.load(std::memory_order_relaxed);
+	size_t offset = head % ring.capacity;
+	size_t contiguous = ring.capacity - offset;
+	size_t needed = header_size + aligned(header.size);
+	size_t total = contiguous < needed ? contiguous + needed : needed;
+
+	while (!ring.has_space(head, total))
+	{
+		if (m_private->policy == OverflowPolicy::Drop)
+		{
+			ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			m_private->wake();
+			return;
+		}
+		m_private->wait_for_passes(1);
+	}
+
+	char * buffer = ring.buffer.get();
+	if (contiguous < needed)
+	{
+		LineHeader skip {padding, 0};
+		std::memcpy(buffer + offset, &skip, header_size);
+		head += contiguous;
+		offset = 0;
+	}
+
+	char * output = buffer + offset;
+	std::memcpy(output, &header, header_size);
+	output += header_size;
+	std::memcpy(output, prefix.data(), prefix.size());
+	output += prefix.size();
+	std::memcpy(output, line.data(), line.size());
+	output[line.size()] = '\n';
+
+	// Sequentially consistent with the check of sleeping, see writer_function()
+	ring.head.store(head + needed);
+	if (m_private->sleeping.load())
+		m_private->wake();
+}
+
+void AsyncLogCallback::flush()
+{
+	// The pass in progress may have missed the latest lines, the next one won't
+	m_private->wait_for_passes(2);
+}
+
+uint64_t AsyncLogCallback::dropped() const
+{
+	return m_private->dropped();
+}
@@ -0,0 +1,54 @@
+#ifndef FCGISERVER_ASYNCLOGCALLBACK_H
+#define FCGISERVER_ASYNCLOGCALLBACK_H
+
+#include "fcgiserver_defs.h"
+#include "i_log_callback.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace fcgiserver
+{
+
+class AsyncLogCallbackPrivate;
+
+/// Console logging that keeps the worker threads off the terminal. Every
+/// thread formats its lines into a ring buffer of its own, and a background
+/// thread writes out whatever the rings hold in batches with writev(). Debug
+/// and info go to out_fd, errors to err_fd, in the same format as the default
+/// console logger.
+///
+/// When a ring is full the line is either dropped and counted, or the thread
+/// waits for the writer to make room. Everything logged is written out before
+/// the callback is destroyed.
+class DLL_PUBLIC AsyncLogCallback : public ILogCallback
+{
+public:
+	enum class OverflowPolicy : uint8_t
+	{
+		Drop,
+		Block,
+	};
+
+	/// Bytes per thread, lines longer than a quarter of this are truncated
+	static constexpr size_t default_ring_size = 64 * 1024;
+
+	AsyncLogCallback(OverflowPolicy policy = OverflowPolicy::Drop, size_t ring_size = default_ring_size, int out_fd = 1, int err_fd = 2);
+	AsyncLogCallback(AsyncLogCallback const& other) = delete;
+	AsyncLogCallback & operator= (AsyncLogCallback const& other) = delete;
+	~AsyncLogCallback();
+
+	void log_message(LogLevel level, std::string_view const& message) override;
+
+	/// Waits until everything logged before the call has been written
+	void flush();
+
+	/// Lines lost to full rings so far
+	uint64_t dropped() const;
+
+private:
+	AsyncLogCallbackPrivate * m_private;
+};
+
+}
+
+#endif // FCGISERVER_ASYNCLOGCALLBACK_H
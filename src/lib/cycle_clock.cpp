@@ -0,0 +1,52 @@
+#include "cycle_clock.h"
+
+#ifdef FCGISERVER_HAVE_RDTSC
+#include <cpuid.h>
+#endif
+
+using namespace fcgiserver;
+
+namespace
+{
+
+double calibrate()
+{
+	using clock = std::chrono::steady_clock;
+
+	clock::time_point start = clock::now();
+	uint64_t start_ticks = CycleClock::now();
+
+	clock::time_point end;
+	do
+	{
+		end = clock::now();
+	}
+	while (end - start < std::chrono::milliseconds(5));
+	uint64_t end_ticks = CycleClock::now();
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	return (end_ticks > start_ticks) ? double(elapsed) / double(end_ticks - start_ticks) : 1.0;
+}
+
+}
+
+// The counter must tick at a constant rate regardless of frequency scaling
+// and sleep states, which is what the invariant TSC flag promises
+bool CycleClock::has_invariant_tsc()
+{
+#ifdef FCGISERVER_HAVE_RDTSC
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007)
+		return false;
+	__cpuid(0x80000007, eax, ebx, ecx, edx);
+	return (edx & (1u << 8)) != 0;
+#else
+	return false;
+#endif
+}
+
+double CycleClock::nanoseconds_per_tick()
+{
+	static const double rate = use_tsc() ? calibrate() : 1.0;
+	return rate;
+}
@@ -0,0 +1,54 @@
+#ifndef FCGISERVER_CYCLE_CLOCK_H
+#define FCGISERVER_CYCLE_CLOCK_H
+
+#include "fcgiserver_defs.h"
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define FCGISERVER_HAVE_RDTSC 1
+#endif
+
+namespace fcgiserver
+{
+
+/// Monotonic clock that is cheap enough to read several times per request.
+/// Uses the time stamp counter where it runs at a constant rate, otherwise
+/// falls back to the steady clock; ticks are only meaningful after
+/// conversion with to_nanoseconds().
+class DLL_PRIVATE CycleClock
+{
+public:
+	static inline uint64_t now()
+	{
+#ifdef FCGISERVER_HAVE_RDTSC
+		if (use_tsc())
+			return __rdtsc();
+#endif
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static inline uint64_t to_nanoseconds(uint64_t ticks)
+	{
+		return use_tsc() ? uint64_t(ticks * nanoseconds_per_tick()) : ticks;
+	}
+
+	/// Measures the tick rate on first use, which takes a few milliseconds
+	static double nanoseconds_per_tick();
+
+private:
+	// Decided on first use rather than during static initialisation, which
+	// might already read the clock from another translation unit
+	static inline bool use_tsc()
+	{
+		static const bool value = has_invariant_tsc();
+		return value;
+	}
+
+	static bool has_invariant_tsc();
+};
+
+}
+
+#endif // FCGISERVER_CYCLE_CLOCK_H
@@ -0,0 +1,135 @@
+#include "epoch_domain.h"
+#include <algorithm>
+
+using namespace fcgiserver;
+
+namespace
+{
+
+// The slot of the current thread, handed back to the domain on thread exit
+struct ThreadSlot
+{
+	~ThreadSlot()
+	{
+		if (slot)
+			release(slot);
+	}
+
+	void * slot = nullptr;
+	unsigned int depth = 0;
+	void (*release)(void*) = nullptr;
+};
+
+thread_local ThreadSlot g_thread_slot;
+
+}
+
+EpochDomain & EpochDomain::instance()
+{
+	static EpochDomain domain;
+	return domain;
+}
+
+EpochDomain::EpochDomain()
+    : m_epoch(0)
+    , m_slots(nullptr)
+{
+}
+
+EpochDomain::~EpochDomain()
+{
+	for (Retired const& retired : m_retired)
+		retired.deleter(retired.ptr);
+
+	Slot * slot = m_slots.load();
+	while (slot)
+	{
+		Slot * next = slot->next;
+		delete slot;
+		slot = next;
+	}
+}
+
+void EpochDomain::retire(void * ptr, void (*deleter)(void*))
+{
+	{
+		std::lock_guard<std::mutex> guard(m_retired_mutex);
+
+		// Readers that enter from now on see the new epoch and cannot have
+		// loaded the pointer that was just replaced
+		uint64_t epoch = m_epoch.fetch_add(1);
+		m_retired.push_back(Retired{epoch, ptr, deleter});
+	}
+
+	reclaim();
+}
+
+void EpochDomain::reclaim()
+{
+	uint64_t oldest = idle;
+	for (Slot * slot = m_slots.load(); slot; slot = slot->next)
+		oldest = std::min(oldest, slot->epoch.load());
+
+	std::vector<Retired> expired;
+	{
+		std::lock_guard<std::mutex> guard(m_retired_mutex);
+
+		auto split = std::partition(m_retired.begin(), m_retired.end(), [oldest] (Retired const& retired) { return retired.epoch >= oldest; });
+		expired.assign(split, m_retired.end());
+		m_retired.erase(split, m_retired.end());
+	}
+
+	for (Retired const& retired : expired)
+		retired.deleter(retired.ptr);
+}
+
+EpochDomain::Slot * EpochDomain::acquire_slot()
+{
+	for (Slot * slot = m_slots.load(); slot; slot = slot->next)
+	{
+		bool expected = false;
+		if (!slot->in_use.load(std::memory_order_relaxed) && slot->in_use.compare_exchange_strong(expected, true))
+			return slot;
+	}
+
+	// Slots are never removed, so pushing to the front is all it takes
+	Slot * slot = new Slot;
+	slot->in_use.store(true);
+	slot->next = m_slots.load();
+	while (!m_slots.compare_exchange_weak(slot->next, slot))
+		;
+	return slot;
+}
+
+void EpochDomain::release_slot(Slot * slot)
+{
+	slot->epoch.store(idle);
+	slot->in_use.store(false);
+}
+
+EpochGuard::EpochGuard()
+{
+	ThreadSlot & thread_slot = g_thread_slot;
+	if (thread_slot.depth++ > 0)
+		return;
+
+	EpochDomain & domain = EpochDomain::instance();
+	if (!thread_slot.slot)
+	{
+		thread_slot.slot = domain.acquire_slot();
+		thread_slot.release = [] (void * slot) { EpochDomain::instance().release_slot(static_cast<EpochDomain::Slot*>(slot)); };
+	}
+
+	// Sequentially consistent so the announcement is ordered before the
+	// loads of the protected pointers that follow
+	static_cast<EpochDomain::Slot*>(thread_slot.slot)->epoch.store(domain.m_epoch.load());
+}
+
+EpochGuard::~EpochGuard()
+{
+	ThreadSlot & thread_slot = g_thread_slot;
+	if (--thread_slot.depth > 0)
+		return;
+
+	static_cast<EpochDomain::Slot*>(thread_slot.slot)->epoch.store(EpochDomain::idle, std::memory_order_release);
+}
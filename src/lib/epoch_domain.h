@@ -0,0 +1,76 @@
+#ifndef FCGISERVER_EPOCHDOMAIN_H
+#define FCGISERVER_EPOCHDOMAIN_H
+
+#include "fcgiserver_defs.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace fcgiserver
+{
+
+/// Epoch based reclamation for data that is read without locks. Readers
+/// hold an EpochGuard while they use a pointer loaded from an atomic; a
+/// writer swaps in a replacement and retires the old object, which is
+/// deleted once every reader that could have seen it has left.
+///
+/// Writers never wait for readers, retired objects are merely kept around
+/// until a later retire() or reclaim() finds them unreferenced.
+class DLL_PRIVATE EpochDomain
+{
+public:
+	static EpochDomain & instance();
+	~EpochDomain();
+
+	template <typename T>
+	inline void retire(T * ptr)
+	{
+		retire(ptr, [] (void * p) { delete static_cast<T*>(p); });
+	}
+
+	void retire(void * ptr, void (*deleter)(void*));
+	void reclaim();
+
+private:
+	friend class EpochGuard;
+
+	static constexpr uint64_t idle = UINT64_MAX;
+
+	struct alignas(64) Slot
+	{
+		std::atomic<uint64_t> epoch { idle };
+		std::atomic<bool> in_use { false };
+		Slot * next = nullptr;
+	};
+
+	struct Retired
+	{
+		uint64_t epoch;
+		void * ptr;
+		void (*deleter)(void*);
+	};
+
+	EpochDomain();
+	Slot * acquire_slot();
+	void release_slot(Slot * slot);
+
+	std::atomic<uint64_t> m_epoch;
+	std::atomic<Slot*> m_slots;
+	std::mutex m_retired_mutex;
+	std::vector<Retired> m_retired;
+};
+
+/// Marks the current thread as reading for its lifetime. Guards nest.
+class DLL_PRIVATE EpochGuard
+{
+public:
+	EpochGuard();
+	~EpochGuard();
+	EpochGuard(EpochGuard const& other) = delete;
+	EpochGuard & operator= (EpochGuard const& other) = delete;
+};
+
+}
+
+#endif // FCGISERVER_EPOCHDOMAIN_H
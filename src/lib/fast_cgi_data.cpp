@@ -10,31 +10,44 @@ FastCgiData::FastCgiData(FCGX_Request & FastCgiData)
 
 FastCgiData::~FastCgiData()
 {
-	FCGX_Finish_r(m_request);
+	finish();
 }
 
+// The streams are only valid between FCGX_Accept_r and FCGX_Finish_r; since
+// this object lives for the whole worker thread, guard against use while idle
+
 int FastCgiData::read(uint8_t * buffer, size_t bufsize)
 {
+	if (!m_request->in)
+		return -1;
 	return FCGX_GetStr(reinterpret_cast<char*>(buffer), bufsize, m_request->in);
 }
 
 int FastCgiData::write(const uint8_t * buffer, size_t bufsize)
 {
+	if (!m_request->out)
+		return -1;
 	return FCGX_PutStr(reinterpret_cast<const char*>(buffer), bufsize, m_request->out);
 }
 
 int FastCgiData::error(const uint8_t * buffer, size_t bufsize)
 {
+	if (!m_request->err)
+		return -1;
 	return FCGX_PutStr(reinterpret_cast<const char*>(buffer), bufsize, m_request->err);
 }
 
 int FastCgiData::flush_write()
 {
+	if (!m_request->out)
+		return -1;
 	return FCGX_FFlush(m_request->out);
 }
 
 int FastCgiData::flush_error()
 {
+	if (!m_request->err)
+		return -1;
 	return FCGX_FFlush(m_request->err);
 }
 
@@ -43,4 +56,9 @@ const char **FastCgiData::env() const
 	return const_cast<const char**>(m_request->envp);
 }
 
+void FastCgiData::finish()
+{
+	FCGX_Finish_r(m_request);
+}
+
 } // namespace fcgiserver
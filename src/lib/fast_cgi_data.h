@@ -21,6 +21,8 @@ public:
 	int flush_error() override;
 	const char **env() const override;
 
+	void finish();
+
 private:
 	FCGX_Request * m_request;
 };
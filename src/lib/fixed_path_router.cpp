@@ -0,0 +1,31 @@
+#include "fixed_path_router.h"
+#include "request.h"
+#include "request_context.h"
+
+using namespace fcgiserver;
+
+FixedPathRouter::FixedPathRouter(std::string_view const& path)
+{
+	std::string_view remaining = path;
+	while (!remaining.empty())
+	{
+		size_t split = remaining.find('/');
+		std::string_view component = remaining.substr(0, split);
+		remaining = (split == std::string_view::npos) ? std::string_view() : remaining.substr(split + 1);
+
+		if (!component.empty())
+			m_route.emplace_back(component);
+	}
+}
+
+IRouter::RouteResult FixedPathRouter::handle_request(RequestContext & context)
+{
+	Request::RouteView route = context.request().relative_route();
+	if (route.size() != m_route.size())
+		return IRouter::RouteResult::NotFound;
+	for (size_t idx = 0; idx < m_route.size(); ++idx)
+		if (route[idx] != m_route[idx])
+			return IRouter::RouteResult::NotFound;
+
+	return handle_path(context);
+}
@@ -0,0 +1,33 @@
+#ifndef FCGISERVER_FIXED_PATH_ROUTER_H
+#define FCGISERVER_FIXED_PATH_ROUTER_H
+
+#include "fcgiserver_defs.h"
+#include "i_router.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fcgiserver
+{
+
+/// Base for routers that serve a single path, relative to where they are
+/// mounted. Any other path is NotFound; requests for the path itself are
+/// passed on to handle_path().
+class DLL_PUBLIC FixedPathRouter : public IRouter
+{
+public:
+	FixedPathRouter(std::string_view const& path);
+	~FixedPathRouter() = default;
+
+	IRouter::RouteResult handle_request(RequestContext & context) final;
+
+protected:
+	virtual IRouter::RouteResult handle_path(RequestContext & context) = 0;
+
+private:
+	std::vector<std::string> m_route;
+};
+
+}
+
+#endif // FCGISERVER_FIXED_PATH_ROUTER_H
@@ -0,0 +1,133 @@
+#ifndef FCGISERVER_FORMAT_STRING_H
+#define FCGISERVER_FORMAT_STRING_H
+
+#include "fcgiserver_defs.h"
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Format strings that are checked and split up at compile time. Every "{}" is
+// replaced by the next argument, "{{" and "}}" produce literal braces.
+//
+//   formatter.format(FCGISERVER_FORMAT("Hello {}, you are {} today"), name, age);
+//
+// C++17 cannot take a string literal as template argument, so the macro wraps
+// the literal in a unique type that carries it as a constexpr function.
+#define FCGISERVER_FORMAT(literal) \
+	([] { \
+		struct FormatLiteral : ::fcgiserver::format_string::FormatString \
+		{ \
+			static constexpr std::string_view string() { return literal; } \
+		}; \
+		return FormatLiteral(); \
+	}())
+
+namespace fcgiserver
+{
+namespace format_string
+{
+
+/// Base of all types created by FCGISERVER_FORMAT
+struct FormatString {};
+
+struct Piece
+{
+	std::size_t begin;
+	std::size_t length;
+	std::size_t argument;
+	bool is_argument;
+};
+
+/// Walk the format string, calling fn(piece) for every literal run and
+/// argument. Returns false if it contains an unmatched brace.
+template <typename FN>
+constexpr bool walk(std::string_view fmt, FN && fn)
+{
+	std::size_t start = 0;
+	std::size_t argument = 0;
+	std::size_t idx = 0;
+
+	while (idx < fmt.size())
+	{
+		char c = fmt[idx];
+		if (c != '{' && c != '}')
+		{
+			++idx;
+			continue;
+		}
+
+		if (idx + 1 >= fmt.size())
+			return false;
+
+		char next = fmt[idx + 1];
+		if (c == '{' && next == '}')
+		{
+			if (idx > start)
+				fn(Piece{start, idx - start, 0, false});
+			fn(Piece{0, 0, argument++, true});
+		}
+		else if (c == next)
+		{
+			// Keep the first of the pair as part of the literal
+			fn(Piece{start, idx + 1 - start, 0, false});
+		}
+		else
+		{
+			return false;
+		}
+
+		idx += 2;
+		start = idx;
+	}
+
+	if (idx > start)
+		fn(Piece{start, idx - start, 0, false});
+
+	return true;
+}
+
+struct Summary
+{
+	bool valid = false;
+	std::size_t pieces = 0;
+	std::size_t arguments = 0;
+	std::size_t literal_size = 0;
+};
+
+constexpr Summary summarize(std::string_view fmt)
+{
+	Summary summary;
+	summary.valid = walk(fmt, [&summary] (Piece const& piece)
+	{
+		++summary.pieces;
+		if (piece.is_argument)
+			++summary.arguments;
+		else
+			summary.literal_size += piece.length;
+	});
+	return summary;
+}
+
+template <std::size_t N>
+constexpr std::array<Piece,N> parse(std::string_view fmt)
+{
+	std::array<Piece,N> pieces {};
+	std::size_t count = 0;
+	walk(fmt, [&pieces, &count] (Piece const& piece)
+	{
+		pieces[count++] = piece;
+	});
+	return pieces;
+}
+
+// Expected output size of an argument, used to reserve space up front
+inline std::size_t size_hint(std::string_view const& s) { return s.size(); }
+inline std::size_t size_hint(std::string const& s) { return s.size(); }
+template <typename T>
+inline std::size_t size_hint(T const&) { return 8; }
+
+} // namespace format_string
+} // namespace fcgiserver
+
+#endif // FCGISERVER_FORMAT_STRING_H
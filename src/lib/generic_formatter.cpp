@@ -1,4 +1,5 @@
 #include "generic_formatter.h"
+#include "simd.h"
 #include "utils.h"
 #include <charconv>
 #include <cstring>
@@ -7,11 +8,113 @@
 using namespace fcgiserver;
 using namespace std::literals::string_view_literals;
 
+namespace
+{
+
+// Length of the prefix that HTML output copies unchanged: ASCII except NUL,
+// '&' and, for content, '<' and '>'
+size_t plain_html_run(std::string_view s, bool content)
+{
+	char const* data = s.data();
+	size_t const size = s.size();
+	size_t idx = 0;
+
+	const simd::Vector zero = simd::splat(0);
+	const simd::Vector amp = simd::splat('&');
+	const simd::Vector lt = simd::splat(content ? '<' : '&');
+	const simd::Vector gt = simd::splat(content ? '>' : '&');
+	for (; idx + simd::width <= size; idx += simd::width)
+	{
+		simd::Vector block = simd::load(data + idx);
+		simd::Vector special = simd::either(simd::either(simd::eq(block, zero), simd::eq(block, amp)), simd::either(simd::eq(block, lt), simd::eq(block, gt)));
+		simd::Mask found = simd::non_ascii(block) | simd::mask(special);
+		if (found)
+			return idx + simd::first(found);
+	}
+
+	for (; idx < size; ++idx)
+	{
+		uint8_t c = data[idx];
+		if (c == 0 || c >= 0x80 || c == '&' || (content && (c == '<' || c == '>')))
+			return idx;
+	}
+
+	return size;
+}
+
+// Length of the prefix without control characters, '"' and '\\'
+size_t plain_json_run(std::string_view s)
+{
+	char const* data = s.data();
+	size_t const size = s.size();
+	size_t idx = 0;
+
+	const simd::Vector quote = simd::splat('"');
+	const simd::Vector backslash = simd::splat('\\');
+	for (; idx + simd::width <= size; idx += simd::width)
+	{
+		simd::Vector block = simd::load(data + idx);
+		simd::Mask found = simd::mask(simd::either(simd::below(block, 0x20), simd::either(simd::eq(block, quote), simd::eq(block, backslash))));
+		if (found)
+			return idx + simd::first(found);
+	}
+
+	for (; idx < size; ++idx)
+	{
+		uint8_t c = data[idx];
+		if (c < 0x20 || c == '"' || c == '\\')
+			return idx;
+	}
+
+	return size;
+}
+
+size_t json_escape(char32_t glyph, char * out)
+{
+	switch (glyph)
+	{
+		case U'"':
+			std::memcpy(out, "\\\"", 2);
+			return 2;
+		case U'\\':
+			std::memcpy(out, "\\\\", 2);
+			return 2;
+		case U'\n':
+			std::memcpy(out, "\\n", 2);
+			return 2;
+		case U'\r':
+			std::memcpy(out, "\\r", 2);
+			return 2;
+		case U'\t':
+			std::memcpy(out, "\\t", 2);
+			return 2;
+		default:
+			break;
+	}
+
+	if (glyph < 0x20)
+	{
+		static constexpr char hex[] = "0123456789abcdef";
+		std::memcpy(out, "\\u00", 4);
+		out[4] = hex[glyph >> 4];
+		out[5] = hex[glyph & 0xf];
+		return 6;
+	}
+
+	return utils::utf32_to_8(glyph, reinterpret_cast<uint8_t*>(out));
+}
+
+}
+
 GenericFormatter::GenericFormatter(GenericFormat format)
     : m_generic_format(format)
 {
 }
 
+void GenericFormatter::reserve(size_t)
+{
+}
+
 GenericFormatter & GenericFormatter::printf(char const* fmt, ...)
 {
 	std::va_list vl;
@@ -159,15 +262,56 @@ GenericFormatter & GenericFormatter::operator<< (std::string_view const& s)
 
 		utils::convert_state mbstate;
 		size_t offset = 0;
+		size_t idx = 0;
 
-		for (char c : s)
+		while (idx < s.size())
 		{
+			// Between glyphs, skip ahead to the next byte that needs attention
+			if (mbstate.remaining == 0)
+			{
+				std::string_view rest = s.substr(idx);
+				size_t run;
+				if (m_generic_format == GenericFormat::UTF8)
+					run = utils::utf8_clean_prefix(rest);
+				else if (m_generic_format == GenericFormat::JSON)
+					run = utils::utf8_clean_prefix(rest.substr(0, plain_json_run(rest)));
+				else
+					run = plain_html_run(rest, m_generic_format == GenericFormat::HTMLContent);
+
+				if (run > 0)
+				{
+					if (offset + run <= 100)
+					{
+						std::memcpy(tmp + offset, rest.data(), run);
+						offset += run;
+					}
+					else
+					{
+						if (offset > 0)
+							real_append(std::string_view(tmp, offset));
+						real_append(rest.substr(0, run));
+						offset = 0;
+					}
+
+					idx += run;
+					if (idx == s.size())
+						break;
+				}
+			}
+
+			char c = s[idx++];
+			bool nul = (c == 0 && mbstate.remaining == 0);
 			char32_t glyph = utils::utf8_to_32(c, mbstate);
 
-			if (glyph == 0)
+			// Only JSON can represent a NUL character
+			if (glyph == 0 && !(nul && m_generic_format == GenericFormat::JSON))
 				continue;
 
-			if (m_generic_format == GenericFormat::UTF8)
+			if (m_generic_format == GenericFormat::JSON)
+			{
+				offset += json_escape(glyph, tmp + offset);
+			}
+			else if (m_generic_format == GenericFormat::UTF8)
 			{
 				size_t len = utils::utf32_to_8(glyph, reinterpret_cast<uint8_t*>(tmp + offset));
 				offset += len;
@@ -233,7 +377,11 @@ GenericFormatter & GenericFormatter::operator<< (std::u32string_view const& s)
 
 		for (char32_t glyph : s)
 		{
-			if (m_generic_format == GenericFormat::UTF8)
+			if (m_generic_format == GenericFormat::JSON)
+			{
+				offset += json_escape(glyph, tmp + offset);
+			}
+			else if (m_generic_format == GenericFormat::UTF8)
 			{
 				size_t len = utils::utf32_to_8(glyph, reinterpret_cast<uint8_t*>(tmp + offset));
 				offset += len;
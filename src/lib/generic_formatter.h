@@ -2,9 +2,13 @@
 #define FCGISERVER_GENERIC_FORMATTER_H
 
 #include "fcgiserver_defs.h"
+#include "format_string.h"
 #include "symbol.h"
 #include <cstdarg>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 
 namespace fcgiserver
@@ -23,6 +27,9 @@ enum class GenericFormat : char
 
 	/// Encode multibyte glyphs as UTF8
 	UTF8,
+
+	/// Encode multibyte glyphs as UTF8 and escape for use inside a JSON string
+	JSON,
 };
 
 class DLL_PUBLIC GenericFormatter
@@ -48,6 +55,21 @@ public:
 	GenericFormatter & printf(char const* fmt, ...);
 	GenericFormatter & vprintf(char const* fmt, std::va_list vl);
 
+	/// Append a format string created with FCGISERVER_FORMAT. The literal parts
+	/// are appended verbatim, the arguments are formatted as with operator<<.
+	template <typename FORMAT, typename ...ARGS>
+	inline GenericFormatter & format(FORMAT, ARGS const& ...args)
+	{
+		static_assert(std::is_base_of_v<format_string::FormatString, FORMAT>, "format strings must be created with FCGISERVER_FORMAT");
+		constexpr format_string::Summary summary = format_string::summarize(FORMAT::string());
+		static_assert(summary.valid, "unmatched '{' or '}' in format string, use '{{' and '}}' for literal braces");
+		static_assert(summary.arguments == sizeof...(ARGS), "number of arguments does not match the format string");
+
+		reserve(summary.literal_size + (format_string::size_hint(args) + ... + 0));
+		format_pieces<FORMAT>(std::make_index_sequence<summary.pieces>(), std::forward_as_tuple(args...));
+		return *this;
+	}
+
 	GenericFormatter & operator<< (bool b);
 	GenericFormatter & operator<< (char c);
 	GenericFormatter & operator<< (uint8_t i);
@@ -73,6 +95,28 @@ public:
 protected:
 	GenericFormat m_generic_format;
 	virtual void real_append(std::string_view const& s) = 0;
+
+	/// Hint that about this many bytes are about to be appended
+	virtual void reserve(size_t size);
+
+private:
+	template <typename FORMAT, typename TUPLE, size_t ...I>
+	inline void format_pieces(std::index_sequence<I...>, TUPLE const& args)
+	{
+		(format_piece<FORMAT, I>(args), ...);
+	}
+
+	template <typename FORMAT, size_t I, typename TUPLE>
+	inline void format_piece(TUPLE const& args)
+	{
+		constexpr std::string_view fmt = FORMAT::string();
+		constexpr format_string::Piece piece = format_string::parse<format_string::summarize(fmt).pieces>(fmt)[I];
+
+		if constexpr (piece.is_argument)
+			operator<<(std::get<piece.argument>(args));
+		else
+			real_append(fmt.substr(piece.begin, piece.length));
+	}
 };
 
 }
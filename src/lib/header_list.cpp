@@ -0,0 +1,100 @@
+#include "header_list.h"
+#include <algorithm>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+
+HeaderList::HeaderList()
+{
+	m_entries.reserve(16);
+}
+
+HeaderList::~HeaderList() = default;
+
+std::string_view HeaderList::get(Symbol key) const
+{
+	for (auto const& entry : m_entries)
+		if (entry.key == key)
+			return entry.value();
+	return std::string_view();
+}
+
+bool HeaderList::contains(Symbol key) const
+{
+	for (auto const& entry : m_entries)
+		if (entry.key == key)
+			return true;
+	return false;
+}
+
+size_t HeaderList::count(Symbol key) const
+{
+	return std::count_if(m_entries.cbegin(), m_entries.cend(), [key] (Entry const& entry) { return entry.key == key; });
+}
+
+void HeaderList::set(Symbol key, std::string && value)
+{
+	auto iter = std::find_if(m_entries.begin(), m_entries.end(), [key] (Entry const& entry) { return entry.key == key; });
+	replace(iter, Entry(key, std::move(value)));
+}
+
+void HeaderList::set(Symbol key, HeaderValue value)
+{
+	auto iter = std::find_if(m_entries.begin(), m_entries.end(), [key] (Entry const& entry) { return entry.key == key; });
+	replace(iter, Entry(key, value));
+}
+
+void HeaderList::add(Symbol key, std::string && value)
+{
+	m_entries.emplace_back(key, std::move(value));
+}
+
+void HeaderList::add(Symbol key, HeaderValue value)
+{
+	m_entries.emplace_back(key, value);
+}
+
+bool HeaderList::remove(Symbol key)
+{
+	auto last = std::remove_if(m_entries.begin(), m_entries.end(), [key] (Entry const& entry) { return entry.key == key; });
+	if (last == m_entries.end())
+		return false;
+
+	m_entries.erase(last, m_entries.end());
+	return true;
+}
+
+void HeaderList::clear()
+{
+	m_entries.clear();
+}
+
+void HeaderList::render(std::string & output) const
+{
+	for (auto const& entry : m_entries)
+	{
+		output.append(entry.key.to_string_view());
+		output.append(": "sv);
+		output.append(entry.value());
+		output.append("\r\n"sv);
+	}
+
+	output.append("\r\n"sv);
+}
+
+void HeaderList::replace(Entries::iterator iter, Entry && entry)
+{
+	if (iter == m_entries.end())
+	{
+		m_entries.push_back(std::move(entry));
+		return;
+	}
+
+	Symbol key = entry.key;
+	*iter = std::move(entry);
+
+	// Drop any additional values so the key remains single valued
+	auto last = std::remove_if(std::next(iter), m_entries.end(), [key] (Entry const& other) { return other.key == key; });
+	m_entries.erase(last, m_entries.end());
+}
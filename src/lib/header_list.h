@@ -0,0 +1,80 @@
+#ifndef FCGISERVER_HEADER_LIST_H
+#define FCGISERVER_HEADER_LIST_H
+
+#include "fcgiserver_defs.h"
+#include "symbol.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fcgiserver
+{
+
+/// Header value with static storage duration, referenced without copying
+struct DLL_PUBLIC HeaderValue
+{
+	explicit constexpr HeaderValue(std::string_view v) : value(v) {}
+	std::string_view value;
+};
+
+/// Response headers in insertion order. A key may occur more than once so
+/// that headers such as Set-Cookie can carry multiple values.
+class DLL_PUBLIC HeaderList
+{
+public:
+	class Entry
+	{
+	public:
+		inline Entry(Symbol k, std::string && v) : key(k), m_owned(std::move(v)) {}
+		inline Entry(Symbol k, HeaderValue v) : key(k), m_static(v.value) {}
+
+		inline std::string_view value() const { return m_static.data() ? m_static : std::string_view(m_owned); }
+		/// Whether the value is a HeaderValue referenced without copying
+		inline bool is_static() const { return m_static.data() != nullptr; }
+
+		Symbol key;
+
+	private:
+		std::string_view m_static;
+		std::string m_owned;
+	};
+
+	using Entries = std::vector<Entry>;
+	using const_iterator = Entries::const_iterator;
+
+	HeaderList();
+	~HeaderList();
+
+	inline const_iterator begin() const { return m_entries.cbegin(); }
+	inline const_iterator end() const { return m_entries.cend(); }
+	inline size_t size() const { return m_entries.size(); }
+	inline bool empty() const { return m_entries.empty(); }
+
+	std::string_view get(Symbol key) const;
+	bool contains(Symbol key) const;
+	size_t count(Symbol key) const;
+
+	/// Replace all values of key with this single value
+	void set(Symbol key, std::string && value);
+	void set(Symbol key, HeaderValue value);
+
+	/// Add another value for key, keeping any existing ones
+	void add(Symbol key, std::string && value);
+	void add(Symbol key, HeaderValue value);
+
+	bool remove(Symbol key);
+	void clear();
+
+	/// Append all headers in CGI format, including the terminating empty line
+	void render(std::string & output) const;
+
+private:
+	void replace(Entries::iterator iter, Entry && entry);
+
+	Entries m_entries;
+};
+
+} // namespace fcgiserver
+
+#endif // FCGISERVER_HEADER_LIST_H
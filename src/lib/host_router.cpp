@@ -0,0 +1,304 @@
+#include "host_router.h"
+#include "epoch_domain.h"
+#include "request.h"
+#include "request_context.h"
+#include "router.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+
+namespace
+{
+
+inline char lower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+}
+
+// FNV-1a over the lowercased bytes, back to front. Hashing from the end
+// means the hashes of all dot suffixes fall out of a single pass.
+constexpr uint64_t fnv_offset = 14695981039346656037ull;
+constexpr uint64_t fnv_prime = 1099511628211ull;
+
+inline uint64_t hash_step(uint64_t hash, char c)
+{
+	return (hash ^ uint8_t(lower(c))) * fnv_prime;
+}
+
+uint64_t host_hash(std::string_view const& host)
+{
+	uint64_t hash = fnv_offset;
+	for (size_t i = host.size(); i > 0; --i)
+		hash = hash_step(hash, host[i-1]);
+	return hash;
+}
+
+// Key is stored lowercased already
+bool host_equal(std::string_view const& key, std::string_view const& host)
+{
+	if (key.size() != host.size())
+		return false;
+	for (size_t i = 0; i < key.size(); ++i)
+		if (key[i] != lower(host[i]))
+			return false;
+	return true;
+}
+
+// Drop the port and a trailing dot; IPv6 literals keep their brackets
+std::string_view strip_host(std::string_view host)
+{
+	if (!host.empty() && host.front() == '[')
+	{
+		size_t close = host.find(']');
+		if (close != std::string_view::npos)
+			host = host.substr(0, close + 1);
+	}
+	else
+	{
+		size_t colon = host.rfind(':');
+		if (colon != std::string_view::npos)
+			host = host.substr(0, colon);
+	}
+
+	if (!host.empty() && host.back() == '.')
+		host.remove_suffix(1);
+
+	return host;
+}
+
+// Turn a pattern into its lookup key: "*" stays, "*.example.com" becomes
+// ".example.com" and exact hosts are simply lowercased
+bool make_key(std::string_view pattern, std::string & key)
+{
+	if (pattern == "*"sv)
+	{
+		key = "*";
+		return true;
+	}
+
+	bool wildcard = pattern.substr(0, 2) == "*."sv;
+	if (wildcard)
+		pattern.remove_prefix(1);
+
+	if (!pattern.empty() && pattern.back() == '.')
+		pattern.remove_suffix(1);
+
+	if (pattern.empty() || pattern == "."sv)
+		return false;
+
+	// Would otherwise share its key with the wildcard
+	if (!wildcard && pattern.front() == '.')
+		return false;
+
+	for (size_t i = 0; i < pattern.size(); ++i)
+	{
+		char c = pattern[i];
+		if (c <= ' ' || c == '/' || c == '*' || uint8_t(c) >= 0x80)
+			return false;
+		if (c == ':' && pattern.front() != '[')
+			return false;
+		if (c == '.' && i + 1 < pattern.size() && pattern[i+1] == '.')
+			return false;
+	}
+
+	key.clear();
+	key.reserve(pattern.size());
+	for (char c : pattern)
+		key.push_back(lower(c));
+	return true;
+}
+
+using HostDefinition = std::map<std::string,std::shared_ptr<IRouter>,std::less<>>;
+
+// Open addressing table over the exact hosts and wildcard suffixes, rebuilt
+// whenever the hosts change
+struct HostTable
+{
+	static constexpr uint32_t none = UINT32_MAX;
+
+	// Hosts with more labels than this only have their shortest suffixes
+	// checked against the wildcards
+	static constexpr size_t max_suffixes = 32;
+
+	struct Slot
+	{
+		uint64_t hash;
+		uint32_t entry;
+	};
+
+	struct Entry
+	{
+		std::string key;
+		std::shared_ptr<IRouter> router;
+	};
+
+	HostTable(HostDefinition const& definition)
+	{
+		size_t capacity = 8;
+		while (capacity < definition.size() * 2)
+			capacity <<= 1;
+		slots.resize(capacity, Slot{0, none});
+		mask = capacity - 1;
+
+		entries.reserve(definition.size());
+		for (auto const& host : definition)
+		{
+			if (host.first == "*"sv)
+			{
+				fallback = host.second;
+				continue;
+			}
+
+			uint64_t hash = host_hash(host.first);
+			size_t idx = hash & mask;
+			while (slots[idx].entry != none)
+				idx = (idx + 1) & mask;
+
+			slots[idx] = Slot{hash, uint32_t(entries.size())};
+			entries.push_back(Entry{host.first, host.second});
+		}
+	}
+
+	IRouter * lookup(uint64_t hash, std::string_view const& host) const
+	{
+		for (size_t idx = hash & mask; slots[idx].entry != none; idx = (idx + 1) & mask)
+		{
+			Slot const& slot = slots[idx];
+			if (slot.hash == hash && host_equal(entries[slot.entry].key, host))
+				return entries[slot.entry].router.get();
+		}
+		return nullptr;
+	}
+
+	IRouter * find(std::string_view const& host) const
+	{
+		if (entries.empty() || host.empty())
+			return fallback.get();
+
+		size_t suffixes[max_suffixes];
+		uint64_t suffix_hashes[max_suffixes];
+		size_t suffix_count = 0;
+
+		uint64_t hash = fnv_offset;
+		for (size_t i = host.size(); i > 0; --i)
+		{
+			hash = hash_step(hash, host[i-1]);
+			if (host[i-1] == '.' && suffix_count < max_suffixes)
+			{
+				suffixes[suffix_count] = i - 1;
+				suffix_hashes[suffix_count] = hash;
+				++suffix_count;
+			}
+		}
+
+		if (IRouter * router = lookup(hash, host))
+			return router;
+
+		// Longest suffix first, i.e. the dot found last
+		while (suffix_count > 0)
+		{
+			--suffix_count;
+			if (IRouter * router = lookup(suffix_hashes[suffix_count], host.substr(suffixes[suffix_count])))
+				return router;
+		}
+
+		return fallback.get();
+	}
+
+	std::vector<Slot> slots;
+	std::vector<Entry> entries;
+	std::shared_ptr<IRouter> fallback;
+	size_t mask;
+};
+
+}
+
+
+class fcgiserver::HostRouterPrivate
+{
+public:
+	HostRouterPrivate()
+	    : table(new HostTable(definition))
+	{
+	}
+
+	~HostRouterPrivate()
+	{
+		delete table.load();
+	}
+
+	// Must be called with definition_mutex held
+	void publish()
+	{
+		HostTable * old_table = table.exchange(new HostTable(definition));
+		EpochDomain::instance().retire(old_table);
+	}
+
+	std::mutex definition_mutex;
+	HostDefinition definition;
+
+	std::atomic<HostTable*> table;
+};
+
+
+HostRouter::HostRouter()
+    : m_private(new HostRouterPrivate)
+{
+}
+
+HostRouter::~HostRouter()
+{
+	delete m_private;
+}
+
+IRouter::RouteResult HostRouter::handle_request(RequestContext & context)
+{
+	EpochGuard guard;
+	HostTable const& table = *m_private->table.load();
+
+	IRouter * router = table.find(strip_host(context.request().http_host()));
+	if (!router)
+		return IRouter::RouteResult::NotFound;
+
+	return router->handle_request(context);
+}
+
+bool HostRouter::add_host(std::string_view const& host, std::shared_ptr<IRouter> router)
+{
+	std::string key;
+	if (!router || !make_key(host, key))
+		return false;
+
+	if (Router * nested = dynamic_cast<Router*>(router.get()))
+		nested->inherit_metrics_prefix(host);
+
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
+
+	m_private->definition[std::move(key)] = std::move(router);
+	m_private->publish();
+	return true;
+}
+
+bool HostRouter::remove_host(std::string_view const& host)
+{
+	std::string key;
+	if (!make_key(host, key))
+		return false;
+
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
+
+	auto iter = m_private->definition.find(key);
+	if (iter == m_private->definition.end())
+		return false;
+
+	m_private->definition.erase(iter);
+	m_private->publish();
+	return true;
+}
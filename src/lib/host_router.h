@@ -0,0 +1,40 @@
+#ifndef FCGISERVER_HOST_ROUTER_H
+#define FCGISERVER_HOST_ROUTER_H
+
+#include "fcgiserver_defs.h"
+#include "i_router.h"
+#include <memory>
+#include <string_view>
+
+namespace fcgiserver
+{
+
+/// Selects a router by the Host of the request before any path routing
+/// takes place. Hosts are registered as an exact name ("example.com"), a
+/// wildcard suffix ("*.example.com", matching any subdomain but not the
+/// domain itself) or "*" as the fallback for all other hosts. Host names
+/// are matched case insensitively and without their port.
+///
+/// The most specific match wins: an exact host, then the longest wildcard
+/// suffix, then the fallback. Without a match the request is NotFound.
+class HostRouterPrivate;
+class DLL_PUBLIC HostRouter : public IRouter
+{
+public:
+	HostRouter();
+	~HostRouter();
+
+	IRouter::RouteResult handle_request(RequestContext & context) override;
+
+	/// Returns false if the pattern is not a valid host or wildcard. A Router
+	/// without a metrics prefix of its own gets the pattern as its prefix.
+	bool add_host(std::string_view const& host, std::shared_ptr<IRouter> router);
+	bool remove_host(std::string_view const& host);
+
+protected:
+	HostRouterPrivate * m_private;
+};
+
+}
+
+#endif // FCGISERVER_HOST_ROUTER_H
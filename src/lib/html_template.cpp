@@ -0,0 +1,120 @@
+#include "html_template.h"
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+void TemplateValue::write(GenericFormatter & output) const
+{
+	switch (m_type)
+	{
+		case Type::String:
+			output << m_string;
+			break;
+		case Type::Signed:
+			output << m_signed;
+			break;
+		case Type::Unsigned:
+			output << m_unsigned;
+			break;
+		case Type::Double:
+			output << m_double;
+			break;
+	}
+}
+
+HtmlTemplate::HtmlTemplate(std::string source)
+    : m_source(std::move(source))
+    , m_valid(false)
+{
+	parse();
+}
+
+size_t HtmlTemplate::slot_index(std::string_view const& name) const
+{
+	for (size_t idx = 0; idx < m_slot_names.size(); ++idx)
+	{
+		if (m_slot_names[idx] == name)
+			return idx;
+	}
+	return npos;
+}
+
+bool HtmlTemplate::render(GenericFormatter & output, std::initializer_list<TemplateValue> values) const
+{
+	return render(output, values.begin(), values.size());
+}
+
+bool HtmlTemplate::render(GenericFormatter & output, TemplateValue const* values, size_t count) const
+{
+	if (!m_valid || count < m_slot_names.size())
+		return false;
+
+	GenericFormat format = output.generic_format();
+	std::string_view source = m_source;
+
+	for (Segment const& segment : m_segments)
+	{
+		if (segment.slot == npos)
+		{
+			output.set_generic_format(GenericFormat::Verbatim);
+			output << source.substr(segment.offset, segment.length);
+		}
+		else
+		{
+			output.set_generic_format(GenericFormat::HTMLContent);
+			values[segment.slot].write(output);
+		}
+	}
+
+	output.set_generic_format(format);
+	return true;
+}
+
+void HtmlTemplate::parse()
+{
+	std::string_view source = m_source;
+	size_t start = 0;
+
+	auto trim = [] (std::string_view s)
+	{
+		while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+			s.remove_prefix(1);
+		while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+			s.remove_suffix(1);
+		return s;
+	};
+
+	while (start < source.size())
+	{
+		size_t open = source.find("{{"sv, start);
+		if (open == std::string_view::npos)
+			break;
+
+		size_t close = source.find("}}"sv, open + 2);
+		std::string_view name = (close == std::string_view::npos) ? std::string_view() : trim(source.substr(open + 2, close - open - 2));
+		if (name.empty())
+		{
+			m_segments.clear();
+			m_slot_names.clear();
+			return;
+		}
+
+		if (open > start)
+			m_segments.push_back(Segment{start, open - start, npos});
+
+		size_t slot = slot_index(name);
+		if (slot == npos)
+		{
+			slot = m_slot_names.size();
+			m_slot_names.emplace_back(name);
+		}
+		m_segments.push_back(Segment{0, 0, slot});
+
+		start = close + 2;
+	}
+
+	if (start < source.size())
+		m_segments.push_back(Segment{start, source.size() - start, npos});
+
+	m_valid = true;
+}
@@ -0,0 +1,100 @@
+#ifndef FCGISERVER_HTML_TEMPLATE_H
+#define FCGISERVER_HTML_TEMPLATE_H
+
+#include "fcgiserver_defs.h"
+#include "generic_formatter.h"
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fcgiserver
+{
+
+/// A single value to fill a template slot with. Only refers to string data,
+/// so it must not outlive the string it was created from.
+class DLL_PUBLIC TemplateValue
+{
+public:
+	TemplateValue(std::string_view const& value) : m_type(Type::String), m_string(value) {}
+	TemplateValue(std::string const& value) : m_type(Type::String), m_string(value) {}
+	TemplateValue(char const* value) : m_type(Type::String), m_string(value) {}
+	TemplateValue(Symbol value) : m_type(Type::String), m_string(value.to_string_view()) {}
+	TemplateValue(int32_t value) : m_type(Type::Signed), m_signed(value) {}
+	TemplateValue(int64_t value) : m_type(Type::Signed), m_signed(value) {}
+	TemplateValue(uint32_t value) : m_type(Type::Unsigned), m_unsigned(value) {}
+	TemplateValue(uint64_t value) : m_type(Type::Unsigned), m_unsigned(value) {}
+	TemplateValue(double value) : m_type(Type::Double), m_double(value) {}
+
+	void write(GenericFormatter & output) const;
+
+private:
+	enum class Type : char
+	{
+		String,
+		Signed,
+		Unsigned,
+		Double,
+	};
+
+	Type m_type;
+	union
+	{
+		std::string_view m_string;
+		int64_t m_signed;
+		uint64_t m_unsigned;
+		double m_double;
+	};
+};
+
+/// An HTML template with named slots written as {{name}}. The template is
+/// parsed once into static segments and slots; rendering writes the static
+/// segments verbatim and the slot values with HTMLContent escaping.
+///
+/// Slots are numbered in order of first appearance, a name that is used more
+/// than once refers to the same slot.
+class DLL_PUBLIC HtmlTemplate
+{
+public:
+	static constexpr size_t npos = size_t(-1);
+
+	HtmlTemplate(std::string source);
+	HtmlTemplate(HtmlTemplate const& other) = delete;
+	HtmlTemplate(HtmlTemplate && other) = default;
+	HtmlTemplate & operator= (HtmlTemplate const& other) = delete;
+	HtmlTemplate & operator= (HtmlTemplate && other) = default;
+	~HtmlTemplate() = default;
+
+	/// False if the source has an unterminated or empty slot. An invalid
+	/// template renders nothing.
+	inline bool is_valid() const { return m_valid; }
+
+	inline size_t slot_count() const { return m_slot_names.size(); }
+	size_t slot_index(std::string_view const& name) const;
+	inline std::string_view slot_name(size_t index) const { return m_slot_names[index]; }
+
+	/// Render with one value per slot, in slot order. Fails without writing
+	/// anything if the template is invalid or there are too few values.
+	bool render(GenericFormatter & output, std::initializer_list<TemplateValue> values) const;
+	bool render(GenericFormatter & output, TemplateValue const* values, size_t count) const;
+
+private:
+	struct Segment
+	{
+		size_t offset;
+		size_t length;
+		size_t slot;
+	};
+
+	void parse();
+
+	std::string m_source;
+	std::vector<Segment> m_segments;
+	std::vector<std::string> m_slot_names;
+	bool m_valid;
+};
+
+} // namespace fcgiserver
+
+#endif // FCGISERVER_HTML_TEMPLATE_H
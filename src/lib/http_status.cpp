@@ -0,0 +1,76 @@
+#include "http_status.h"
+
+namespace fcgiserver
+{
+
+std::string_view http_status_line(uint16_t code)
+{
+	switch (code)
+	{
+		case 100: return "100 Continue"sv;
+		case 101: return "101 Switching Protocols"sv;
+		case 102: return "102 Processing"sv;
+		case 103: return "103 Early Hints"sv;
+		case 200: return "200 OK"sv;
+		case 201: return "201 Created"sv;
+		case 202: return "202 Accepted"sv;
+		case 203: return "203 Non-Authoritative Information"sv;
+		case 204: return "204 No Content"sv;
+		case 205: return "205 Reset Content"sv;
+		case 206: return "206 Partial Content"sv;
+		case 207: return "207 Multi-Status"sv;
+		case 208: return "208 Already Reported"sv;
+		case 226: return "226 IM Used"sv;
+		case 300: return "300 Multiple Choices"sv;
+		case 301: return "301 Moved Permanently"sv;
+		case 302: return "302 Found"sv;
+		case 303: return "303 See Other"sv;
+		case 304: return "304 Not Modified"sv;
+		case 305: return "305 Use Proxy"sv;
+		case 307: return "307 Temporary Redirect"sv;
+		case 308: return "308 Permanent Redirect"sv;
+		case 400: return "400 Bad Request"sv;
+		case 401: return "401 Unauthorized"sv;
+		case 402: return "402 Payment Required"sv;
+		case 403: return "403 Forbidden"sv;
+		case 404: return "404 Not Found"sv;
+		case 405: return "405 Method Not Allowed"sv;
+		case 406: return "406 Not Acceptable"sv;
+		case 407: return "407 Proxy Authentication Required"sv;
+		case 408: return "408 Request Timeout"sv;
+		case 409: return "409 Conflict"sv;
+		case 410: return "410 Gone"sv;
+		case 411: return "411 Length Required"sv;
+		case 412: return "412 Precondition Failed"sv;
+		case 413: return "413 Content Too Large"sv;
+		case 414: return "414 URI Too Long"sv;
+		case 415: return "415 Unsupported Media Type"sv;
+		case 416: return "416 Range Not Satisfiable"sv;
+		case 417: return "417 Expectation Failed"sv;
+		case 418: return "418 I'm a teapot"sv;
+		case 421: return "421 Misdirected Request"sv;
+		case 422: return "422 Unprocessable Content"sv;
+		case 423: return "423 Locked"sv;
+		case 424: return "424 Failed Dependency"sv;
+		case 425: return "425 Too Early"sv;
+		case 426: return "426 Upgrade Required"sv;
+		case 428: return "428 Precondition Required"sv;
+		case 429: return "429 Too Many Requests"sv;
+		case 431: return "431 Request Header Fields Too Large"sv;
+		case 451: return "451 Unavailable For Legal Reasons"sv;
+		case 500: return "500 Internal Server Error"sv;
+		case 501: return "501 Not Implemented"sv;
+		case 502: return "502 Bad Gateway"sv;
+		case 503: return "503 Service Unavailable"sv;
+		case 504: return "504 Gateway Timeout"sv;
+		case 505: return "505 HTTP Version Not Supported"sv;
+		case 506: return "506 Variant Also Negotiates"sv;
+		case 507: return "507 Insufficient Storage"sv;
+		case 508: return "508 Loop Detected"sv;
+		case 510: return "510 Not Extended"sv;
+		case 511: return "511 Network Authentication Required"sv;
+		default:  return std::string_view();
+	}
+}
+
+} // namespace fcgiserver
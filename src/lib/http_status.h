@@ -0,0 +1,37 @@
+#ifndef FCGISERVER_HTTP_STATUS_H
+#define FCGISERVER_HTTP_STATUS_H
+
+#include "fcgiserver_defs.h"
+#include "header_list.h"
+#include <cstdint>
+#include <string_view>
+
+using namespace std::literals::string_view_literals;
+
+namespace fcgiserver
+{
+
+/// Pre-rendered status line such as "404 Not Found", or empty if the code is not a registered HTTP status
+DLL_PUBLIC std::string_view http_status_line(uint16_t code);
+
+namespace header_values
+{
+
+// Common Content-Type values
+inline constexpr HeaderValue TextHtml{"text/html; charset=utf-8"sv};
+inline constexpr HeaderValue TextPlain{"text/plain; charset=utf-8"sv};
+inline constexpr HeaderValue TextCss{"text/css; charset=utf-8"sv};
+inline constexpr HeaderValue TextJavascript{"text/javascript; charset=utf-8"sv};
+inline constexpr HeaderValue ApplicationJson{"application/json"sv};
+inline constexpr HeaderValue ApplicationOctetStream{"application/octet-stream"sv};
+
+// Common Cache-Control values
+inline constexpr HeaderValue NoCache{"no-cache"sv};
+inline constexpr HeaderValue NoStore{"no-store"sv};
+inline constexpr HeaderValue Private{"private"sv};
+
+}
+
+} // namespace fcgiserver
+
+#endif // FCGISERVER_HTTP_STATUS_H
@@ -10,8 +10,13 @@ ILogCallback::~ILogCallback() = default;
 void ILogCallback::log_request(Request const& request)
 {
 	LineFormatter lf;
-	lf.append(request.remote_addr(), ':', request.remote_port(), " - ", request.http_status(), " - ", request.request_method_string(), ' ', request.document_uri());
-	log_message(LogLevel::Debug, lf.buffer());
+	lf.append(request.remote_addr(), ':', request.remote_port(), " - ", request.http_status_code(), " - ", request.request_method_string(), ' ', request.document_uri());
+	log_message(request_log_level(), lf.buffer());
+}
+
+LogLevel ILogCallback::request_log_level() const
+{
+	return LogLevel::Debug;
 }
 
 void ILogCallback::now(std::tm *tm)
@@ -24,6 +24,10 @@ public:
 	virtual void log_message(LogLevel level, std::string_view const& message) = 0;
 	virtual void log_request(Request const& request);
 
+	/// The level log_request() logs at; the Server skips it when the Logger
+	/// has that level disabled
+	virtual LogLevel request_log_level() const;
+
 protected:
 	// Helper functions
 	static void now(std::tm *tm);
@@ -0,0 +1,32 @@
+#ifndef FCGISERVER_I_MULTIPART_HANDLER_H
+#define FCGISERVER_I_MULTIPART_HANDLER_H
+
+#include "fcgiserver_defs.h"
+#include <string_view>
+
+namespace fcgiserver
+{
+
+/// Description of one part of a multipart body, only valid during IMultipartHandler::part_begin
+struct DLL_PUBLIC MultipartPart
+{
+	std::string_view name;
+	std::string_view filename;
+	std::string_view content_type;
+	std::string_view headers;
+};
+
+class DLL_PUBLIC IMultipartHandler
+{
+public:
+	virtual ~IMultipartHandler() = default;
+
+	// Returning false from any of these aborts parsing
+	virtual bool part_begin(MultipartPart const& part) = 0;
+	virtual bool part_data(std::string_view const& data) = 0;
+	virtual bool part_end() = 0;
+};
+
+} // namespace fcgiserver
+
+#endif // FCGISERVER_I_MULTIPART_HANDLER_H
@@ -0,0 +1,163 @@
+#include "json_writer.h"
+#include <cassert>
+#include <charconv>
+#include <cmath>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+JsonWriter::JsonWriter(GenericFormatter & output)
+    : m_output(output)
+    , m_need_comma(false)
+    , m_after_key(false)
+    , m_has_value(false)
+{
+	m_scopes.reserve(16);
+}
+
+JsonWriter & JsonWriter::begin_object()
+{
+	before_value();
+	m_output << '{';
+	m_scopes.push_back('}');
+	m_need_comma = false;
+	return *this;
+}
+
+JsonWriter & JsonWriter::end_object()
+{
+	assert(!m_scopes.empty() && m_scopes.back() == '}' && !m_after_key && "end_object without matching begin_object");
+	m_scopes.pop_back();
+	m_output << '}';
+	m_need_comma = true;
+	return *this;
+}
+
+JsonWriter & JsonWriter::begin_array()
+{
+	before_value();
+	m_output << '[';
+	m_scopes.push_back(']');
+	m_need_comma = false;
+	return *this;
+}
+
+JsonWriter & JsonWriter::end_array()
+{
+	assert(!m_scopes.empty() && m_scopes.back() == ']' && "end_array without matching begin_array");
+	m_scopes.pop_back();
+	m_output << ']';
+	m_need_comma = true;
+	return *this;
+}
+
+JsonWriter & JsonWriter::key(std::string_view const& key)
+{
+	assert(!m_scopes.empty() && m_scopes.back() == '}' && !m_after_key && "key outside of an object");
+	if (m_need_comma)
+		m_output << ',';
+	write_string(key);
+	m_output << ':';
+	m_after_key = true;
+	return *this;
+}
+
+JsonWriter & JsonWriter::value(std::string_view const& value)
+{
+	before_value();
+	write_string(value);
+	m_need_comma = true;
+	return *this;
+}
+
+JsonWriter & JsonWriter::value(std::string const& value)
+{
+	return this->value(std::string_view(value));
+}
+
+JsonWriter & JsonWriter::value(char const* value)
+{
+	return value ? this->value(std::string_view(value)) : null();
+}
+
+JsonWriter & JsonWriter::value(bool value)
+{
+	return raw_value(value ? "true"sv : "false"sv);
+}
+
+JsonWriter & JsonWriter::value(int32_t value)
+{
+	return this->value(int64_t(value));
+}
+
+JsonWriter & JsonWriter::value(uint32_t value)
+{
+	return this->value(uint64_t(value));
+}
+
+JsonWriter & JsonWriter::value(int64_t value)
+{
+	char tmp[24];
+	auto result = std::to_chars(tmp, tmp + sizeof(tmp), value);
+	return raw_value(std::string_view(tmp, result.ptr - tmp));
+}
+
+JsonWriter & JsonWriter::value(uint64_t value)
+{
+	char tmp[24];
+	auto result = std::to_chars(tmp, tmp + sizeof(tmp), value);
+	return raw_value(std::string_view(tmp, result.ptr - tmp));
+}
+
+JsonWriter & JsonWriter::value(double value)
+{
+	// JSON has no representation for these
+	if (!std::isfinite(value))
+		return null();
+
+	char tmp[32];
+	auto result = std::to_chars(tmp, tmp + sizeof(tmp), value);
+	return raw_value(std::string_view(tmp, result.ptr - tmp));
+}
+
+JsonWriter & JsonWriter::null()
+{
+	return raw_value("null"sv);
+}
+
+JsonWriter & JsonWriter::raw_value(std::string_view const& json)
+{
+	before_value();
+	GenericFormat format = m_output.generic_format();
+	m_output.set_generic_format(GenericFormat::Verbatim);
+	m_output << json;
+	m_output.set_generic_format(format);
+	m_need_comma = true;
+	return *this;
+}
+
+bool JsonWriter::complete() const
+{
+	return m_has_value && m_scopes.empty();
+}
+
+void JsonWriter::before_value()
+{
+	assert((m_scopes.empty() ? !m_has_value : (m_scopes.back() == ']' || m_after_key)) && "value in a position where none is allowed");
+
+	if (m_need_comma && !m_after_key)
+		m_output << ',';
+
+	m_after_key = false;
+	m_has_value = true;
+}
+
+void JsonWriter::write_string(std::string_view const& s)
+{
+	GenericFormat format = m_output.generic_format();
+	m_output << '"';
+	m_output.set_generic_format(GenericFormat::JSON);
+	m_output << s;
+	m_output.set_generic_format(format);
+	m_output << '"';
+}
@@ -0,0 +1,79 @@
+#ifndef FCGISERVER_JSON_WRITER_H
+#define FCGISERVER_JSON_WRITER_H
+
+#include "fcgiserver_defs.h"
+#include "generic_formatter.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fcgiserver
+{
+
+/// Streams a JSON document into any GenericFormatter, typically a
+/// RequestStream, without building it in memory first. Commas and key
+/// separators are inserted automatically:
+///
+///   JsonWriter json(stream);
+///   json.begin_object();
+///   json.field("id", 42).field("name", name);
+///   json.key("tags").begin_array().value("a").value("b").end_array();
+///   json.end_object();
+class DLL_PUBLIC JsonWriter
+{
+public:
+	JsonWriter(GenericFormatter & output);
+	JsonWriter(JsonWriter const& other) = delete;
+	JsonWriter(JsonWriter && other) = delete;
+	JsonWriter & operator= (JsonWriter const& other) = delete;
+	JsonWriter & operator= (JsonWriter && other) = delete;
+	~JsonWriter() = default;
+
+	JsonWriter & begin_object();
+	JsonWriter & end_object();
+	JsonWriter & begin_array();
+	JsonWriter & end_array();
+
+	/// Start a member of the current object, to be followed by exactly one value
+	JsonWriter & key(std::string_view const& key);
+
+	JsonWriter & value(std::string_view const& value);
+	JsonWriter & value(std::string const& value);
+	JsonWriter & value(char const* value);
+	JsonWriter & value(bool value);
+	JsonWriter & value(int32_t value);
+	JsonWriter & value(uint32_t value);
+	JsonWriter & value(int64_t value);
+	JsonWriter & value(uint64_t value);
+	JsonWriter & value(double value);
+	JsonWriter & null();
+
+	/// Insert an already encoded JSON value as-is
+	JsonWriter & raw_value(std::string_view const& json);
+
+	template <typename T>
+	inline JsonWriter & field(std::string_view const& name, T const& v)
+	{
+		key(name);
+		return value(v);
+	}
+
+	/// True when a single top level value has been written and all objects
+	/// and arrays have been closed
+	bool complete() const;
+
+private:
+	void before_value();
+	void write_string(std::string_view const& s);
+
+	GenericFormatter & m_output;
+	std::vector<char> m_scopes;
+	bool m_need_comma;
+	bool m_after_key;
+	bool m_has_value;
+};
+
+} // namespace fcgiserver
+
+#endif // FCGISERVER_JSON_WRITER_H
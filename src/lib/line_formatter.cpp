@@ -8,9 +8,15 @@ using namespace std::literals::string_view_literals;
 
 
 LineFormatter::LineFormatter(GenericFormat format)
+    : LineFormatter(format, 128)
+{
+}
+
+LineFormatter::LineFormatter(GenericFormat format, size_t reserve_size)
     : GenericFormatter(format)
 {
-	m_buffer.reserve(128);
+	if (reserve_size > 0)
+		m_buffer.reserve(reserve_size);
 }
 
 LineFormatter::LineFormatter(std::string && buffer, GenericFormat format)
@@ -40,3 +46,8 @@ void LineFormatter::real_append(const std::string_view & s)
 	m_buffer.append(s);
 }
 
+void LineFormatter::reserve(size_t size)
+{
+	m_buffer.reserve(m_buffer.size() + size);
+}
+
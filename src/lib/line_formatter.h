@@ -30,7 +30,10 @@ public:
 	bool empty() const;
 
 protected:
+	LineFormatter(GenericFormat format, size_t reserve_size);
+
 	void real_append(const std::string_view & s) override;
+	void reserve(size_t size) override;
 
 	std::string m_buffer;
 };
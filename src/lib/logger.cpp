@@ -14,11 +14,13 @@ public:
 
 Logger::Logger()
     : m_private(new LoggerPrivate)
+    , m_min_level(LogLevel::Debug)
 {
 }
 
 Logger::Logger(std::unique_ptr<ILogCallback> && callback)
     : m_private(new LoggerPrivate)
+    , m_min_level(LogLevel::Debug)
 {
 	m_private->callback = std::move(callback);
 }
@@ -38,9 +40,14 @@ ILogCallback * Logger::log_callback() const
 	return m_private->callback.get();
 }
 
+void Logger::set_min_level(LogLevel level)
+{
+	m_min_level.store(level, std::memory_order_relaxed);
+}
+
 void Logger::log(LogLevel level, std::string_view const& message) const
 {
-	if (!m_private->callback)
+	if (!m_private->callback || !enabled(level))
 		return;
 
 	size_t start = 0;
@@ -69,6 +76,9 @@ void Logger::log(LogLevel level, std::string_view const& message) const
 
 void Logger::logf(LogLevel level, const char *fmt, ...) const
 {
+	if (!enabled(level))
+		return;
+
 	std::va_list vl;
 	va_start(vl, fmt);
 	stream(level).vprintf(fmt, vl);
@@ -81,13 +91,27 @@ LogStream Logger::operator<< (LogLevel level) const
 }
 
 LogStream::LogStream(Logger const& log, LogLevel lvl)
-    : LineFormatter(GenericFormat::UTF8)
+    : LineFormatter(GenericFormat::UTF8, log.enabled(lvl) ? 128 : 0)
     , m_logger(log)
     , m_level(lvl)
+    , m_enabled(log.enabled(lvl))
 {
 }
 
 LogStream::~LogStream()
 {
-	m_logger.log(m_level, m_buffer);
+	if (m_enabled)
+		m_logger.log(m_level, m_buffer);
+}
+
+void LogStream::real_append(std::string_view const& s)
+{
+	if (m_enabled)
+		LineFormatter::real_append(s);
+}
+
+void LogStream::reserve(size_t size)
+{
+	if (m_enabled)
+		LineFormatter::reserve(size);
 }
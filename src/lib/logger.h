@@ -1,11 +1,25 @@
 #ifndef FCGISERVER_LOGGER_H
 #define FCGISERVER_LOGGER_H
 
+#include <atomic>
 #include <memory>
+#include <type_traits>
 #include "fcgiserver_defs.h"
 #include "i_log_callback.h"
 #include "line_formatter.h"
 
+// Log through a stream only if the level is enabled, without evaluating the
+// streamed arguments otherwise. The logger and level are evaluated once:
+//
+//   FCGISERVER_LOG_DEBUG(logger) << "Handled " << expensive_summary();
+#define FCGISERVER_LOG(logger, level) \
+	if (auto && fcgiserver_log_ = (logger); false) ; \
+	else if (auto const fcgiserver_log_level_ = (level); !fcgiserver_log_.enabled(fcgiserver_log_level_)) ; \
+	else fcgiserver_log_.stream(fcgiserver_log_level_)
+#define FCGISERVER_LOG_DEBUG(logger) FCGISERVER_LOG(logger, ::fcgiserver::LogLevel::Debug)
+#define FCGISERVER_LOG_INFO(logger) FCGISERVER_LOG(logger, ::fcgiserver::LogLevel::Info)
+#define FCGISERVER_LOG_ERROR(logger) FCGISERVER_LOG(logger, ::fcgiserver::LogLevel::Error)
+
 namespace fcgiserver
 {
 
@@ -25,9 +39,18 @@ public:
 	void set_log_callback(std::unique_ptr<ILogCallback> && callback);
 	ILogCallback * log_callback() const;
 
+	/// Messages below this level are discarded before they are formatted,
+	/// Debug (everything) by default
+	void set_min_level(LogLevel level);
+	inline LogLevel min_level() const { return m_min_level.load(std::memory_order_relaxed); }
+	inline bool enabled(LogLevel level) const { return level >= m_min_level.load(std::memory_order_relaxed); }
+
 	void log(LogLevel level, std::string_view const& message) const;
 	void logf(LogLevel level, const char *fmt, ...) const;
 
+	template <typename FORMAT, typename ...ARGS, typename = std::enable_if_t<std::is_base_of_v<format_string::FormatString, FORMAT>>>
+	inline void log(LogLevel level, FORMAT fmt, ARGS const& ...args) const;
+
 	LogStream operator<< (LogLevel level) const;
 	inline LogStream stream(LogLevel level) const;
 	inline LogStream debug() const;
@@ -36,17 +59,35 @@ public:
 
 private:
 	LoggerPrivate * m_private;
+	std::atomic<LogLevel> m_min_level;
 };
 
+/// Collects one message and logs it when it goes out of scope. For a level
+/// the logger discards, streaming into it formats nothing.
 class DLL_PUBLIC LogStream : public LineFormatter
 {
 public:
 	LogStream(Logger const& logger, LogLevel level);
 	~LogStream();
 
+	inline bool enabled() const { return m_enabled; }
+
+	template <typename T>
+	inline LogStream & operator<< (T const& value)
+	{
+		if (m_enabled)
+			static_cast<GenericFormatter&>(*this) << value;
+		return *this;
+	}
+
+protected:
+	void real_append(std::string_view const& s) override;
+	void reserve(size_t size) override;
+
 private:
 	Logger const& m_logger;
 	LogLevel m_level;
+	bool m_enabled;
 };
 
 inline LogStream Logger::stream(LogLevel level) const { return operator<< (level); }
@@ -54,6 +95,13 @@ inline LogStream Logger::debug() const { return operator<< (LogLevel::Debug); }
 inline LogStream Logger::info() const { return operator<< (LogLevel::Info); }
 inline LogStream Logger::error() const { return operator<< (LogLevel::Error); }
 
+template <typename FORMAT, typename ...ARGS, typename>
+inline void Logger::log(LogLevel level, FORMAT fmt, ARGS const& ...args) const
+{
+	if (enabled(level))
+		stream(level).format(fmt, args...);
+}
+
 }
 
 #endif // FCGISERVER_LOGGER_H
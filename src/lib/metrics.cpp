@@ -0,0 +1,407 @@
+#include "metrics.h"
+#include "generic_formatter.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+namespace
+{
+
+// Only the owning thread writes a shard, so a plain load and store is enough
+// to count and readers never see a torn value
+inline void bump(std::atomic<uint64_t> & counter, uint64_t amount = 1)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+struct RouteCounters
+{
+	std::atomic<uint64_t> status_classes[6] {};
+	std::atomic<uint64_t> started {0};
+	std::atomic<uint64_t> finished {0};
+	std::atomic<uint64_t> bytes_out {0};
+	std::atomic<uint64_t> duration_sum_ns {0};
+	std::atomic<uint64_t> buckets[Metrics::bucket_count] {};
+};
+
+struct Shard
+{
+	~Shard()
+	{
+		for (auto & route : routes)
+			delete route.load();
+	}
+
+	// Allocated on first use so every thread only pays for the routes it serves
+	RouteCounters & route(uint32_t id)
+	{
+		RouteCounters * counters = routes[id].load(std::memory_order_relaxed);
+		if (!counters)
+		{
+			counters = new RouteCounters;
+			routes[id].store(counters, std::memory_order_release);
+		}
+		return *counters;
+	}
+
+	std::atomic<RouteCounters*> routes[Metrics::max_routes] {};
+	std::atomic<bool> in_use {false};
+	Shard * next = nullptr;
+};
+
+// The shard of the current thread, handed back on thread exit so the next
+// thread can continue counting in it
+struct ThreadShard
+{
+	~ThreadShard()
+	{
+		if (shard)
+			shard->in_use.store(false, std::memory_order_release);
+	}
+
+	Shard * shard = nullptr;
+};
+
+thread_local ThreadShard g_thread_shard;
+
+}
+
+
+class fcgiserver::MetricsPrivate
+{
+public:
+	MetricsPrivate()
+	    : shards(nullptr)
+	{
+		labels.emplace_back("unmatched");
+		ids.emplace(labels.back(), Metrics::unmatched);
+	}
+
+	~MetricsPrivate()
+	{
+		Shard * shard = shards.load();
+		while (shard)
+		{
+			Shard * next = shard->next;
+			delete shard;
+			shard = next;
+		}
+	}
+
+	Shard & thread_shard()
+	{
+		ThreadShard & thread_shard = g_thread_shard;
+		if (!thread_shard.shard)
+			thread_shard.shard = acquire_shard();
+		return *thread_shard.shard;
+	}
+
+	Shard * acquire_shard()
+	{
+		for (Shard * shard = shards.load(); shard; shard = shard->next)
+		{
+			bool expected = false;
+			if (!shard->in_use.load(std::memory_order_relaxed) && shard->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+				return shard;
+		}
+
+		// Shards are never removed, so pushing to the front is all it takes
+		Shard * shard = new Shard;
+		shard->in_use.store(true);
+		shard->next = shards.load();
+		while (!shards.compare_exchange_weak(shard->next, shard))
+			;
+		return shard;
+	}
+
+	std::atomic<Shard*> shards;
+
+	mutable std::mutex labels_mutex;
+	std::vector<std::string> labels;
+	std::map<std::string,uint32_t,std::less<>> ids;
+
+	mutable std::mutex sources_mutex;
+	std::map<void const*,Metrics::Source> sources;
+};
+
+
+uint64_t Metrics::Histogram::percentile(double fraction) const
+{
+	uint64_t total = 0;
+	for (uint64_t samples : buckets)
+		total += samples;
+	if (total == 0)
+		return 0;
+
+	uint64_t target = uint64_t(fraction * total);
+	if (target >= total)
+		target = total - 1;
+
+	uint64_t seen = 0;
+	for (size_t idx = 0; idx < bucket_count; ++idx)
+	{
+		seen += buckets[idx];
+		if (seen > target)
+			return bucket_upper_bound(idx);
+	}
+	return bucket_upper_bound(bucket_count - 1);
+}
+
+Metrics & Metrics::instance()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+Metrics::Metrics()
+    : m_private(new MetricsPrivate)
+{
+}
+
+Metrics::~Metrics()
+{
+	delete m_private;
+}
+
+uint32_t Metrics::route_id(std::string_view const& label)
+{
+	std::lock_guard<std::mutex> guard(m_private->labels_mutex);
+
+	auto iter = m_private->ids.find(label);
+	if (iter != m_private->ids.end())
+		return iter->second;
+
+	if (m_private->labels.size() >= max_routes)
+		return unmatched;
+
+	uint32_t id = m_private->labels.size();
+	m_private->labels.emplace_back(label);
+	m_private->ids.emplace(std::string(label), id);
+	return id;
+}
+
+void Metrics::request_started(uint32_t route)
+{
+	bump(m_private->thread_shard().route(route).started);
+}
+
+void Metrics::request_finished(uint32_t route, uint16_t status, std::chrono::nanoseconds duration, size_t bytes_out)
+{
+	RouteCounters & counters = m_private->thread_shard().route(route);
+
+	uint64_t nanoseconds = duration.count() > 0 ? duration.count() : 0;
+	size_t status_class = (status >= 100 && status < 600) ? status / 100 : 0;
+
+	bump(counters.status_classes[status_class]);
+	bump(counters.bytes_out, bytes_out);
+	bump(counters.duration_sum_ns, nanoseconds);
+	bump(counters.buckets[bucket_index(nanoseconds / 1000)]);
+	bump(counters.finished);
+}
+
+Metrics::RouteSnapshot Metrics::snapshot(uint32_t route) const
+{
+	RouteSnapshot result {};
+	result.label = route_label(route);
+
+	if (route >= max_routes)
+		return result;
+
+	uint64_t started = 0;
+	uint64_t finished = 0;
+	for (Shard * shard = m_private->shards.load(); shard; shard = shard->next)
+	{
+		RouteCounters const* counters = shard->routes[route].load(std::memory_order_acquire);
+		if (!counters)
+			continue;
+
+		for (size_t idx = 0; idx < result.status_classes.size(); ++idx)
+			result.status_classes[idx] += counters->status_classes[idx].load(std::memory_order_relaxed);
+		for (size_t idx = 0; idx < bucket_count; ++idx)
+			result.latency.buckets[idx] += counters->buckets[idx].load(std::memory_order_relaxed);
+
+		started += counters->started.load(std::memory_order_relaxed);
+		finished += counters->finished.load(std::memory_order_relaxed);
+		result.bytes_out += counters->bytes_out.load(std::memory_order_relaxed);
+		result.latency.sum_ns += counters->duration_sum_ns.load(std::memory_order_relaxed);
+	}
+
+	result.requests = finished;
+	result.latency.count = finished;
+	result.in_flight = started > finished ? started - finished : 0;
+	return result;
+}
+
+std::string Metrics::route_label(uint32_t route) const
+{
+	std::lock_guard<std::mutex> guard(m_private->labels_mutex);
+	return route < m_private->labels.size() ? m_private->labels[route] : std::string();
+}
+
+size_t Metrics::route_count() const
+{
+	std::lock_guard<std::mutex> guard(m_private->labels_mutex);
+	return m_private->labels.size();
+}
+
+void Metrics::write_prometheus(GenericFormatter & output) const
+{
+	static constexpr std::string_view status_names[] = { "other"sv, "1xx"sv, "2xx"sv, "3xx"sv, "4xx"sv, "5xx"sv };
+
+	GenericFormat format = output.generic_format();
+	output.set_generic_format(GenericFormat::Verbatim);
+
+	std::vector<RouteSnapshot> routes;
+	routes.reserve(route_count());
+	for (uint32_t id = 0; id < route_count(); ++id)
+	{
+		RouteSnapshot route = snapshot(id);
+		if (route.requests != 0 || route.in_flight != 0)
+			routes.push_back(std::move(route));
+	}
+
+	output << "# HELP fcgiserver_requests_total Requests handled, by route and status class.\n"sv;
+	output << "# TYPE fcgiserver_requests_total counter\n"sv;
+	for (RouteSnapshot const& route : routes)
+	{
+		for (size_t idx = 0; idx < route.status_classes.size(); ++idx)
+		{
+			if (route.status_classes[idx] == 0)
+				continue;
+			output << "fcgiserver_requests_total{route=\""sv;
+			write_label_value(output, route.label);
+			output << "\",status=\""sv << status_names[idx] << "\"} "sv << route.status_classes[idx] << '\n';
+		}
+	}
+
+	output << "# HELP fcgiserver_requests_in_flight Requests currently being handled.\n"sv;
+	output << "# TYPE fcgiserver_requests_in_flight gauge\n"sv;
+	for (RouteSnapshot const& route : routes)
+	{
+		output << "fcgiserver_requests_in_flight{route=\""sv;
+		write_label_value(output, route.label);
+		output << "\"} "sv << route.in_flight << '\n';
+	}
+
+	output << "# HELP fcgiserver_response_bytes_total Response body bytes written.\n"sv;
+	output << "# TYPE fcgiserver_response_bytes_total counter\n"sv;
+	for (RouteSnapshot const& route : routes)
+	{
+		output << "fcgiserver_response_bytes_total{route=\""sv;
+		write_label_value(output, route.label);
+		output << "\"} "sv << route.bytes_out << '\n';
+	}
+
+	output << "# HELP fcgiserver_request_duration_seconds Time spent handling requests.\n"sv;
+	output << "# TYPE fcgiserver_request_duration_seconds histogram\n"sv;
+	for (RouteSnapshot const& route : routes)
+		write_histogram(output, "fcgiserver_request_duration_seconds"sv, "route"sv, route.label, route.latency);
+
+	{
+		std::lock_guard<std::mutex> guard(m_private->sources_mutex);
+		for (auto const& source : m_private->sources)
+			source.second(output);
+	}
+
+	output.set_generic_format(format);
+}
+
+void Metrics::add_source(void const* owner, Source source)
+{
+	std::lock_guard<std::mutex> guard(m_private->sources_mutex);
+	m_private->sources[owner] = std::move(source);
+}
+
+void Metrics::remove_source(void const* owner)
+{
+	std::lock_guard<std::mutex> guard(m_private->sources_mutex);
+	m_private->sources.erase(owner);
+}
+
+void Metrics::write_histogram(GenericFormatter & output, std::string_view const& name, std::string_view const& label, std::string_view const& value, Histogram const& histogram)
+{
+	// Exported on power of two boundaries from 8us up to about a minute,
+	// which line up with the internal buckets
+	static constexpr size_t first_boundary = 3;
+	static constexpr size_t last_boundary = 26;
+
+	auto write_series = [&] (std::string_view const& suffix)
+	{
+		output << name << suffix << '{' << label << "=\""sv;
+		write_label_value(output, value);
+		output << '"';
+	};
+
+	uint64_t cumulative = 0;
+	size_t bucket = 0;
+	for (size_t boundary = first_boundary; boundary <= last_boundary; ++boundary)
+	{
+		uint64_t limit = uint64_t(1) << boundary;
+		while (bucket < bucket_count && bucket_upper_bound(bucket) <= limit)
+			cumulative += histogram.buckets[bucket++];
+
+		write_series("_bucket"sv);
+		output << ",le=\""sv << double(limit) / 1e6 << "\"} "sv << cumulative << '\n';
+	}
+
+	// The count is read apart from the buckets while requests finish, so the
+	// total is taken from the buckets to keep them cumulative
+	while (bucket < bucket_count)
+		cumulative += histogram.buckets[bucket++];
+
+	write_series("_bucket"sv);
+	output << ",le=\"+Inf\"} "sv << cumulative << '\n';
+
+	write_series("_sum"sv);
+	output << "} "sv << double(histogram.sum_ns) / 1e9 << '\n';
+
+	write_series("_count"sv);
+	output << "} "sv << cumulative << '\n';
+}
+
+void Metrics::write_label_value(GenericFormatter & output, std::string_view const& value)
+{
+	for (char c : value)
+	{
+		switch (c)
+		{
+			case '\\':
+				output << "\\\\"sv;
+				break;
+			case '"':
+				output << "\\\""sv;
+				break;
+			case '\n':
+				output << "\\n"sv;
+				break;
+			default:
+				output << c;
+				break;
+		}
+	}
+}
+
+size_t Metrics::bucket_index(uint64_t microseconds)
+{
+	if (microseconds < 8)
+		return microseconds;
+
+	size_t exponent = 63 - __builtin_clzll(microseconds);
+	size_t index = 8 + (exponent - 3) * 4 + ((microseconds >> (exponent - 2)) & 3);
+	return index < bucket_count ? index : bucket_count - 1;
+}
+
+uint64_t Metrics::bucket_upper_bound(size_t index)
+{
+	if (index < 8)
+		return index + 1;
+
+	size_t exponent = 3 + (index - 8) / 4;
+	size_t sub = (index - 8) % 4;
+	return uint64_t(5 + sub) << (exponent - 2);
+}
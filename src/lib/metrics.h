@@ -0,0 +1,106 @@
+#ifndef FCGISERVER_METRICS_H
+#define FCGISERVER_METRICS_H
+
+#include "fcgiserver_defs.h"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace fcgiserver
+{
+
+class GenericFormatter;
+class MetricsPrivate;
+
+/// Process wide request metrics per route: request counts by status class,
+/// requests in flight, bytes written and a latency histogram. Routers record
+/// the routes they dispatch to, the Server records requests that no route
+/// took. Latency is the time spent routing and handling the request in
+/// either case.
+///
+/// Every thread records into its own shard without locks or read-modify-write
+/// atomics; shards are only merged when the metrics are read.
+class DLL_PUBLIC Metrics
+{
+public:
+	/// Route that collects requests that were not dispatched to any route,
+	/// as well as routes registered beyond max_routes
+	static constexpr uint32_t unmatched = 0;
+	static constexpr uint32_t max_routes = 4096;
+
+	/// Latency buckets are log-linear in microseconds: exact below 8us, then
+	/// four buckets per power of two. Relative error stays below 25%.
+	static constexpr size_t bucket_count = 8 + 4 * 37;
+
+	struct Histogram
+	{
+		std::array<uint64_t,bucket_count> buckets;
+		uint64_t count;
+		uint64_t sum_ns;
+
+		/// Upper bound in microseconds of the bucket that holds the given
+		/// fraction (0..1) of the samples
+		uint64_t percentile(double fraction) const;
+	};
+
+	struct RouteSnapshot
+	{
+		std::string label;
+		std::array<uint64_t,6> status_classes; // Other, 1xx, 2xx, 3xx, 4xx, 5xx
+		uint64_t requests;
+		uint64_t in_flight;
+		uint64_t bytes_out;
+		Histogram latency;
+	};
+
+	/// Writes additional metrics at the end of write_prometheus()
+	using Source = std::function<void(GenericFormatter&)>;
+
+	static Metrics & instance();
+	Metrics(Metrics const& other) = delete;
+	Metrics & operator= (Metrics const& other) = delete;
+
+	/// Returns the id for a route label, registering it on first use. Not
+	/// meant for the request path, labels are registered along with routes.
+	uint32_t route_id(std::string_view const& label);
+
+	void request_started(uint32_t route);
+	void request_finished(uint32_t route, uint16_t status, std::chrono::nanoseconds duration, size_t bytes_out);
+
+	/// Merged view of all shards. Counters are read one at a time, so a
+	/// request that finishes meanwhile may show up in some but not all.
+	RouteSnapshot snapshot(uint32_t route) const;
+	size_t route_count() const;
+	std::string route_label(uint32_t route) const;
+
+	/// Prometheus text exposition format, version 0.0.4
+	void write_prometheus(GenericFormatter & output) const;
+
+	/// Register a Source under an owner, which must remove it again before
+	/// it goes away
+	void add_source(void const* owner, Source source);
+	void remove_source(void const* owner);
+
+	/// One histogram in Prometheus format as "name_bucket{label="value",le=...}",
+	/// the HELP and TYPE lines are up to the caller
+	static void write_histogram(GenericFormatter & output, std::string_view const& name, std::string_view const& label, std::string_view const& value, Histogram const& histogram);
+	static void write_label_value(GenericFormatter & output, std::string_view const& value);
+
+	static size_t bucket_index(uint64_t microseconds);
+	/// Exclusive, in microseconds
+	static uint64_t bucket_upper_bound(size_t index);
+
+private:
+	Metrics();
+	~Metrics();
+
+	MetricsPrivate * m_private;
+};
+
+}
+
+#endif // FCGISERVER_METRICS_H
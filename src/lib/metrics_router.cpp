@@ -0,0 +1,43 @@
+#include "metrics_router.h"
+#include "http_status.h"
+#include "metrics.h"
+#include "request.h"
+#include "request_context.h"
+#include "symbols.h"
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+namespace
+{
+
+constexpr HeaderValue PrometheusText{"text/plain; version=0.0.4; charset=utf-8"sv};
+constexpr HeaderValue AllowGet{"GET, HEAD"sv};
+
+}
+
+MetricsRouter::MetricsRouter(std::string_view const& path)
+    : FixedPathRouter(path)
+{
+}
+
+IRouter::RouteResult MetricsRouter::handle_path(RequestContext & context)
+{
+	Request & request = context.request();
+
+	RequestMethod method = request.request_method();
+	if (method != RequestMethod::GET && method != RequestMethod::HEAD)
+	{
+		request.set_header(symbols::Allow, AllowGet);
+		return IRouter::RouteResult::InvalidMethod;
+	}
+
+	request.set_http_status(200);
+	request.set_content_type(PrometheusText);
+	request.set_header(symbols::CacheControl, header_values::NoStore);
+
+	RequestStream stream = request.write_stream();
+	stream.set_generic_format(GenericFormat::Verbatim);
+	Metrics::instance().write_prometheus(stream);
+	return IRouter::RouteResult::Handled;
+}
@@ -0,0 +1,26 @@
+#ifndef FCGISERVER_METRICS_ROUTER_H
+#define FCGISERVER_METRICS_ROUTER_H
+
+#include "fcgiserver_defs.h"
+#include "fixed_path_router.h"
+#include <string_view>
+
+namespace fcgiserver
+{
+
+/// Serves the process wide Metrics in Prometheus text format on GET of a
+/// single path, relative to where the router is mounted. Any other path is
+/// NotFound so it can be chained in front of or mounted into other routers.
+class DLL_PUBLIC MetricsRouter : public FixedPathRouter
+{
+public:
+	MetricsRouter(std::string_view const& path = "/metrics");
+	~MetricsRouter() = default;
+
+protected:
+	IRouter::RouteResult handle_path(RequestContext & context) override;
+};
+
+}
+
+#endif // FCGISERVER_METRICS_ROUTER_H
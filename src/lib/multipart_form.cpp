@@ -0,0 +1,128 @@
+#include "multipart_form.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace fcgiserver;
+
+
+MultipartForm::MultipartForm(std::string upload_directory, size_t max_field_size, size_t max_parts, size_t max_file_bytes)
+    : m_upload_directory(std::move(upload_directory))
+    , m_max_field_size(max_field_size)
+    , m_max_parts(max_parts)
+    , m_max_file_bytes(max_file_bytes)
+    , m_file_bytes(0)
+    , m_fd(-1)
+    , m_in_file(false)
+{
+}
+
+MultipartForm::~MultipartForm()
+{
+	close_file();
+
+	for (auto const& file : m_files)
+		if (!file.path.empty())
+			::unlink(file.path.c_str());
+}
+
+bool MultipartForm::part_begin(MultipartPart const& part)
+{
+	close_file();
+
+	if (m_fields.size() + m_files.size() >= m_max_parts)
+		return false;
+
+	// A filename parameter, even an empty one, marks a file input
+	m_in_file = part.filename.data() != nullptr;
+	if (!m_in_file)
+	{
+		m_fields.push_back(Field{std::string(part.name), std::string()});
+		return true;
+	}
+
+	std::string path = m_upload_directory;
+	path.append("/fcgiserver-upload-XXXXXX");
+
+	m_fd = ::mkstemp(path.data());
+	if (m_fd < 0)
+		return false;
+
+	m_files.push_back(File{std::string(part.name), std::string(part.filename), std::string(part.content_type), std::move(path), 0});
+	return true;
+}
+
+bool MultipartForm::part_data(std::string_view const& data)
+{
+	if (!m_in_file)
+	{
+		std::string & value = m_fields.back().value;
+		if (value.size() + data.size() > m_max_field_size)
+			return false;
+
+		value.append(data);
+		return true;
+	}
+
+	if (m_file_bytes + data.size() > m_max_file_bytes)
+		return false;
+
+	File & file = m_files.back();
+
+	size_t offset = 0;
+	while (offset < data.size())
+	{
+		ssize_t written = ::write(m_fd, data.data() + offset, data.size() - offset);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		offset += written;
+	}
+
+	file.size += data.size();
+	m_file_bytes += data.size();
+	return true;
+}
+
+bool MultipartForm::part_end()
+{
+	close_file();
+	return true;
+}
+
+std::pair<bool,std::string_view> MultipartForm::field(std::string_view const& name) const
+{
+	for (auto const& item : m_fields)
+	{
+		if (item.name == name)
+			return std::make_pair(true, std::string_view(item.value));
+	}
+
+	return std::make_pair(false, std::string_view());
+}
+
+bool MultipartForm::take_file(size_t index, std::string const& destination)
+{
+	if (index >= m_files.size() || m_files[index].path.empty())
+		return false;
+
+	if (std::rename(m_files[index].path.c_str(), destination.c_str()) != 0)
+		return false;
+
+	m_files[index].path.clear();
+	return true;
+}
+
+void MultipartForm::close_file()
+{
+	if (m_fd >= 0)
+	{
+		::close(m_fd);
+		m_fd = -1;
+	}
+	m_in_file = false;
+}
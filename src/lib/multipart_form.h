@@ -0,0 +1,73 @@
+#ifndef FCGISERVER_MULTIPART_FORM_H
+#define FCGISERVER_MULTIPART_FORM_H
+
+#include "fcgiserver_defs.h"
+#include "i_multipart_handler.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace fcgiserver
+{
+
+/// Multipart handler that keeps regular fields in memory and spools file
+/// uploads straight to temporary files. Spooled files that have not been
+/// taken by the time the form is destroyed are removed.
+///
+/// A single field, the number of parts and the bytes spooled to all files
+/// together are limited; exceeding any of them fails the parse.
+class DLL_PUBLIC MultipartForm : public IMultipartHandler
+{
+public:
+	struct Field
+	{
+		std::string name;
+		std::string value;
+	};
+
+	struct File
+	{
+		std::string name;
+		std::string filename;
+		std::string content_type;
+		std::string path;
+		size_t size;
+	};
+
+	MultipartForm(std::string upload_directory = "/tmp", size_t max_field_size = 65536, size_t max_parts = 256, size_t max_file_bytes = 256 * 1024 * 1024);
+	MultipartForm(MultipartForm const& other) = delete;
+	MultipartForm(MultipartForm && other) = delete;
+	MultipartForm & operator= (MultipartForm const& other) = delete;
+	MultipartForm & operator= (MultipartForm && other) = delete;
+	~MultipartForm();
+
+	bool part_begin(MultipartPart const& part) override;
+	bool part_data(std::string_view const& data) override;
+	bool part_end() override;
+
+	inline std::vector<Field> const& fields() const { return m_fields; }
+	inline std::vector<File> const& files() const { return m_files; }
+	std::pair<bool,std::string_view> field(std::string_view const& name) const;
+
+	/// Move a spooled file to its final destination on the same filesystem
+	bool take_file(size_t index, std::string const& destination);
+
+private:
+	void close_file();
+
+	std::string m_upload_directory;
+	size_t m_max_field_size;
+	size_t m_max_parts;
+	size_t m_max_file_bytes;
+	size_t m_file_bytes;
+	std::vector<Field> m_fields;
+	std::vector<File> m_files;
+	int m_fd;
+	bool m_in_file;
+};
+
+} // namespace fcgiserver
+
+#endif // FCGISERVER_MULTIPART_FORM_H
@@ -0,0 +1,310 @@
+#include "multipart_parser.h"
+#include "request.h"
+#include <algorithm>
+#include <memory>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+
+namespace
+{
+
+std::string_view trim(std::string_view value)
+{
+	while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+		value.remove_prefix(1);
+	while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+		value.remove_suffix(1);
+	return value;
+}
+
+bool iequals(std::string_view const& lhs, std::string_view const& rhs)
+{
+	return lhs.size() == rhs.size() && std::equal(lhs.cbegin(), lhs.cend(), rhs.cbegin(), [] (char a, char b)
+	{
+		return (a | 0x20) == (b | 0x20);
+	});
+}
+
+// Find a parameter in a header value such as: form-data; name="field"; filename="file.txt"
+std::string_view header_param(std::string_view const& value, std::string_view const& key)
+{
+	size_t pos = value.find(';');
+	while (pos != std::string_view::npos)
+	{
+		size_t eq = value.find('=', pos + 1);
+		if (eq == std::string_view::npos)
+			break;
+
+		std::string_view name = trim(value.substr(pos + 1, eq - pos - 1));
+		std::string_view param;
+
+		pos = eq + 1;
+		if (pos < value.size() && value[pos] == '"')
+		{
+			size_t close = value.find('"', pos + 1);
+			param = value.substr(pos + 1, close == std::string_view::npos ? std::string_view::npos : close - pos - 1);
+			pos = (close == std::string_view::npos) ? close : value.find(';', close);
+		}
+		else
+		{
+			size_t end = value.find(';', pos);
+			param = trim(value.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos));
+			pos = end;
+		}
+
+		if (iequals(name, key))
+			return param;
+	}
+
+	return std::string_view();
+}
+
+}
+
+
+MultipartParser::MultipartParser(IMultipartHandler & handler, std::string_view const& boundary)
+    : m_handler(handler)
+    , m_state(State::Preamble)
+{
+	if (boundary.empty() || boundary.size() > 70)
+	{
+		m_state = State::Error;
+		return;
+	}
+
+	m_delimiter.reserve(boundary.size() + 4);
+	m_delimiter.append("\r\n--"sv);
+	m_delimiter.append(boundary);
+
+	// The first delimiter is not preceded by a newline, pretend that it was
+	m_buffer.append("\r\n"sv);
+}
+
+MultipartParser::~MultipartParser() = default;
+
+std::string_view MultipartParser::boundary_from_content_type(std::string_view const& content_type)
+{
+	return header_param(content_type, "boundary"sv);
+}
+
+bool MultipartParser::feed(std::string_view chunk)
+{
+	while (!chunk.empty() && m_state != State::Error)
+	{
+		if (m_buffer.empty())
+		{
+			// Fast path, process straight from the input and only keep what is left over
+			size_t used = process(chunk);
+			if (m_state != State::Error)
+				m_buffer.assign(chunk.substr(used));
+			break;
+		}
+
+		// Something straddles the chunk boundary, complete it in small steps
+		// until the buffer is drained and the fast path can take over again
+		size_t take = std::min(chunk.size(), std::max<size_t>(m_delimiter.size(), 256));
+		m_buffer.append(chunk.substr(0, take));
+		chunk.remove_prefix(take);
+
+		size_t used = process(m_buffer);
+		m_buffer.erase(0, used);
+	}
+
+	return m_state != State::Error;
+}
+
+bool MultipartParser::finish()
+{
+	if (m_state != State::Epilogue)
+		m_state = State::Error;
+
+	m_buffer.clear();
+	return m_state == State::Epilogue;
+}
+
+bool MultipartParser::parse(Request & request)
+{
+	constexpr size_t chunk_size = 16384;
+	std::unique_ptr<char[]> chunk(new char[chunk_size]);
+
+	while (m_state != State::Epilogue)
+	{
+		int retval = request.read(chunk.get(), chunk_size);
+		if (retval <= 0)
+			break;
+
+		if (!feed(std::string_view(chunk.get(), retval)))
+			return false;
+	}
+
+	return finish();
+}
+
+size_t MultipartParser::process(std::string_view const& data)
+{
+	size_t pos = 0;
+	while (pos < data.size())
+	{
+		switch (m_state)
+		{
+			case State::Preamble:
+			{
+				size_t found = data.find(m_delimiter, pos);
+				if (found == std::string_view::npos)
+					return partial_delimiter(data, pos);
+
+				pos = found + m_delimiter.size();
+				m_state = State::AfterBoundary;
+				break;
+			}
+
+			case State::AfterBoundary:
+			{
+				if (data.size() - pos < 2)
+					return pos;
+
+				if (data.compare(pos, 2, "--"sv) == 0)
+				{
+					pos += 2;
+					m_state = State::Epilogue;
+				}
+				else
+				{
+					m_state = State::BoundaryLine;
+				}
+				break;
+			}
+
+			case State::BoundaryLine:
+			{
+				// Skip any transport padding up to the end of the delimiter line
+				size_t found = data.find("\r\n"sv, pos);
+				if (found == std::string_view::npos)
+					return data.back() == '\r' ? data.size() - 1 : data.size();
+
+				pos = found + 2;
+				m_state = State::Headers;
+				break;
+			}
+
+			case State::Headers:
+			{
+				std::string_view remaining = data.substr(pos);
+				size_t header_end;
+				size_t body_start;
+
+				if (remaining.substr(0, 2) == "\r\n"sv)
+				{
+					header_end = 0;
+					body_start = 2;
+				}
+				else
+				{
+					size_t found = remaining.find("\r\n\r\n"sv);
+					if (found == std::string_view::npos)
+					{
+						if (remaining.size() > max_header_size)
+							m_state = State::Error;
+						return pos;
+					}
+
+					header_end = found + 2;
+					body_start = found + 4;
+				}
+
+				if (!begin_part(remaining.substr(0, header_end)))
+				{
+					m_state = State::Error;
+					return pos;
+				}
+
+				pos += body_start;
+				m_state = State::Body;
+				break;
+			}
+
+			case State::Body:
+			{
+				size_t found = data.find(m_delimiter, pos);
+				size_t end = (found == std::string_view::npos) ? partial_delimiter(data, pos) : found;
+
+				if (end > pos && !m_handler.part_data(data.substr(pos, end - pos)))
+				{
+					m_state = State::Error;
+					return pos;
+				}
+
+				if (found == std::string_view::npos)
+					return end;
+
+				if (!m_handler.part_end())
+				{
+					m_state = State::Error;
+					return end;
+				}
+
+				pos = found + m_delimiter.size();
+				m_state = State::AfterBoundary;
+				break;
+			}
+
+			case State::Epilogue:
+				return data.size();
+
+			case State::Error:
+				return pos;
+		}
+	}
+
+	return pos;
+}
+
+size_t MultipartParser::partial_delimiter(std::string_view const& data, size_t start) const
+{
+	// Position of the earliest trailing bytes that might turn into a delimiter with more data
+	size_t first = data.size() >= m_delimiter.size() ? data.size() - m_delimiter.size() + 1 : 0;
+	std::string_view delimiter(m_delimiter);
+
+	for (size_t idx = std::max(first, start); idx < data.size(); ++idx)
+	{
+		if (data[idx] == '\r' && delimiter.substr(0, data.size() - idx) == data.substr(idx))
+			return idx;
+	}
+
+	return data.size();
+}
+
+bool MultipartParser::begin_part(std::string_view const& headers)
+{
+	MultipartPart part;
+	part.headers = headers;
+
+	std::string_view remaining = headers;
+	while (!remaining.empty())
+	{
+		size_t eol = remaining.find("\r\n"sv);
+		std::string_view line = remaining.substr(0, eol);
+		remaining = (eol == std::string_view::npos) ? std::string_view() : remaining.substr(eol + 2);
+
+		size_t colon = line.find(':');
+		if (colon == std::string_view::npos)
+			continue;
+
+		std::string_view name = trim(line.substr(0, colon));
+		std::string_view value = trim(line.substr(colon + 1));
+
+		if (iequals(name, "Content-Disposition"sv))
+		{
+			part.name = header_param(value, "name"sv);
+			part.filename = header_param(value, "filename"sv);
+		}
+		else if (iequals(name, "Content-Type"sv))
+		{
+			part.content_type = value;
+		}
+	}
+
+	return m_handler.part_begin(part);
+}
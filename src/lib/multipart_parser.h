@@ -0,0 +1,65 @@
+#ifndef FCGISERVER_MULTIPART_PARSER_H
+#define FCGISERVER_MULTIPART_PARSER_H
+
+#include "fcgiserver_defs.h"
+#include "i_multipart_handler.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace fcgiserver
+{
+
+class Request;
+
+/// Incremental multipart/form-data parser. Part data is handed to the
+/// handler as it arrives, straight from the fed chunks where possible,
+/// so uploads are never held in memory as a whole.
+class DLL_PUBLIC MultipartParser
+{
+public:
+	enum class State
+	{
+		Preamble,
+		AfterBoundary,
+		BoundaryLine,
+		Headers,
+		Body,
+		Epilogue,
+		Error,
+	};
+
+	static constexpr size_t max_header_size = 8192;
+
+	MultipartParser(IMultipartHandler & handler, std::string_view const& boundary);
+	MultipartParser(MultipartParser const& other) = delete;
+	MultipartParser(MultipartParser && other) = delete;
+	MultipartParser & operator= (MultipartParser const& other) = delete;
+	MultipartParser & operator= (MultipartParser && other) = delete;
+	~MultipartParser();
+
+	/// Extract the boundary parameter from a multipart Content-Type, empty if there is none
+	static std::string_view boundary_from_content_type(std::string_view const& content_type);
+
+	bool feed(std::string_view chunk);
+	bool finish();
+
+	/// Read and parse the complete request body
+	bool parse(Request & request);
+
+	inline State state() const { return m_state; }
+
+protected:
+	size_t process(std::string_view const& data);
+	size_t partial_delimiter(std::string_view const& data, size_t start) const;
+	bool begin_part(std::string_view const& headers);
+
+	IMultipartHandler & m_handler;
+	std::string m_delimiter;
+	std::string m_buffer;
+	State m_state;
+};
+
+} // namespace fcgiserver
+
+#endif // FCGISERVER_MULTIPART_PARSER_H
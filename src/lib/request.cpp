@@ -1,11 +1,15 @@
+#include "http_status.h"
 #include "i_cgi_data.h"
 #include "logger.h"
 #include "request.h"
+#include "tracing.h"
 #include "utils.h"
 #include <cassert>
 #include <cstring>
+#include <algorithm>
 #include <charconv>
-#include <mutex>
+#include <utility>
+#include <vector>
 
 using namespace fcgiserver;
 using namespace std::literals::string_view_literals;
@@ -54,6 +58,28 @@ GenericFormat to_format(ContentEncoding encoding)
 	return GenericFormat::Verbatim;
 }
 
+ContentEncoding detect_encoding(std::string_view const& content_type)
+{
+	// Some very crude autodetection
+	std::string_view mime_type = content_type.substr(0, content_type.find(';'));
+	while (!mime_type.empty() && mime_type.back() == ' ')
+		mime_type.remove_suffix(1);
+
+	if (mime_type == "text/html"sv)
+		return ContentEncoding::HTML;
+	else if (mime_type.substr(0, 5) == "text/"sv)
+		return ContentEncoding::UTF8;
+	else
+		return ContentEncoding::Verbatim;
+}
+
+uint16_t parse_status_code(std::string_view const& status)
+{
+	uint16_t code = 0;
+	auto result = std::from_chars(status.begin(), status.end(), code, 10);
+	return result.ec == std::errc() ? code : 0;
+}
+
 void issue_headers_sent_warning(Symbol header, fcgiserver::Request const& request)
 {
 	request.logger().error() << "Attempted to modify header \"" << header << "\" after headers already sent - "sv << request.request_method_string() << ' ' << request.document_uri();
@@ -67,22 +93,161 @@ public:
 	RequestPrivate(ICgiData & icd, Logger const& lg)
 	    : cgi_data(icd)
 	    , logger(lg)
+	    , relative_offset(0)
+	    , encoding(ContentEncoding::Verbatim)
+	    , status_code(0)
+	    , stream_buffer_size(Request::default_stream_buffer_size)
+	    , bytes_written(0)
+	    , headers_sent_warning(false)
 	    , headers_sent(false)
 	    , query_parsed(false)
+	    , query_indexed(false)
+	    , form_parsed(false)
 	    , route_parsed(false)
 	{}
 
+	void reset()
+	{
+		// Keep the map nodes around, the next request will most likely
+		// have the exact same set of environment variables
+		while (!env_map.empty())
+			spare_env_nodes.push_back(env_map.extract(env_map.begin()));
+
+		headers.clear();
+		query.clear();
+		query_index.clear();
+		query_arena.clear();
+		form.clear();
+		body.clear();
+		route.clear();
+		relative_offset = 0;
+		encoding = ContentEncoding::Verbatim;
+		status_code = 0;
+		stream_buffer_size = Request::default_stream_buffer_size;
+		bytes_written = 0;
+		headers_sent_warning = false;
+		headers_sent = false;
+		query_parsed = false;
+		query_indexed = false;
+		form_parsed = false;
+		route_parsed = false;
+	}
+
+	void flush_streams(int (Request::*channel)(std::string_view const&))
+	{
+		for (auto const& entry : live_streams)
+			if (entry.second == channel)
+				entry.first->flush();
+	}
+
+	bool headers_locked(Symbol key, Request const& request)
+	{
+		if (!headers_sent)
+			return false;
+
+		if (!headers_sent_warning)
+		{
+			headers_sent_warning = true;
+			issue_headers_sent_warning(key, request);
+		}
+		return true;
+	}
+
+	void add_env(std::string_view const& key, std::string_view const& val)
+	{
+		if (spare_env_nodes.empty())
+		{
+			env_map.emplace(Symbol(key), val);
+			return;
+		}
+
+		auto node = std::move(spare_env_nodes.back());
+		spare_env_nodes.pop_back();
+
+		node.key() = Symbol(key);
+		node.mapped() = val;
+
+		auto result = env_map.insert(std::move(node));
+		if (!result.inserted)
+			spare_env_nodes.push_back(std::move(result.node));
+	}
+
+	struct QueryEntry
+	{
+		std::string_view key;
+		std::string_view value;
+		bool decoded;
+	};
+
+	using QueryRange = std::pair<std::vector<QueryEntry>::iterator, std::vector<QueryEntry>::iterator>;
+
+	std::string_view decode(std::string_view const& raw)
+	{
+		// Nothing to decode, refer to the original
+		if (raw.find('%') == std::string_view::npos)
+			return raw;
+
+		// The arena was reserved for the whole query string and decoding never grows
+		size_t offset = query_arena.size();
+		assert(offset + raw.size() <= query_arena.capacity());
+		query_arena.resize(offset + raw.size());
+		size_t len = utils::percent_decode(raw, query_arena.data() + offset);
+		query_arena.resize(offset + len);
+		return std::string_view(query_arena.data() + offset, len);
+	}
+
+	QueryRange find_query(Request const& request, std::string_view const& key)
+	{
+		if (!query_indexed)
+		{
+			Request::QueryParams const& params = request.query();
+			query_arena.reserve(request.query_string().size());
+			query_index.reserve(params.size());
+
+			for (auto const& param : params)
+				query_index.push_back(QueryEntry{decode(param.first), param.second, false});
+
+			std::stable_sort(query_index.begin(), query_index.end(), [] (QueryEntry const& lhs, QueryEntry const& rhs) { return lhs.key < rhs.key; });
+			query_indexed = true;
+		}
+
+		return std::equal_range(query_index.begin(), query_index.end(), QueryEntry{key, std::string_view(), false}, [] (QueryEntry const& lhs, QueryEntry const& rhs) { return lhs.key < rhs.key; });
+	}
+
+	std::string_view decoded_value(QueryEntry & entry)
+	{
+		if (!entry.decoded)
+		{
+			entry.value = decode(entry.value);
+			entry.decoded = true;
+		}
+		return entry.value;
+	}
+
 	ICgiData & cgi_data;
 	Logger const& logger;
 	Request::EnvMap env_map;
-	Request::HeaderMap headers;
+	std::vector<Request::EnvMap::node_type> spare_env_nodes;
+	HeaderList headers;
+	std::string header_buffer;
+	std::vector<std::string> stream_buffers;
+	std::vector<std::pair<RequestStream*,int (Request::*)(std::string_view const&)>> live_streams;
 	Request::QueryParams query;
+	std::vector<QueryEntry> query_index;
+	std::string query_arena;
+	Request::QueryParams form;
+	std::string body;
 	Request::Route route;
-	Request::Route relative_route;
+	size_t relative_offset;
 	ContentEncoding encoding;
-	std::once_flag headers_sent_warning;
+	uint16_t status_code;
+	size_t stream_buffer_size;
+	size_t bytes_written;
+	bool headers_sent_warning;
 	bool headers_sent;
 	bool query_parsed;
+	bool query_indexed;
+	bool form_parsed;
 	bool route_parsed;
 };
 
@@ -98,13 +263,18 @@ Request::~Request()
 		constexpr std::string_view message("Data processor did not return any data"sv);
 
 		set_http_status(500);
-		set_content_type("text/plain");
+		set_content_type(header_values::TextPlain);
 		set_header(symbols::ContentLength, message.size());
 		write(message);
 	}
 	delete m_private;
 }
 
+void Request::reset()
+{
+	m_private->reset();
+}
+
 ICgiData & Request::cgi_data()
 {
 	return m_private->cgi_data;
@@ -128,6 +298,34 @@ int Request::read(char * buffer, size_t bufsize)
 	return m_private->cgi_data.read(reinterpret_cast<uint8_t*>(buffer), bufsize);
 }
 
+size_t Request::read_body(std::string & output, size_t max_size)
+{
+	constexpr size_t chunk_size = 4096;
+
+	// Trust the announced length for the initial allocation, but never beyond the maximum
+	size_t expected = 0;
+	std::string_view length = request_content_length();
+	std::from_chars(length.begin(), length.end(), expected, 10);
+	output.reserve(output.size() + std::min(expected, max_size));
+
+	size_t total = 0;
+	while (total <= max_size)
+	{
+		size_t offset = output.size();
+		output.resize(offset + chunk_size);
+
+		int retval = read(output.data() + offset, chunk_size);
+		output.resize(offset + std::max(retval, 0));
+
+		if (retval <= 0)
+			break;
+
+		total += retval;
+	}
+
+	return total;
+}
+
 RequestStream Request::write_stream()
 {
 	return RequestStream(*this, &Request::write, to_format(m_private->encoding));
@@ -135,12 +333,22 @@ RequestStream Request::write_stream()
 
 int Request::write(std::string_view const& buffer)
 {
+	m_private->flush_streams(&Request::write);
 	send_headers();
-	return m_private->cgi_data.write(reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
+	int result = m_private->cgi_data.write(reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
+	if (result > 0)
+		m_private->bytes_written += result;
+	return result;
+}
+
+size_t Request::bytes_written() const
+{
+	return m_private->bytes_written;
 }
 
 int Request::flush_write()
 {
+	m_private->flush_streams(&Request::write);
 	return m_private->cgi_data.flush_write();
 }
 
@@ -151,14 +359,54 @@ RequestStream Request::error_stream()
 
 int Request::error(std::string_view const& buffer)
 {
+	m_private->flush_streams(&Request::error);
 	return m_private->cgi_data.error(reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
 }
 
 int Request::flush_error()
 {
+	m_private->flush_streams(&Request::error);
 	return m_private->cgi_data.flush_error();
 }
 
+size_t Request::stream_buffer_size() const
+{
+	return m_private->stream_buffer_size;
+}
+
+void Request::set_stream_buffer_size(size_t size)
+{
+	m_private->stream_buffer_size = size;
+}
+
+std::string Request::acquire_stream_buffer()
+{
+	std::string buffer;
+	if (!m_private->stream_buffers.empty())
+	{
+		buffer = std::move(m_private->stream_buffers.back());
+		m_private->stream_buffers.pop_back();
+	}
+	return buffer;
+}
+
+void Request::release_stream_buffer(std::string && buffer)
+{
+	buffer.clear();
+	m_private->stream_buffers.push_back(std::move(buffer));
+}
+
+void Request::attach_stream(RequestStream * stream, int (Request::*channel)(std::string_view const&))
+{
+	m_private->live_streams.emplace_back(stream, channel);
+}
+
+void Request::detach_stream(RequestStream * stream)
+{
+	auto & streams = m_private->live_streams;
+	streams.erase(std::remove_if(streams.begin(), streams.end(), [stream] (auto const& entry) { return entry.first == stream; }), streams.end());
+}
+
 Request::EnvMap const& Request::env_map() const
 {
 	if (m_private->env_map.empty())
@@ -173,13 +421,13 @@ Request::EnvMap const& Request::env_map() const
 
 			std::string_view key = line.substr(0, split_pos);
 			std::string_view val = line.substr(split_pos + 1);
-			m_private->env_map.emplace(Symbol(key), val);
+			m_private->add_env(key, val);
 		}
 	}
 	return m_private->env_map;
 }
 
-const Request::HeaderMap & Request::headers() const
+HeaderList const& Request::headers() const
 {
 	return m_private->headers;
 }
@@ -193,8 +441,7 @@ std::string_view Request::env(Symbol key) const
 
 std::string_view Request::header(Symbol key) const
 {
-	auto iter = m_private->headers.find(key);
-	return iter != m_private->headers.cend() ? iter->second : std::string_view();
+	return m_private->headers.get(key);
 }
 
 RequestMethod Request::request_method() const
@@ -222,22 +469,26 @@ Request::Route const& Request::full_route() const
 		}
 
 		m_private->route_parsed = true;
-		m_private->relative_route = m_private->route;
 	}
 
 	return m_private->route;
 }
 
-Request::Route const& Request::relative_route() const
+Request::RouteView Request::relative_route() const
 {
-	if (!m_private->route_parsed)
-		full_route();
-	return m_private->relative_route;
+	Route const& route = full_route();
+	size_t offset = std::min(m_private->relative_offset, route.size());
+	return RouteView(route.data() + offset, route.data() + route.size());
+}
+
+size_t Request::relative_route_offset() const
+{
+	return m_private->relative_offset;
 }
 
-void Request::swap_relative_route(Request::Route & route)
+void Request::set_relative_route_offset(size_t offset)
 {
-	m_private->relative_route.swap(route);
+	m_private->relative_offset = offset;
 }
 
 Request::QueryParams const& Request::query() const
@@ -245,25 +496,37 @@ Request::QueryParams const& Request::query() const
 	if (!m_private->query_parsed)
 	{
 		m_private->query.reserve(16);
+		utils::split_params(query_string(), m_private->query);
+		m_private->query_parsed = true;
+	}
 
-		std::string_view query_str = query_string();
-		while (!query_str.empty())
-		{
-			size_t split = query_str.find('&');
+	return m_private->query;
+}
+
+Request::QueryParams const& Request::form()
+{
+	if (!m_private->form_parsed)
+	{
+		m_private->form_parsed = true;
 
-			std::string_view element = query_str.substr(0, split);
-			query_str = split == std::string_view::npos ? std::string_view() : query_str.substr(split+1);
+		constexpr std::string_view urlencoded = "application/x-www-form-urlencoded"sv;
+		std::string_view content_type = request_content_type();
+		if (content_type.substr(0, urlencoded.size()) != urlencoded)
+			return m_private->form;
 
-			split = element.find('=');
-			std::string_view key = element.substr(0, split);
-			std::string_view value = split == std::string_view::npos ? std::string_view() : element.substr(split+1);
-			m_private->query.emplace_back(key, value);
+		std::string & body = m_private->body;
+		body.clear();
+		if (read_body(body, max_form_size) > max_form_size)
+		{
+			m_private->logger.error() << "Form data exceeds " << max_form_size << " bytes - " << request_method_string() << ' ' << document_uri();
+			body.clear();
+			return m_private->form;
 		}
 
-		m_private->query_parsed = true;
+		utils::split_params(body, m_private->form);
 	}
 
-	return m_private->query;
+	return m_private->form;
 }
 
 std::pair<bool,std::string_view> Request::query(const std::string_view & key) const
@@ -279,51 +542,89 @@ std::pair<bool,std::string_view> Request::query(const std::string_view & key) co
 	return std::make_pair(false, std::string_view());
 }
 
-std::string Request::query_decode(const std::string_view & value)
+std::pair<bool,std::string_view> Request::query_value(std::string_view const& key) const
 {
-	std::string result;
-	result.reserve(value.size());
+	auto range = m_private->find_query(*this, key);
+	if (range.first == range.second)
+		return std::make_pair(false, std::string_view());
+
+	return std::make_pair(true, m_private->decoded_value(*range.first));
+}
+
+size_t Request::query_values(std::string_view const& key, std::vector<std::string_view> & values) const
+{
+	auto range = m_private->find_query(*this, key);
+	for (auto iter = range.first; iter != range.second; ++iter)
+		values.push_back(m_private->decoded_value(*iter));
+
+	return std::distance(range.first, range.second);
+}
+
+size_t Request::query_list(std::string_view const& key, std::vector<std::string_view> & values, char separator) const
+{
+	size_t count = 0;
 
-	for (size_t idx = 0; idx < value.size(); ++idx)
+	auto range = m_private->find_query(*this, key);
+	for (auto iter = range.first; iter != range.second; ++iter)
 	{
-		char c = value[idx];
-		if (c == '%' && idx + 2 < value.size())
+		std::string_view value = m_private->decoded_value(*iter);
+		while (!value.empty())
 		{
-			auto chr = utils::unhex(value.data() + idx + 1);
-			if (chr.first)
-			{
-				result.push_back(chr.second);
-				idx += 2;
-			}
-			else
+			size_t split = value.find(separator);
+			std::string_view element = value.substr(0, split);
+			value = (split == std::string_view::npos) ? std::string_view() : value.substr(split + 1);
+
+			if (!element.empty())
 			{
-				result.push_back(c);
+				values.push_back(element);
+				++count;
 			}
 		}
-		else
-		{
-			result.push_back(c);
-		}
 	}
 
-	return result;
+	return count;
 }
 
-std::u32string Request::utf8_decode(std::string_view const& value)
+std::pair<bool,int64_t> Request::query_int(std::string_view const& key) const
 {
-	std::u32string result;
-	result.reserve(value.size());
+	std::pair<bool,std::string_view> value = query_value(key);
+	if (!value.first)
+		return std::make_pair(false, 0);
 
-	utils::convert_state mbstate;
+	int64_t number = 0;
+	auto result = std::from_chars(value.second.begin(), value.second.end(), number, 10);
+	bool valid = result.ec == std::errc() && result.ptr == value.second.end();
+	return std::make_pair(valid, valid ? number : 0);
+}
 
-	for (size_t idx = 0; idx < value.size(); ++idx)
-	{
-		char32_t glyph = utils::utf8_to_32(value[idx], mbstate);
+std::pair<bool,bool> Request::query_bool(std::string_view const& key) const
+{
+	std::pair<bool,std::string_view> value = query_value(key);
+	if (!value.first)
+		return std::make_pair(false, false);
 
-		if (glyph != 0)
-			result.push_back(glyph);
-	}
+	// A bare key such as "?verbose" counts as true
+	std::string_view v = value.second;
+	if (v.empty() || v == "1"sv || v == "true"sv || v == "yes"sv || v == "on"sv)
+		return std::make_pair(true, true);
+	if (v == "0"sv || v == "false"sv || v == "no"sv || v == "off"sv)
+		return std::make_pair(true, false);
+
+	return std::make_pair(false, false);
+}
+
+std::string Request::query_decode(const std::string_view & value)
+{
+	std::string result;
+	result.resize(value.size());
+	result.resize(utils::percent_decode(value, result.data()));
+	return result;
+}
 
+std::u32string Request::utf8_decode(std::string_view const& value)
+{
+	std::u32string result;
+	utils::utf8_decode(value, result);
 	return result;
 }
 
@@ -360,26 +661,57 @@ bool Request::do_not_track() const
 	return value == "1"sv;
 }
 
-bool Request::set_http_status(uint16_t code)
+uint16_t Request::http_status_code() const
 {
-	return set_header(symbols::Status, std::to_string(code));
+	return m_private->status_code;
 }
 
-bool Request::set_content_type(std::string content_type)
+bool Request::set_http_status(uint16_t code)
 {
-	// Some very crude autodetection
-	std::string_view ct = content_type;
-	ContentEncoding new_encoding;
-	if (ct == "text/html"sv)
-		new_encoding = ContentEncoding::HTML;
-	else if (ct.substr(0, 5) == "text/"sv)
-		new_encoding = ContentEncoding::UTF8;
+	if (m_private->headers_locked(symbols::Status, *this))
+		return false;
+
+	std::string_view line = http_status_line(code);
+	if (!line.empty())
+	{
+		m_private->headers.set(symbols::Status, HeaderValue(line));
+	}
 	else
-		new_encoding = ContentEncoding::Verbatim;
+	{
+		// Not a registered status, fits in the small string buffer anyway
+		char tmp[8];
+		auto result = std::to_chars(tmp, tmp + sizeof(tmp), code);
+		m_private->headers.set(symbols::Status, std::string(tmp, result.ptr - tmp));
+	}
+
+	m_private->status_code = code;
+	return true;
+}
 
+bool Request::set_content_type(std::string content_type)
+{
+	ContentEncoding new_encoding = detect_encoding(content_type);
 	return set_content_type(std::move(content_type), new_encoding);
 }
 
+bool Request::set_content_type(HeaderValue content_type)
+{
+	return set_content_type(content_type, detect_encoding(content_type.value));
+}
+
+bool Request::set_content_type(HeaderValue content_type, ContentEncoding encoding)
+{
+	if (set_header(symbols::ContentType, content_type))
+	{
+		m_private->encoding = encoding;
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
 bool Request::set_content_type(std::string content_type, ContentEncoding encoding)
 {
 	if (set_header(symbols::ContentType, std::move(content_type)))
@@ -395,13 +727,25 @@ bool Request::set_content_type(std::string content_type, ContentEncoding encodin
 
 bool Request::set_header(Symbol key, std::string value)
 {
-	if (m_private->headers_sent)
-	{
-		std::call_once(m_private->headers_sent_warning, [this,key] { issue_headers_sent_warning(key, *this); });
+	if (m_private->headers_locked(key, *this))
 		return false;
-	}
 
-	m_private->headers.emplace(key, std::move(value));
+	if (key == symbols::Status)
+		m_private->status_code = parse_status_code(value);
+
+	m_private->headers.set(key, std::move(value));
+	return true;
+}
+
+bool Request::set_header(Symbol key, HeaderValue value)
+{
+	if (m_private->headers_locked(key, *this))
+		return false;
+
+	if (key == symbols::Status)
+		m_private->status_code = parse_status_code(value.value);
+
+	m_private->headers.set(key, value);
 	return true;
 }
 
@@ -410,24 +754,50 @@ bool Request::set_header(Symbol key, int value)
 	return set_header(key, std::to_string(value));
 }
 
+bool Request::add_header(Symbol key, std::string value)
+{
+	if (m_private->headers_locked(key, *this))
+		return false;
+
+	m_private->headers.add(key, std::move(value));
+	return true;
+}
+
+bool Request::add_header(Symbol key, HeaderValue value)
+{
+	if (m_private->headers_locked(key, *this))
+		return false;
+
+	m_private->headers.add(key, value);
+	return true;
+}
+
+bool Request::remove_header(Symbol key)
+{
+	if (m_private->headers_locked(key, *this))
+		return false;
+
+	if (key == symbols::Status)
+		m_private->status_code = 0;
+
+	return m_private->headers.remove(key);
+}
+
 void Request::send_headers()
 {
 	if (m_private->headers_sent)
 		return;
 
-	if (m_private->headers.find(symbols::Status) == m_private->headers.cend())
-		m_private->headers.emplace(symbols::Status, "200");
+	TRACE_SCOPE("send_headers");
 
-	for (auto iter : m_private->headers)
-	{
-		std::string_view key = iter.first.to_string_view();
-		m_private->cgi_data.write(reinterpret_cast<const uint8_t*>(key.data()), key.size());
-		m_private->cgi_data.write(reinterpret_cast<const uint8_t*>(": "), 2);
-		m_private->cgi_data.write(reinterpret_cast<const uint8_t*>(iter.second.c_str()), iter.second.size());
-		m_private->cgi_data.write(reinterpret_cast<const uint8_t*>("\r\n"), 2);
-	}
+	if (m_private->status_code == 0 && !m_private->headers.contains(symbols::Status))
+		set_http_status(200);
+
+	std::string & buffer = m_private->header_buffer;
+	buffer.clear();
+	m_private->headers.render(buffer);
 
-	m_private->cgi_data.write(reinterpret_cast<const uint8_t*>("\r\n"), 2);
+	m_private->cgi_data.write(reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
 	m_private->headers_sent = true;
 }
 
@@ -2,6 +2,7 @@
 #define FCGISERVER_REQUEST_H
 
 #include "fcgiserver_defs.h"
+#include "header_list.h"
 #include "request_method.h"
 #include "request_stream.h"
 #include "symbol.h"
@@ -10,7 +11,6 @@
 #include <cstddef>
 #include <cstdint>
 #include <map>
-#include <unordered_map>
 #include <utility>
 #include <string_view>
 #include <string>
@@ -38,29 +38,65 @@ class DLL_PUBLIC Request
 public:
 	using QueryParams = std::vector<std::pair<std::string_view,std::string_view>>;
 	using EnvMap = std::map<Symbol,std::string_view>;
-	using HeaderMap = std::unordered_map<Symbol,std::string>;
 	using Route = std::vector<std::string_view>;
 
+	/// A window on the trailing components of full_route(), so routers can
+	/// hand the remainder of the path down without copying it
+	class RouteView
+	{
+	public:
+		using const_iterator = std::string_view const*;
+
+		RouteView() : m_begin(nullptr), m_end(nullptr) {}
+		RouteView(const_iterator begin, const_iterator end) : m_begin(begin), m_end(end) {}
+
+		inline const_iterator begin() const { return m_begin; }
+		inline const_iterator end() const { return m_end; }
+		inline const_iterator cbegin() const { return m_begin; }
+		inline const_iterator cend() const { return m_end; }
+		inline size_t size() const { return m_end - m_begin; }
+		inline bool empty() const { return m_begin == m_end; }
+		inline std::string_view const& operator[] (size_t index) const { return m_begin[index]; }
+
+	private:
+		const_iterator m_begin;
+		const_iterator m_end;
+	};
+
+	static constexpr size_t default_stream_buffer_size = 8192;
+
 	Request(ICgiData & cgidata, Logger const& logger);
 	Request(Request && other) = delete;
 	Request(Request const& other) = delete;
 	~Request();
 
+	/// Discard all per-request state so this object can serve the next
+	/// request on the same ICgiData. Allocated storage is kept for reuse.
+	void reset();
+
 	ICgiData      & cgi_data();
 	ICgiData const& cgi_data() const;
 
 	Logger const& logger() const;
 
 	int read(char * buffer, size_t bufsize);
+	size_t read_body(std::string & output, size_t max_size);
 
 	RequestStream write_stream();
 	int write(std::string_view const& buf);
 	int flush_write();
+	/// Body bytes handed to the webserver so far, excluding the headers
+	size_t bytes_written() const;
 
 	RequestStream error_stream();
 	int error(std::string_view const& buf);
 	int flush_error();
 
+	/// Output buffer size of streams created from now on, 0 to disable
+	/// buffering. Restored to the default on reset.
+	size_t stream_buffer_size() const;
+	void set_stream_buffer_size(size_t size);
+
 	EnvMap const& env_map() const;
 	std::string_view env(Symbol symbol) const;
 	inline std::string_view request_content_type() const { return env(symbols::CONTENT_TYPE); }
@@ -73,32 +109,55 @@ public:
 	inline std::string_view path_info() const { return env(symbols::PATH_INFO); }
 	inline std::string_view remote_addr() const { return env(symbols::REMOTE_ADDR); }
 	inline std::string_view remote_port_string() const { return env(symbols::REMOTE_PORT); }
+	inline std::string_view http_host() const { return env(symbols::HTTP_HOST); }
 	inline std::string_view user_agent() const { return env(symbols::HTTP_USER_AGENT); }
 	inline std::string_view do_not_track_string() const { return env(symbols::HTTP_DNT); }
 
-	HeaderMap const& headers() const;
+	HeaderList const& headers() const;
 	std::string_view header(Symbol symbol) const;
 	inline std::string_view http_status() const { return header(symbols::Status); }
+	uint16_t http_status_code() const;
 	inline std::string_view content_type() const { return header(symbols::ContentType); }
 
 	QueryParams const& query() const;
 	std::pair<bool,std::string_view> query(std::string_view const& key) const;
 	static std::string query_decode(std::string_view const& value);
+
+	// Lookups by decoded key returning decoded values. Every parameter is
+	// decoded at most once per request and the results stay valid until reset.
+	std::pair<bool,std::string_view> query_value(std::string_view const& key) const;
+	size_t query_values(std::string_view const& key, std::vector<std::string_view> & values) const;
+	size_t query_list(std::string_view const& key, std::vector<std::string_view> & values, char separator = ',') const;
+	std::pair<bool,int64_t> query_int(std::string_view const& key) const;
+	std::pair<bool,bool> query_bool(std::string_view const& key) const;
+
+	/// Largest urlencoded body that form() reads, a larger one leaves it empty
+	static constexpr size_t max_form_size = 1 << 20;
+	QueryParams const& form();
 	static std::u32string utf8_decode(std::string_view const& value);
 	static std::string utf8_encode(std::u32string_view const& value);
 
 	RequestMethod request_method() const;
 	Route const& full_route() const;
-	Route const& relative_route() const;
-	void swap_relative_route(Route & route);
+	RouteView relative_route() const;
+	/// Number of leading components of full_route() consumed by the routers
+	/// so far; relative_route() starts after them
+	size_t relative_route_offset() const;
+	void set_relative_route_offset(size_t offset);
 	int remote_port() const;
 	bool do_not_track() const;
 
 	bool set_http_status(uint16_t code);
 	bool set_content_type(std::string content_type);
 	bool set_content_type(std::string content_type, ContentEncoding encoding);
+	bool set_content_type(HeaderValue content_type);
+	bool set_content_type(HeaderValue content_type, ContentEncoding encoding);
 	bool set_header(Symbol key, std::string value);
+	bool set_header(Symbol key, HeaderValue value);
 	bool set_header(Symbol key, int value);
+	bool add_header(Symbol key, std::string value);
+	bool add_header(Symbol key, HeaderValue value);
+	bool remove_header(Symbol key);
 	void send_headers();
 	bool headers_sent() const;
 
@@ -106,6 +165,14 @@ public:
 	void set_encoding(ContentEncoding encoding);
 
 protected:
+	friend class RequestStream;
+	std::string acquire_stream_buffer();
+	void release_stream_buffer(std::string && buffer);
+	// Buffering streams are flushed before anything else goes out on their
+	// channel, so that output keeps its order
+	void attach_stream(RequestStream * stream, int (Request::*channel)(std::string_view const&));
+	void detach_stream(RequestStream * stream);
+
 	RequestPrivate * m_private;
 };
 
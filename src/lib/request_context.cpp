@@ -2,6 +2,7 @@
 #include "request_context_private.h"
 #include "request.h"
 #include <cassert>
+#include <charconv>
 
 
 using namespace fcgiserver;
@@ -65,3 +66,36 @@ void RequestContext::replace_thread_context(std::unique_ptr<UserContext> && new_
 {
 	m_private->thread_context = std::move(new_context);
 }
+
+std::string_view RequestContext::path_param(std::string_view const& name) const
+{
+	for (auto const& param : m_private->path_params)
+	{
+		if (param.name == name)
+			return param.value;
+	}
+	return std::string_view();
+}
+
+std::pair<bool,int64_t> RequestContext::path_param_int(std::string_view const& name) const
+{
+	for (auto const& param : m_private->path_params)
+	{
+		if (param.name != name)
+			continue;
+
+		if (param.is_number)
+			return std::make_pair(true, param.number);
+
+		int64_t number = 0;
+		auto result = std::from_chars(param.value.begin(), param.value.end(), number, 10);
+		bool valid = result.ec == std::errc() && result.ptr == param.value.end();
+		return std::make_pair(valid, valid ? number : 0);
+	}
+	return std::make_pair(false, 0);
+}
+
+size_t RequestContext::path_param_count() const
+{
+	return m_private->path_params.size();
+}
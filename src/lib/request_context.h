@@ -3,7 +3,10 @@
 
 #include "fcgiserver_defs.h"
 #include "user_context.h"
+#include <cstdint>
 #include <memory>
+#include <string_view>
+#include <utility>
 
 namespace fcgiserver
 {
@@ -12,11 +15,13 @@ class Logger;
 class Request;
 class Server;
 class RequestContextPrivate;
+class RouterPrivate;
 
 class DLL_PUBLIC RequestContext
 {
 private:
 	friend class Server;
+	friend class RouterPrivate;
 	RequestContext();
 
 public:
@@ -30,6 +35,12 @@ public:
 	std::shared_ptr<UserContext> global_context() const;
 	UserContext * thread_context() const;
 
+	/// Parameters captured by route patterns such as "/users/{id:int}". The
+	/// views are only valid while the request is being handled.
+	std::string_view path_param(std::string_view const& name) const;
+	std::pair<bool,int64_t> path_param_int(std::string_view const& name) const;
+	size_t path_param_count() const;
+
 	void replace_global_context(std::shared_ptr<UserContext> const& new_context);
 	void replace_thread_context(std::unique_ptr<UserContext> && new_context);
 
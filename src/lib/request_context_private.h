@@ -1,7 +1,10 @@
 #ifndef FCGISERVER_REQUEST_CONTEXT_PRIVATE_H
 #define FCGISERVER_REQUEST_CONTEXT_PRIVATE_H
 
+#include <cstdint>
 #include <memory>
+#include <string_view>
+#include <vector>
 #include "fcgiserver_defs.h"
 
 namespace fcgiserver
@@ -15,11 +18,21 @@ class UserContext;
 class DLL_PRIVATE RequestContextPrivate
 {
 public:
+	struct PathParam
+	{
+		std::string_view name;
+		std::string_view value;
+		int64_t number;
+		bool is_number;
+	};
+	using PathParams = std::vector<PathParam>;
+
 	RequestContextPrivate()
 	    : thread_id(0)
 	    , server(nullptr)
 	    , request(nullptr)
 	    , replaced_global_context(false)
+	    , route_metric(no_route)
 	{}
 
 	size_t thread_id;
@@ -27,7 +40,11 @@ public:
 	Request * request;
 	std::shared_ptr<UserContext> global_context;
 	std::unique_ptr<UserContext> thread_context;
+	PathParams path_params;
 	bool replaced_global_context;
+	// Metrics id of the route callback that ran, which records its own metrics
+	static constexpr uint32_t no_route = UINT32_MAX;
+	uint32_t route_metric;
 };
 
 }
@@ -1,4 +1,6 @@
 #include "request_stream.h"
+#include "request.h"
+#include "tracing.h"
 #include <cassert>
 
 using namespace fcgiserver;
@@ -7,8 +9,26 @@ RequestStream::RequestStream(Request & request, int (Request::*channel)(std::str
     : GenericFormatter(format)
     , m_request(request)
     , m_channel(channel)
+    , m_buffer_size(request.stream_buffer_size())
 {
 	assert(m_channel != nullptr && "invalid channel in RequestStream");
+
+	if (m_buffer_size > 0)
+	{
+		m_buffer = m_request.acquire_stream_buffer();
+		m_buffer.reserve(m_buffer_size);
+		m_request.attach_stream(this, m_channel);
+	}
+}
+
+RequestStream::~RequestStream()
+{
+	if (m_buffer_size > 0)
+	{
+		m_request.detach_stream(this);
+		flush();
+		m_request.release_stream_buffer(std::move(m_buffer));
+	}
 }
 
 RequestStream & RequestStream::operator<< (HTMLContent const& value)
@@ -26,7 +46,35 @@ RequestStream & RequestStream::operator<< (HTMLContent const& value)
 	return *this;
 }
 
+int RequestStream::flush()
+{
+	if (m_buffer.empty())
+		return 0;
+
+	TRACE_SCOPE("flush");
+
+	// The channel flushes the live streams first, this one included
+	std::string pending;
+	pending.swap(m_buffer);
+	int retval = (m_request.*m_channel)(pending);
+	pending.clear();
+	m_buffer.swap(pending);
+	return retval;
+}
+
 void RequestStream::real_append(std::string_view const& s)
 {
-	(m_request.*m_channel)(s);
+	if (m_buffer.size() + s.size() > m_buffer_size)
+	{
+		flush();
+
+		// Too large to be worth copying
+		if (s.size() >= m_buffer_size)
+		{
+			(m_request.*m_channel)(s);
+			return;
+		}
+	}
+
+	m_buffer.append(s);
 }
@@ -3,6 +3,7 @@
 
 #include "fcgiserver_defs.h"
 #include "generic_formatter.h"
+#include <string>
 #include <string_view>
 
 namespace fcgiserver
@@ -16,13 +17,20 @@ struct DLL_PUBLIC HTMLContent
 	std::string_view content;
 };
 
+/// Formats output for a Request channel. Fragments are collected in a buffer
+/// borrowed from the request and passed on in large chunks whenever the buffer
+/// would overflow, on flush() and when the stream is destroyed. A request with
+/// a stream buffer size of 0 passes every fragment on immediately.
+///
+/// Writing to the channel of the request directly, or flushing it, passes on
+/// what its live streams have buffered first, so output stays in order.
 class DLL_PUBLIC RequestStream : public GenericFormatter
 {
 public:
 	RequestStream(Request & request, int (Request::*channel)(std::string_view const&), GenericFormat format);
-	RequestStream(Request const& other) = delete;
-	RequestStream(Request && other) = delete;
-	~RequestStream() = default;
+	RequestStream(RequestStream const& other) = delete;
+	RequestStream(RequestStream && other) = delete;
+	~RequestStream();
 
 	RequestStream & operator<< (HTMLContent const& value);
 
@@ -33,9 +41,14 @@ public:
 		return *this;
 	}
 
+	/// Pass the buffered output on to the request channel
+	int flush();
+
 protected:
 	Request & m_request;
 	int (Request::*m_channel)(std::string_view const& s);
+	std::string m_buffer;
+	size_t m_buffer_size;
 
 	void real_append(std::string_view const& s) override;
 };
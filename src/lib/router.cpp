@@ -1,13 +1,26 @@
 #include "router.h"
+#include "cycle_clock.h"
+#include "epoch_domain.h"
+#include "metrics.h"
 #include "request.h"
 #include "request_context.h"
+#include "request_context_private.h"
 #include "request_method.h"
 #include "symbol.h"
 #include "symbols.h"
+#include "tracing.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
 #include <map>
 #include <mutex>
-#include <shared_mutex>
+#include <regex>
+#include <string>
 #include <vector>
 
 using namespace fcgiserver;
@@ -17,38 +30,493 @@ using namespace std::literals::string_view_literals;
 namespace
 {
 
-struct SubRoute
+using EndpointDefinition = std::map<RequestMethod,Router::Callback>;
+
+// Mutable form of the routes, only touched when routes are added or removed
+struct RouteDefinition
 {
-	SubRoute() = default;
-	~SubRoute() = default;
+	RouteDefinition * get_or_create_subroute(std::string_view const& component)
+	{
+		auto iter = routes.find(component);
+		if (iter == routes.end())
+			iter = routes.emplace(std::string(component), std::make_unique<RouteDefinition>()).first;
+		return iter->second.get();
+	}
 
-	SubRoute * get_or_create_subroute(Symbol symbol)
+	RouteDefinition * maybe_get_subroute(std::string_view const& component) const
 	{
-		auto & ptr = routes[symbol];
-		if (!ptr)
-			ptr.reset(new SubRoute);
-		return ptr.get();
+		auto iter = routes.find(component);
+		return (iter == routes.end()) ? nullptr : iter->second.get();
 	}
 
-	SubRoute * maybe_get_subroute(Symbol symbol) const
+	std::map<std::string,std::unique_ptr<RouteDefinition>,std::less<>> routes;
+	std::shared_ptr<IRouter> router;
+	EndpointDefinition endpoints;
+};
+
+struct RegexDefinition
+{
+	std::string pattern;
+	size_t mark_count;
+	EndpointDefinition endpoints;
+};
+
+// Routes that match the remaining path as a whole rather than per component
+struct PatternDefinition
+{
+	std::map<std::string,EndpointDefinition,std::less<>> prefixes;
+	std::vector<RegexDefinition> regexes;
+};
+
+enum class ParamType : uint8_t
+{
+	String,
+	Int,
+	UInt,
+};
+
+// Recognise "{name}" and "{name:type}" route components
+bool parse_param(std::string_view const& component, std::string_view & name, ParamType & type)
+{
+	if (component.size() < 3 || component.front() != '{' || component.back() != '}')
+		return false;
+
+	std::string_view inner = component.substr(1, component.size() - 2);
+	size_t colon = inner.find(':');
+	name = inner.substr(0, colon);
+	if (name.empty())
+		return false;
+
+	std::string_view type_name = (colon == std::string_view::npos) ? std::string_view() : inner.substr(colon + 1);
+	if (type_name.empty() || type_name == "str"sv)
+		type = ParamType::String;
+	else if (type_name == "int"sv)
+		type = ParamType::Int;
+	else if (type_name == "uint"sv)
+		type = ParamType::UInt;
+	else
+		return false;
+
+	return true;
+}
+
+// Immutable, flattened form of the routes that requests are matched against.
+// Nodes are laid out breadth first and the edges of a node are contiguous and
+// sorted, so a lookup is a binary search over a few neighbouring entries.
+struct RouteTable
+{
+	static constexpr uint32_t none = UINT32_MAX;
+	static constexpr size_t method_count = size_t(RequestMethod::Other) + 1;
+
+	struct Node
+	{
+		uint32_t first_edge;
+		uint32_t edge_count;
+		uint32_t first_param;
+		uint32_t param_count;
+		uint32_t wildcard;
+		uint32_t endpoints;
+		uint32_t router;
+		bool catch_all_recursive;
+	};
+
+	struct Edge
+	{
+		uint32_t label_offset;
+		uint32_t label_length;
+		uint32_t node;
+	};
+
+	// Callback for every concrete request method, with the fallbacks already
+	// applied, and the methods to advertise when none of them matches
+	struct Endpoints
+	{
+		std::array<uint32_t,method_count> dispatch;
+		uint32_t catch_all_recursive;
+		uint32_t metric;
+		std::string allow;
+	};
+
+	struct Param
+	{
+		uint32_t label_offset;
+		uint32_t label_length;
+		uint32_t node;
+		ParamType type;
+	};
+
+	struct PrefixNode
+	{
+		uint32_t first_edge;
+		uint32_t edge_count;
+		uint32_t endpoints;
+	};
+
+	struct PrefixEdge
+	{
+		uint8_t byte;
+		uint32_t node;
+	};
+
+	struct RegexGroup
+	{
+		size_t group;
+		uint32_t endpoints;
+	};
+
+	RouteTable(RouteDefinition const& root, PatternDefinition const& patterns, std::string_view const& metrics_prefix)
+	    : metrics_prefix(metrics_prefix)
 	{
-		auto const& iter = routes.find(symbol);
-		return (iter == routes.cend())? nullptr : iter->second.get();
+		compile_routes(root);
+
+		if (!patterns.prefixes.empty())
+			compile_prefixes(patterns.prefixes.begin(), patterns.prefixes.end(), 0);
+
+		if (!patterns.regexes.empty())
+			compile_regexes(patterns.regexes);
+	}
+
+	// Exact matches win over parameters, which win over the wildcard. A
+	// matching parameter is added to the captures.
+	uint32_t child(uint32_t node_index, std::string_view const& component, RequestContextPrivate::PathParams & captures) const
+	{
+		Node const& node = nodes[node_index];
+		auto begin = edges.begin() + node.first_edge;
+		auto end = begin + node.edge_count;
+
+		auto iter = std::lower_bound(begin, end, component, [this] (Edge const& edge, std::string_view const& value) { return label(edge) < value; });
+		if (iter != end && label(*iter) == component)
+			return iter->node;
+
+		for (uint32_t idx = node.first_param; idx < node.first_param + node.param_count; ++idx)
+		{
+			Param const& param = params[idx];
+			std::string_view name(labels.data() + param.label_offset, param.label_length);
+
+			if (param.type == ParamType::String)
+			{
+				captures.push_back(RequestContextPrivate::PathParam{name, component, 0, false});
+				return param.node;
+			}
+
+			if (param.type == ParamType::UInt && !component.empty() && component.front() == '-')
+				continue;
+
+			int64_t number;
+			auto result = std::from_chars(component.begin(), component.end(), number, 10);
+			if (result.ec == std::errc() && result.ptr == component.end())
+			{
+				captures.push_back(RequestContextPrivate::PathParam{name, component, number, true});
+				return param.node;
+			}
+		}
+
+		return node.wildcard;
 	}
 
-	SubRoute * maybe_get_subroute(std::string_view const& component) const
+	// Endpoints of the longest prefix of the path, in a single walk down the
+	// byte trie
+	uint32_t match_prefix(std::string_view const& path) const
 	{
-		return maybe_get_subroute(Symbol::maybe(component));
+		if (prefix_nodes.empty())
+			return none;
+
+		uint32_t node = 0;
+		uint32_t result = prefix_nodes[0].endpoints;
+		for (char c : path)
+		{
+			PrefixNode const& current = prefix_nodes[node];
+			auto begin = prefix_edges.begin() + current.first_edge;
+			auto end = begin + current.edge_count;
+
+			auto iter = std::lower_bound(begin, end, uint8_t(c), [] (PrefixEdge const& edge, uint8_t value) { return edge.byte < value; });
+			if (iter == end || iter->byte != uint8_t(c))
+				break;
+
+			node = iter->node;
+			if (prefix_nodes[node].endpoints != none)
+				result = prefix_nodes[node].endpoints;
+		}
+		return result;
+	}
+
+	// Endpoints of the first regex that matches the whole path. All regexes
+	// are alternatives of one combined expression; the capture group that
+	// took part in the match tells which one it was.
+	uint32_t match_regex(std::string const& path) const
+	{
+		if (regex_groups.empty() || path.size() > Router::max_regex_path_length)
+			return none;
+
+		std::smatch match;
+		if (!std::regex_match(path, match, regex))
+			return none;
+
+		for (RegexGroup const& group : regex_groups)
+			if (match[group.group].matched)
+				return group.endpoints;
+
+		return none;
 	}
 
-	bool has_catch_all_recursive() const
+	inline bool has_patterns() const
 	{
-		return endpoints.find(RequestMethod::CatchAllRecursive) != endpoints.cend();
+		return !prefix_nodes.empty() || !regex_groups.empty();
 	}
 
-	std::unordered_map<Symbol,std::unique_ptr<SubRoute>> routes;
-	std::shared_ptr<IRouter> router;
-	std::map<RequestMethod,Router::Callback> endpoints;
+	inline std::string_view label(Edge const& edge) const
+	{
+		return std::string_view(labels.data() + edge.label_offset, edge.label_length);
+	}
+
+	std::vector<Node> nodes;
+	std::vector<Edge> edges;
+	std::vector<Param> params;
+	std::string labels;
+	std::vector<Endpoints> endpoints;
+	std::vector<Router::Callback> callbacks;
+	std::vector<std::shared_ptr<IRouter>> routers;
+	std::vector<PrefixNode> prefix_nodes;
+	std::vector<PrefixEdge> prefix_edges;
+	std::vector<RegexGroup> regex_groups;
+	std::regex regex;
+
+private:
+	std::string const metrics_prefix;
+
+	void compile_routes(RouteDefinition const& root)
+	{
+		struct Pending
+		{
+			RouteDefinition const* definition;
+			uint32_t node;
+			std::string label;
+		};
+
+		std::vector<Pending> queue;
+		queue.push_back(Pending{&root, add_node(root, "/"sv), "/"});
+
+		for (size_t idx = 0; idx < queue.size(); ++idx)
+		{
+			RouteDefinition const& definition = *queue[idx].definition;
+			uint32_t node_index = queue[idx].node;
+			std::string const parent_label = queue[idx].label;
+
+			uint32_t first_edge = edges.size();
+			uint32_t first_param = params.size();
+			for (auto const& entry : definition.routes)
+			{
+				std::string label = (parent_label.size() > 1 ? parent_label + '/' : parent_label) + entry.first;
+				uint32_t child = add_node(*entry.second, label);
+				queue.push_back(Pending{entry.second.get(), child, std::move(label)});
+
+				std::string_view name;
+				ParamType type;
+
+				if (entry.first == symbols::wildcard.to_string_view())
+				{
+					nodes[node_index].wildcard = child;
+				}
+				else if (parse_param(entry.first, name, type))
+				{
+					params.push_back(Param{uint32_t(labels.size()), uint32_t(name.size()), child, type});
+					labels.append(name);
+				}
+				else
+				{
+					edges.push_back(Edge{uint32_t(labels.size()), uint32_t(entry.first.size()), child});
+					labels.append(entry.first);
+				}
+			}
+
+			// Typed parameters get the first go at a component
+			std::stable_sort(params.begin() + first_param, params.end(), [] (Param const& lhs, Param const& rhs) { return lhs.type != ParamType::String && rhs.type == ParamType::String; });
+
+			nodes[node_index].first_edge = first_edge;
+			nodes[node_index].edge_count = edges.size() - first_edge;
+			nodes[node_index].first_param = first_param;
+			nodes[node_index].param_count = params.size() - first_param;
+		}
+	}
+
+	// The prefixes in [begin,end) are sorted and share their first depth
+	// bytes, so every child is a contiguous run of them
+	template <typename Iter>
+	uint32_t compile_prefixes(Iter begin, Iter end, size_t depth)
+	{
+		uint32_t node_index = prefix_nodes.size();
+		prefix_nodes.push_back(PrefixNode{0, 0, none});
+
+		if (begin != end && begin->first.size() == depth)
+		{
+			prefix_nodes[node_index].endpoints = endpoints.size();
+			endpoints.push_back(compile_endpoints(begin->second, begin->first + '*'));
+			++begin;
+		}
+
+		std::vector<Iter> runs;
+		for (Iter iter = begin; iter != end; ++iter)
+			if (runs.empty() || runs.back()->first[depth] != iter->first[depth])
+				runs.push_back(iter);
+
+		uint32_t first_edge = prefix_edges.size();
+		prefix_edges.resize(first_edge + runs.size());
+		prefix_nodes[node_index].first_edge = first_edge;
+		prefix_nodes[node_index].edge_count = runs.size();
+
+		for (size_t idx = 0; idx < runs.size(); ++idx)
+		{
+			Iter run_end = (idx + 1 < runs.size()) ? runs[idx+1] : end;
+			uint32_t child = compile_prefixes(runs[idx], run_end, depth + 1);
+			prefix_edges[first_edge + idx] = PrefixEdge{uint8_t(runs[idx]->first[depth]), child};
+		}
+
+		return node_index;
+	}
+
+	void compile_regexes(std::vector<RegexDefinition> const& definitions)
+	{
+		std::string combined;
+		size_t group = 1;
+		for (RegexDefinition const& definition : definitions)
+		{
+			if (!combined.empty())
+				combined += '|';
+			combined += '(';
+			combined += definition.pattern;
+			combined += ')';
+
+			regex_groups.push_back(RegexGroup{group, uint32_t(endpoints.size())});
+			endpoints.push_back(compile_endpoints(definition.endpoints, '~' + definition.pattern));
+			group += 1 + definition.mark_count;
+		}
+
+		regex.assign(combined, std::regex::ECMAScript | std::regex::optimize);
+	}
+
+	uint32_t add_node(RouteDefinition const& definition, std::string_view const& label)
+	{
+		Node node{0, 0, 0, 0, none, none, none, false};
+
+		if (!definition.endpoints.empty())
+		{
+			node.endpoints = endpoints.size();
+			node.catch_all_recursive = definition.endpoints.count(RequestMethod::CatchAllRecursive) > 0;
+			endpoints.push_back(compile_endpoints(definition.endpoints, label));
+		}
+
+		if (definition.router)
+		{
+			node.router = routers.size();
+			routers.push_back(definition.router);
+		}
+
+		nodes.push_back(node);
+		return nodes.size() - 1;
+	}
+
+	// The root of a router with a prefix is labelled as just the prefix
+	std::string metric_label(std::string_view const& label) const
+	{
+		if (!metrics_prefix.empty() && label == "/"sv)
+			return metrics_prefix;
+		return metrics_prefix + std::string(label);
+	}
+
+	Endpoints compile_endpoints(EndpointDefinition const& definition, std::string_view const& label)
+	{
+		std::map<RequestMethod,uint32_t> index;
+		for (auto const& entry : definition)
+		{
+			index[entry.first] = callbacks.size();
+			callbacks.push_back(entry.second);
+		}
+
+		auto find = [&index] (RequestMethod method)
+		{
+			auto iter = index.find(method);
+			return (iter == index.end()) ? none : iter->second;
+		};
+
+		Endpoints result;
+		result.catch_all_recursive = find(RequestMethod::CatchAllRecursive);
+		result.metric = Metrics::instance().route_id(metric_label(label));
+		uint16_t allowed = 0;
+
+		uint32_t catch_all = find(RequestMethod::CatchAllHere);
+		if (catch_all == none)
+			catch_all = result.catch_all_recursive;
+
+		for (size_t idx = 0; idx < method_count; ++idx)
+		{
+			RequestMethod method = RequestMethod(idx);
+			uint32_t callback = find(method);
+
+			// HEAD is GET without the body, which the webserver strips
+			if (callback == none && method == RequestMethod::HEAD)
+				callback = find(RequestMethod::GET);
+			if (callback == none)
+				callback = catch_all;
+
+			result.dispatch[idx] = callback;
+			if (callback != none || method == RequestMethod::OPTIONS)
+				allowed |= uint16_t(1) << idx;
+		}
+
+		static const Symbol names[] = {
+		    symbols::GET, symbols::HEAD, symbols::POST, symbols::PUT, symbols::DELETE,
+		    symbols::CONNECT, symbols::OPTIONS, symbols::TRACE, symbols::PATCH
+		};
+
+		for (size_t idx = 0; idx < std::size(names); ++idx)
+		{
+			if (allowed & (uint16_t(1) << idx))
+			{
+				if (!result.allow.empty())
+					result.allow += ", ";
+				result.allow += names[idx].to_string_view();
+			}
+		}
+
+		return result;
+	}
+};
+
+// Records the metrics of a route callback, also when it throws. Timed with
+// the CycleClock like the server's phases and unmatched requests.
+class RouteTimer
+{
+public:
+	RouteTimer(uint32_t metric, Request & request, uint16_t unset_status = 200)
+	    : m_metric(metric)
+	    , m_request(request)
+	    , m_bytes_written(m_request.bytes_written())
+	    , m_uncaught(std::uncaught_exceptions())
+	    , m_unset_status(unset_status)
+	    , m_start(CycleClock::now())
+	{
+		Metrics::instance().request_started(m_metric);
+	}
+
+	~RouteTimer()
+	{
+		auto duration = std::chrono::nanoseconds(CycleClock::to_nanoseconds(CycleClock::now() - m_start));
+
+		// The server picks the status for callbacks that leave it unset
+		uint16_t status = m_request.http_status_code();
+		if (status == 0)
+			status = (std::uncaught_exceptions() > m_uncaught) ? 500 : m_unset_status;
+
+		Metrics::instance().request_finished(m_metric, status, duration, m_request.bytes_written() - m_bytes_written);
+	}
+
+private:
+	uint32_t m_metric;
+	Request & m_request;
+	size_t m_bytes_written;
+	int m_uncaught;
+	uint16_t m_unset_status;
+	uint64_t m_start;
 };
 
 std::string_view find_route_start(std::string_view const& route)
@@ -57,6 +525,16 @@ std::string_view find_route_start(std::string_view const& route)
 	return (start == std::string_view::npos) ? std::string_view() : route.substr(start);
 }
 
+// Prefix routes match against paths that always start with a slash
+std::string prefix_key(std::string_view const& prefix)
+{
+	std::string key;
+	if (prefix.empty() || prefix.front() != '/')
+		key += '/';
+	key += prefix;
+	return key;
+}
+
 std::string_view split_first_component(std::string_view & route)
 {
 	assert(!route.empty());
@@ -76,146 +554,375 @@ std::string_view split_first_component(std::string_view & route)
 class fcgiserver::RouterPrivate
 {
 public:
-	RouterPrivate() {}
-	~RouterPrivate() = default;
+	RouterPrivate(std::string_view const& metrics_prefix)
+	    : metrics_prefix(metrics_prefix)
+	    , metrics_prefix_inherited(metrics_prefix.empty())
+	    , table(new RouteTable(definition, patterns, metrics_prefix))
+	{
+	}
 
-	SubRoute route;
-	std::shared_mutex route_mutex;
-};
+	~RouterPrivate()
+	{
+		delete table.load();
+	}
 
+	RouteDefinition * find_or_create(std::string_view const& route)
+	{
+		std::string_view remaining = find_route_start(route);
+		RouteDefinition * subroute = &definition;
+		while (!remaining.empty())
+		{
+			std::string_view component = split_first_component(remaining);
+			subroute = subroute->get_or_create_subroute(component);
+		}
+		return subroute;
+	}
 
-Router::Router()
-    : m_private(new RouterPrivate)
-{
-}
+	// Must be called with definition_mutex held. Requests that are still
+	// using the previous table keep it alive until they are done.
+	void publish()
+	{
+		RouteTable * old_table = table.exchange(new RouteTable(definition, patterns, metrics_prefix));
+		EpochDomain::instance().retire(old_table);
+	}
 
-Router::~Router()
-{
-	delete m_private;
-}
+	// Must be called with definition_mutex held. Nested routers take over
+	// the prefix along with their mount path, unless they have their own.
+	void pass_metrics_prefix(RouteDefinition const& route, std::string const& path)
+	{
+		if (Router * router = dynamic_cast<Router*>(route.router.get()))
+			router->inherit_metrics_prefix(path);
 
-IRouter::RouteResult Router::handle_request(RequestContext & context)
-{
-	std::shared_lock<std::shared_mutex> lock(m_private->route_mutex);
+		for (auto const& entry : route.routes)
+			pass_metrics_prefix(*entry.second, path + '/' + entry.first);
+	}
 
-	RouteResult route_result = RouteResult::NotFound;
+	// Must be called with definition_mutex held
+	void set_metrics_prefix(std::string_view const& prefix)
+	{
+		metrics_prefix = prefix;
+		publish();
+		pass_metrics_prefix(definition, metrics_prefix);
+	}
+
+	IRouter::RouteResult handle_request(RequestContext & context)
+	{
+		EpochGuard guard;
+		RouteTable const& table = *this->table.load();
 
-	SubRoute * subroute = &m_private->route;
-	SubRoute * last_with_catch_recursive = subroute->has_catch_all_recursive() ? subroute : nullptr;
+		// Captures of routes that did not work out are dropped again
+		RequestContextPrivate::PathParams & captures = context.m_private->path_params;
+		size_t captures_mark = captures.size();
 
-	Request::Route const& route = context.request().relative_route();
-	for (auto iter = route.cbegin(), iter_end = route.cend(); ; ++iter)
+		IRouter::RouteResult route_result = route(table, context);
+		if (route_result != IRouter::RouteResult::Handled)
+			captures.resize(captures_mark);
+
+		return route_result;
+	}
+
+	IRouter::RouteResult route(RouteTable const& table, RequestContext & context)
 	{
-		if (subroute->router)
+		RequestContextPrivate::PathParams & captures = context.m_private->path_params;
+		size_t const captures_mark = captures.size();
+
+		IRouter::RouteResult route_result = IRouter::RouteResult::NotFound;
+
+		uint32_t node = 0;
+		uint32_t last_with_catch_recursive = table.nodes[node].catch_all_recursive ? node : RouteTable::none;
+		// Captures on the path down to that node, anything deeper was abandoned
+		size_t catch_recursive_captures = captures.size();
+
+		Request & request = context.request();
+		size_t const base_offset = request.relative_route_offset();
+		Request::RouteView const route = request.relative_route();
+		for (auto iter = route.cbegin(), iter_end = route.cend(); ; ++iter)
 		{
-			Request::Route relative_route(iter, iter_end);
-			context.request().swap_relative_route(relative_route);
+			if (table.nodes[node].router != RouteTable::none)
+			{
+				request.set_relative_route_offset(base_offset + (iter - route.cbegin()));
+
+				size_t nested_mark = captures.size();
+				auto new_result = table.routers[table.nodes[node].router]->handle_request(context);
+				if (new_result != IRouter::RouteResult::NotFound)
+					route_result = new_result;
+				if (route_result == IRouter::RouteResult::Handled)
+					return route_result;
+
+				captures.resize(nested_mark);
+				request.set_relative_route_offset(base_offset);
+			}
+
+			if (iter == iter_end)
+				break;
+
+			node = table.child(node, *iter, captures);
+			if (node == RouteTable::none)
+				break;
 
-			auto new_result = subroute->router->handle_request(context);
-			if (new_result != RouteResult::NotFound)
-				route_result = new_result;
-			if (route_result == RouteResult::Handled)
-				return route_result;
+			if (table.nodes[node].catch_all_recursive)
+			{
+				last_with_catch_recursive = node;
+				catch_recursive_captures = captures.size();
+			}
+		}
 
-			context.request().swap_relative_route(relative_route);
+		if (node != RouteTable::none)
+		{
+			// A nested router that rejected the method has set Allow, which
+			// does not apply to whatever this route answers instead
+			if (route_result == IRouter::RouteResult::InvalidMethod)
+				request.remove_header(symbols::Allow);
+			route_result = dispatch(table, table.nodes[node].endpoints, context);
 		}
 
-		if (iter == iter_end)
-			break;
+		if (route_result == IRouter::RouteResult::NotFound && table.has_patterns())
+		{
+			std::string const& path = relative_path(route);
+			uint32_t endpoints = table.match_prefix(path);
+			if (endpoints == RouteTable::none)
+				endpoints = table.match_regex(path);
+
+			// Pattern routes have no captures, but the catch-all below still
+			// needs its own if none of them matches
+			if (endpoints != RouteTable::none)
+			{
+				captures.resize(captures_mark);
+				route_result = dispatch(table, endpoints, context);
+			}
+		}
 
-		SubRoute * next = subroute->maybe_get_subroute(*iter);
-		if (!next)
-			next = subroute->maybe_get_subroute(symbols::wildcard);
+		if (route_result == IRouter::RouteResult::NotFound && last_with_catch_recursive != RouteTable::none)
+		{
+			captures.resize(catch_recursive_captures);
 
-		subroute = next;
-		if (!subroute)
-			break;
+			auto const& endpoints = table.endpoints[table.nodes[last_with_catch_recursive].endpoints];
+			context.m_private->route_metric = endpoints.metric;
+			RouteTimer timer(endpoints.metric, context.request());
+			table.callbacks[endpoints.catch_all_recursive](context);
+			return IRouter::RouteResult::Handled;
+		}
 
-		if (subroute->has_catch_all_recursive())
-			last_with_catch_recursive = subroute;
+		return route_result;
 	}
 
-	if (subroute)
+	IRouter::RouteResult dispatch(RouteTable const& table, uint32_t endpoints_index, RequestContext & context)
 	{
-		if (subroute->endpoints.empty())
+		if (endpoints_index == RouteTable::none)
+			return IRouter::RouteResult::NotFound;
+
+		auto const& endpoints = table.endpoints[endpoints_index];
+		RequestMethod method = context.request().request_method();
+		assert(size_t(method) < RouteTable::method_count);
+
+		uint32_t callback = endpoints.dispatch[size_t(method)];
+		if (callback != RouteTable::none)
 		{
-			route_result = RouteResult::NotFound;
+			context.m_private->route_metric = endpoints.metric;
+			RouteTimer timer(endpoints.metric, context.request());
+			table.callbacks[callback](context);
+			return IRouter::RouteResult::Handled;
 		}
-		else
-		{
-			RequestMethod method = context.request().request_method();
-
-			auto iter = subroute->endpoints.find(method);
-			if (iter == subroute->endpoints.cend())
-				iter = subroute->endpoints.find(RequestMethod::CatchAllHere);
-			if (iter == subroute->endpoints.cend())
-				iter = subroute->endpoints.find(RequestMethod::CatchAllRecursive);
 
-			if (iter != subroute->endpoints.cend())
-			{
-				iter->second(context);
-				return RouteResult::Handled;
-			}
+		// The route did match, so these count towards it as well
+		context.m_private->route_metric = endpoints.metric;
 
-			route_result = RouteResult::InvalidMethod;
+		// Not worth a callback, answer OPTIONS right here
+		if (method == RequestMethod::OPTIONS)
+		{
+			RouteTimer timer(endpoints.metric, context.request());
+			context.request().set_http_status(204);
+			context.request().set_header(symbols::Allow, endpoints.allow);
+			return IRouter::RouteResult::Handled;
 		}
+
+		// The server answers 405 unless a parent route handles it after all
+		RouteTimer timer(endpoints.metric, context.request(), 405);
+		context.request().set_header(symbols::Allow, endpoints.allow);
+		return IRouter::RouteResult::InvalidMethod;
 	}
 
-	if (route_result == RouteResult::NotFound && last_with_catch_recursive)
+	// The remaining path as "/a/b" for the pattern routes, built in a buffer
+	// that is reused by the thread for every request
+	static std::string const& relative_path(Request::RouteView const& route)
 	{
-		auto iter = last_with_catch_recursive->endpoints.find(RequestMethod::CatchAllRecursive);
-		if (iter != last_with_catch_recursive->endpoints.cend())
+		thread_local std::string path;
+		path.clear();
+		for (std::string_view const& component : route)
 		{
-			iter->second(context);
-			return RouteResult::Handled;
+			path += '/';
+			path += component;
 		}
+		if (path.empty())
+			path += '/';
+		return path;
 	}
 
-	return route_result;
+	std::mutex definition_mutex;
+	RouteDefinition definition;
+	PatternDefinition patterns;
+	std::string metrics_prefix;
+	bool metrics_prefix_inherited;
+
+	std::atomic<RouteTable*> table;
+};
+
+
+Router::Router(std::string_view const& metrics_prefix)
+    : m_private(new RouterPrivate(metrics_prefix))
+{
+}
+
+Router::~Router()
+{
+	delete m_private;
+}
+
+IRouter::RouteResult Router::handle_request(RequestContext & context)
+{
+	TRACE_SCOPE("route");
+	return m_private->handle_request(context);
 }
 
 void Router::add_route(std::shared_ptr<IRouter> router, std::string_view const& route)
 {
-	std::lock_guard<std::shared_mutex> guard(m_private->route_mutex);
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
 
+	m_private->find_or_create(route)->router = router;
+	m_private->publish();
+
+	std::string path = m_private->metrics_prefix;
 	std::string_view remaining = find_route_start(route);
-	SubRoute * subroute = &m_private->route;
 	while (!remaining.empty())
 	{
-		std::string_view component = split_first_component(remaining);
-		subroute = subroute->get_or_create_subroute(component);
+		path += '/';
+		path += split_first_component(remaining);
 	}
 
-	subroute->router = router;
+	if (Router * nested = dynamic_cast<Router*>(router.get()))
+		nested->inherit_metrics_prefix(path);
+}
+
+void Router::set_metrics_prefix(std::string_view const& prefix)
+{
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
+
+	m_private->metrics_prefix_inherited = false;
+	m_private->set_metrics_prefix(prefix);
+}
+
+void Router::inherit_metrics_prefix(std::string_view const& prefix)
+{
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
+
+	if (m_private->metrics_prefix_inherited && m_private->metrics_prefix != prefix)
+		m_private->set_metrics_prefix(prefix);
+}
+
+std::string Router::metrics_prefix() const
+{
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
+	return m_private->metrics_prefix;
 }
 
 void Router::add_route(Callback && callback, std::string_view const& route, RequestMethod method)
 {
-	std::lock_guard<std::shared_mutex> guard(m_private->route_mutex);
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
 
-	std::string_view remaining = find_route_start(route);
-	SubRoute * subroute = &m_private->route;
-	while (!remaining.empty())
+	m_private->find_or_create(route)->endpoints[method] = std::move(callback);
+	m_private->publish();
+}
+
+void Router::add_prefix_route(Callback && callback, std::string_view const& prefix, RequestMethod method)
+{
+	std::string key = prefix_key(prefix);
+
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
+
+	m_private->patterns.prefixes[std::move(key)][method] = std::move(callback);
+	m_private->publish();
+}
+
+bool Router::add_regex_route(Callback && callback, std::string_view const& pattern, RequestMethod method)
+{
+	// Backreferences would point at the wrong group once combined
+	for (size_t idx = 0; idx + 1 < pattern.size(); ++idx)
 	{
-		std::string_view component = split_first_component(remaining);
-		subroute = subroute->get_or_create_subroute(component);
+		if (pattern[idx] == '\\')
+		{
+			if (pattern[idx+1] >= '1' && pattern[idx+1] <= '9')
+				return false;
+			++idx;
+		}
+	}
+
+	size_t mark_count;
+	try
+	{
+		mark_count = std::regex(pattern.begin(), pattern.end(), std::regex::ECMAScript).mark_count();
+	}
+	catch (std::regex_error const&)
+	{
+		return false;
 	}
 
-	subroute->endpoints[method] = std::move(callback);
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
+
+	auto & regexes = m_private->patterns.regexes;
+	auto iter = std::find_if(regexes.begin(), regexes.end(), [&pattern] (RegexDefinition const& regex) { return regex.pattern == pattern; });
+	if (iter == regexes.end())
+		iter = regexes.insert(regexes.end(), RegexDefinition{std::string(pattern), mark_count, {}});
+
+	iter->endpoints[method] = std::move(callback);
+	m_private->publish();
+	return true;
+}
+
+bool Router::remove_prefix_route(std::string_view const& prefix)
+{
+	std::string key = prefix_key(prefix);
+
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
+
+	auto & prefixes = m_private->patterns.prefixes;
+	auto iter = prefixes.find(key);
+	if (iter == prefixes.end())
+		return false;
+
+	prefixes.erase(iter);
+	m_private->publish();
+	return true;
+}
+
+bool Router::remove_regex_route(std::string_view const& pattern)
+{
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
+
+	auto & regexes = m_private->patterns.regexes;
+	auto iter = std::find_if(regexes.begin(), regexes.end(), [&pattern] (RegexDefinition const& regex) { return regex.pattern == pattern; });
+	if (iter == regexes.end())
+		return false;
+
+	regexes.erase(iter);
+	m_private->publish();
+	return true;
 }
 
 bool Router::remove_route(std::string_view const& route)
 {
-	std::lock_guard<std::shared_mutex> guard(m_private->route_mutex);
+	std::lock_guard<std::mutex> guard(m_private->definition_mutex);
 
 	std::string_view remaining = find_route_start(route);
-	SubRoute * subroute = &m_private->route;
-	while (!remaining.empty())
+	RouteDefinition * subroute = &m_private->definition;
+	while (subroute && !remaining.empty())
 	{
 		std::string_view component = split_first_component(remaining);
-		subroute = subroute->get_or_create_subroute(component);
+		subroute = subroute->maybe_get_subroute(component);
 	}
 
+	if (!subroute)
+		return false;
+
 	bool removed = false;
 	if (subroute->router)
 	{
@@ -227,5 +934,9 @@ bool Router::remove_route(std::string_view const& route)
 		removed = true;
 		subroute->endpoints.clear();
 	}
+
+	if (removed)
+		m_private->publish();
+
 	return removed;
 }
@@ -7,6 +7,7 @@
 #include "request_method.h"
 #include <functional>
 #include <memory>
+#include <string>
 #include <string_view>
 
 namespace fcgiserver
@@ -18,16 +19,41 @@ class DLL_PUBLIC Router : public IRouter
 public:
 	using Callback = std::function<void(RequestContext&)>;
 
+	/// Longest remaining path that regex routes are tried on. The regex
+	/// matcher recurses per character, so longer paths, which the client
+	/// controls, are NotFound for regex routes rather than risking the stack.
+	static constexpr size_t max_regex_path_length = 2048;
+
 public:
-	Router();
+	explicit Router(std::string_view const& metrics_prefix = std::string_view());
 	~Router();
 
 	IRouter::RouteResult handle_request(RequestContext & context) override;
 
+	/// The metrics prefix goes in front of the route labels of this router,
+	/// so that equal paths in different routers are counted apart. A router
+	/// without a prefix of its own inherits one when it is mounted: that of
+	/// the parent router plus the mount path, or the host in a HostRouter.
+	void set_metrics_prefix(std::string_view const& prefix);
+	/// Sets the prefix unless the router has one of its own
+	void inherit_metrics_prefix(std::string_view const& prefix);
+	std::string metrics_prefix() const;
+
 	void add_route(std::shared_ptr<IRouter> router, std::string_view const& route);
 	void add_route(Callback && callback, std::string_view const& route, RequestMethod method = RequestMethod::CatchAllHere);
 	bool remove_route(std::string_view const& route);
 
+	/// Routes for paths that the component routes above cannot express. They
+	/// are only tried when no component route matches, and they match the
+	/// remaining path as a whole, joined as "/a/b". The longest matching
+	/// prefix wins, then the first added regex that matches the full path.
+	/// A regex must be valid ECMAScript without backreferences, and only
+	/// matches paths up to max_regex_path_length bytes.
+	void add_prefix_route(Callback && callback, std::string_view const& prefix, RequestMethod method = RequestMethod::CatchAllHere);
+	bool add_regex_route(Callback && callback, std::string_view const& pattern, RequestMethod method = RequestMethod::CatchAllHere);
+	bool remove_prefix_route(std::string_view const& prefix);
+	bool remove_regex_route(std::string_view const& pattern);
+
 protected:
 	RouterPrivate * m_private;
 };
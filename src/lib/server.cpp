@@ -1,12 +1,19 @@
 #include "server.h"
+#include "http_status.h"
 #include "request.h"
 #include "request_context.h"
 #include "request_context_private.h"
+#include "tracing.h"
+#include "cycle_clock.h"
 #include "fast_cgi_data.h"
+#include "generic_formatter.h"
 #include "i_router.h"
+#include "metrics.h"
+#include "slow_request_log.h"
 #include "console_log_callback.h"
 #include "logger.h"
 
+#include <atomic>
 #include <cstdarg>
 #include <cerrno>
 #include <cstring>
@@ -42,6 +49,50 @@ void sigusr2(int signum, siginfo_t *info, void *ucontext)
 	tick_triggered = true;
 }
 
+// Phase timings of one worker thread. Only the worker itself writes them, so
+// plain loads and stores suffice while stats() may read them at any time.
+struct WorkerStats
+{
+	struct Phase
+	{
+		std::atomic<uint64_t> buckets[Metrics::bucket_count] {};
+		std::atomic<uint64_t> count {0};
+		std::atomic<uint64_t> sum_ns {0};
+	};
+
+	explicit WorkerStats(size_t id) : thread_id(id) {}
+
+	void record(Server::Phase phase, uint64_t ticks)
+	{
+		auto bump = [] (std::atomic<uint64_t> & counter, uint64_t amount)
+		{
+			counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+		};
+
+		uint64_t nanoseconds = CycleClock::to_nanoseconds(ticks);
+		Phase & target = phases[size_t(phase)];
+		bump(target.buckets[Metrics::bucket_index(nanoseconds / 1000)], 1);
+		bump(target.sum_ns, nanoseconds);
+		bump(target.count, 1);
+	}
+
+	size_t thread_id;
+	Phase phases[Server::phase_count];
+};
+
+void write_stats(GenericFormatter & output, Server::Stats const& stats)
+{
+	output << "# HELP fcgiserver_phase_duration_seconds Time spent per request in each phase of a worker thread.\n"sv;
+	output << "# TYPE fcgiserver_phase_duration_seconds histogram\n"sv;
+	for (size_t idx = 0; idx < Server::phase_count; ++idx)
+		Metrics::write_histogram(output, "fcgiserver_phase_duration_seconds"sv, "phase"sv, Server::phase_name(Server::Phase(idx)), stats.phases[idx]);
+
+	output << "# HELP fcgiserver_worker_utilization Fraction of time a worker thread spent on requests.\n"sv;
+	output << "# TYPE fcgiserver_worker_utilization gauge\n"sv;
+	for (Server::ThreadStats const& thread : stats.threads)
+		output << "fcgiserver_worker_utilization{thread=\""sv << thread.thread_id << "\"} "sv << thread.utilization() << '\n';
+}
+
 // Tiny default router
 class EmptyRouter : public fcgiserver::IRouter
 {
@@ -56,7 +107,7 @@ public:
 		if (uri != "/"sv)
 			return RouteResult::NotFound;
 
-		request.set_content_type("text/html");
+		request.set_content_type(header_values::TextHtml);
 		request.write("<!DOCTYPE html>\n");
 		request.write("<html lang=\"en\">\n");
 		request.write("<head><meta charset=\"utf-8\" /><title>FCGIserver online</title></head>\n");
@@ -85,23 +136,37 @@ public:
 	int socket_fd;
 	Logger logger;
 	std::shared_ptr<IRouter> router;
+	std::shared_ptr<SlowRequestLog> slow_request_log;
 	std::list<std::thread> threads;
 	size_t last_thread_id;
 	std::shared_ptr<UserContext> global_context;
 	std::function<UserContext*(std::shared_ptr<UserContext> const&)> create_thread_context;
 	std::chrono::seconds thread_context_tick_interval;
+
+	// Kept after their threads finish so the totals survive restarts
+	mutable std::mutex stats_lock;
+	std::vector<std::unique_ptr<WorkerStats>> worker_stats;
 };
 
 
+std::string_view Server::phase_name(Phase phase)
+{
+	static constexpr std::string_view names[phase_count] = { "accept"sv, "read"sv, "handler"sv, "write"sv };
+	return size_t(phase) < phase_count ? names[size_t(phase)] : std::string_view();
+}
+
 Server::Server()
     : m_private(new ServerPrivate)
 {
 	m_private->logger.set_log_callback(std::make_unique<ConsoleLogCallback>());
 	m_private->thread_context_tick_interval = std::chrono::seconds(60);
+
+	Metrics::instance().add_source(this, [this] (GenericFormatter & output) { write_stats(output, stats()); });
 }
 
 Server::~Server()
 {
+	Metrics::instance().remove_source(this);
 	finalize();
 	delete m_private;
 }
@@ -140,6 +205,12 @@ void Server::set_thread_context_tick_interval(std::chrono::seconds duration)
 	m_private->thread_context_tick_interval = duration;
 }
 
+void Server::set_slow_request_log(std::shared_ptr<SlowRequestLog> log)
+{
+	std::lock_guard<std::shared_mutex> guard(m_private->context_lock);
+	m_private->slow_request_log = std::move(log);
+}
+
 bool Server::initialize(std::string socket_path)
 {
 	int sockfd;
@@ -192,7 +263,10 @@ bool Server::add_threads(size_t count)
 		}
 	}
 
-	m_private->logger.info() << "Starting " << count << " threads";
+	// Measure the clock rate now rather than on the first request
+	CycleClock::nanoseconds_per_tick();
+
+	FCGISERVER_LOG_INFO(m_private->logger) << "Starting " << count << " threads";
 
 	std::lock_guard<std::mutex> guard(m_private->threads_lock);
 
@@ -289,7 +363,11 @@ void Server::thread_function(size_t id)
 		return;
 	}
 
+	// These are reused for every request handled by this thread
+	fcgiserver::FastCgiData fcgi_data(fcgx_request);
+	fcgiserver::Request request(fcgi_data, m_private->logger);
 	fcgiserver::RequestContext context;
+	context.m_private->request = &request;
 	{
 		std::lock_guard<std::shared_mutex> guard(m_private->context_lock);
 		context.m_private->thread_id = id;
@@ -300,8 +378,16 @@ void Server::thread_function(size_t id)
 			            );
 	}
 
-	m_private->logger.debug() << "Thread #" << id << " started";
+	WorkerStats * stats;
+	{
+		std::lock_guard<std::mutex> guard(m_private->stats_lock);
+		m_private->worker_stats.push_back(std::make_unique<WorkerStats>(id));
+		stats = m_private->worker_stats.back().get();
+	}
 
+	FCGISERVER_LOG_DEBUG(m_private->logger) << "Thread #" << id << " started";
+
+	uint64_t phase_start = CycleClock::now();
 	while (!shutdown_triggered)
 	{
 		// Time to do some maintenance?
@@ -332,16 +418,30 @@ void Server::thread_function(size_t id)
 			}
 		}
 
+		uint64_t accepted = CycleClock::now();
+		stats->record(Phase::Accept, accepted - phase_start);
+
 		std::shared_ptr<fcgiserver::IRouter> router;
+		std::shared_ptr<SlowRequestLog> slow_request_log;
 		{
 			std::shared_lock<std::shared_mutex> guard(m_private->context_lock);
 			context.m_private->global_context = m_private->global_context;
 			router = m_private->router;
+			slow_request_log = m_private->slow_request_log;
 		}
 
-		fcgiserver::FastCgiData fcgi_data(fcgx_request);
-		fcgiserver::Request request(fcgi_data, m_private->logger);
-		context.m_private->request = &request;
+		request.reset();
+		context.m_private->path_params.clear();
+		context.m_private->route_metric = RequestContextPrivate::no_route;
+
+		// Parsed here rather than on first use, so that it counts as reading
+		request.env_map();
+
+		uint64_t handler_start = CycleClock::now();
+		stats->record(Phase::Read, handler_start - accepted);
+
+		Tracer & tracer = Tracer::instance();
+		tracer.begin_request();
 
 		IRouter::RouteResult route_result = IRouter::RouteResult::InternalError;
 		try
@@ -357,7 +457,7 @@ void Server::thread_function(size_t id)
 			m_private->logger.error() << "Uncaught unknown exception in thread " << id << " - "<< request.request_method_string() << ' ' << request.document_uri();;;
 		}
 
-		if (request.http_status().empty())
+		if (request.http_status_code() == 0)
 		{
 			switch (route_result)
 			{
@@ -376,13 +476,16 @@ void Server::thread_function(size_t id)
 			}
 		}
 
+		uint64_t write_start = CycleClock::now();
+		stats->record(Phase::Handler, write_start - handler_start);
+
 		// Make sure the headers are sent
 		if (!request.headers_sent())
 		{
 			// TODO Need some form of proper default pages?
-			if (request.content_type().empty())
+			if (request.content_type().empty() && request.http_status_code() != 204)
 			{
-				request.set_content_type("text/plain");
+				request.set_content_type(header_values::TextPlain);
 				request.write_stream() << request.http_status();
 			}
 			else
@@ -391,8 +494,18 @@ void Server::thread_function(size_t id)
 			}
 		}
 
+		// Routes record their own metrics, the rest is accounted as unmatched
+		if (context.m_private->route_metric == RequestContextPrivate::no_route)
+		{
+			Metrics & metrics = Metrics::instance();
+			metrics.request_started(Metrics::unmatched);
+			// Handler time only, as the routes measure it
+			auto duration = std::chrono::nanoseconds(CycleClock::to_nanoseconds(write_start - handler_start));
+			metrics.request_finished(Metrics::unmatched, request.http_status_code(), duration, request.bytes_written());
+		}
+
 		// Log the request/result
-		if (auto * cb = m_private->logger.log_callback(); cb)
+		if (auto * cb = m_private->logger.log_callback(); cb && m_private->logger.enabled(cb->request_log_level()))
 			cb->log_request(request);
 
 		// Process context updates
@@ -402,9 +515,92 @@ void Server::thread_function(size_t id)
 			std::lock_guard<std::shared_mutex> guard(m_private->context_lock);
 			m_private->global_context = context.m_private->global_context;
 		}
+
+		// The request is gone after finishing it, so capture it now if needed
+		std::unique_ptr<SlowRequestLog::Record> slow_request;
+		if (slow_request_log)
+		{
+			uint64_t elapsed = CycleClock::to_nanoseconds(CycleClock::now() - accepted);
+			if (slow_request_log->is_slow(std::chrono::nanoseconds(elapsed)))
+			{
+				uint32_t route = context.m_private->route_metric;
+				slow_request = std::make_unique<SlowRequestLog::Record>(slow_request_log->capture(request));
+				slow_request->thread_id = id;
+				slow_request->route = Metrics::instance().route_label(route == RequestContextPrivate::no_route ? Metrics::unmatched : route);
+				slow_request->phase_ns[size_t(Phase::Accept)] = CycleClock::to_nanoseconds(accepted - phase_start);
+				slow_request->phase_ns[size_t(Phase::Read)] = CycleClock::to_nanoseconds(handler_start - accepted);
+				slow_request->phase_ns[size_t(Phase::Handler)] = CycleClock::to_nanoseconds(write_start - handler_start);
+			}
+		}
+
+		{
+			TRACE_SCOPE("finish");
+			fcgi_data.finish();
+		}
+		tracer.end_request(slow_request ? &slow_request->trace : nullptr);
+
+		phase_start = CycleClock::now();
+		stats->record(Phase::Write, phase_start - write_start);
+
+		if (slow_request)
+		{
+			slow_request->phase_ns[size_t(Phase::Write)] = CycleClock::to_nanoseconds(phase_start - write_start);
+			slow_request->duration_ns = CycleClock::to_nanoseconds(phase_start - accepted);
+			slow_request_log->add(std::move(*slow_request));
+		}
+	}
+
+	FCGISERVER_LOG_DEBUG(m_private->logger) << "Thread #" << id << " finished";
+}
+
+Server::Stats Server::stats() const
+{
+	Stats result {};
+
+	std::lock_guard<std::mutex> guard(m_private->stats_lock);
+	for (auto const& worker : m_private->worker_stats)
+	{
+		ThreadStats thread {worker->thread_id, 0, 0, 0};
+		for (size_t idx = 0; idx < phase_count; ++idx)
+		{
+			WorkerStats::Phase const& phase = worker->phases[idx];
+			Metrics::Histogram & histogram = result.phases[idx];
+
+			for (size_t bucket = 0; bucket < Metrics::bucket_count; ++bucket)
+				histogram.buckets[bucket] += phase.buckets[bucket].load(std::memory_order_relaxed);
+
+			uint64_t sum_ns = phase.sum_ns.load(std::memory_order_relaxed);
+			histogram.count += phase.count.load(std::memory_order_relaxed);
+			histogram.sum_ns += sum_ns;
+
+			if (Phase(idx) == Phase::Accept)
+				thread.idle_ns += sum_ns;
+			else
+				thread.busy_ns += sum_ns;
+		}
+		thread.requests = worker->phases[size_t(Phase::Handler)].count.load(std::memory_order_relaxed);
+		result.threads.push_back(thread);
 	}
 
-	m_private->logger.debug() << "Thread #" << id << " finished";
+	return result;
+}
+
+double Server::ThreadStats::utilization() const
+{
+	uint64_t total = busy_ns + idle_ns;
+	return total ? double(busy_ns) / double(total) : 0.0;
+}
+
+double Server::Stats::utilization() const
+{
+	uint64_t busy = 0;
+	uint64_t total = 0;
+	for (ThreadStats const& thread : threads)
+	{
+		busy += thread.busy_ns;
+		total += thread.busy_ns + thread.idle_ns;
+	}
+	return total ? double(busy) / double(total) : 0.0;
 }
 
 void Server::run_thread_tick_function(Server * server)
@@ -419,7 +615,7 @@ void Server::thread_tick_function()
 	size_t trigger_index = size_t(-1);
 	size_t num_threads;
 
-	m_private->logger.debug() << "Maintenance thread started";
+	FCGISERVER_LOG_DEBUG(m_private->logger) << "Maintenance thread started";
 
 	std::unique_lock<std::mutex> guard(m_private->threads_lock);
 	num_threads = m_private->threads.size();
@@ -459,6 +655,6 @@ void Server::thread_tick_function()
 		}
 	}
 
-	m_private->logger.debug() << "Maintenance thread finished";
+	FCGISERVER_LOG_DEBUG(m_private->logger) << "Maintenance thread finished";
 }
 
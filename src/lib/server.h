@@ -3,11 +3,15 @@
 
 #include "fcgiserver_defs.h"
 #include "logger.h"
+#include "metrics.h"
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace fcgiserver
 {
@@ -15,10 +19,47 @@ namespace fcgiserver
 class Request;
 class IRouter;
 class ServerPrivate;
+class SlowRequestLog;
 class UserContext;
 
 class DLL_PUBLIC Server
 {
+public:
+	/// The phases a worker thread goes through for every request: waiting in
+	/// accept, parsing the request parameters (the body is read on demand by
+	/// the handler), running the router and finishing the response, which
+	/// flushes the output to the webserver
+	enum class Phase : uint8_t
+	{
+		Accept,
+		Read,
+		Handler,
+		Write,
+	};
+	static constexpr size_t phase_count = 4;
+	/// Lowercase name of the phase as used in the metrics and slow requests
+	DLL_PRIVATE static std::string_view phase_name(Phase phase);
+
+	struct ThreadStats
+	{
+		size_t thread_id;
+		uint64_t requests;
+		uint64_t busy_ns;
+		uint64_t idle_ns;
+
+		/// Fraction of the time spent on requests rather than waiting for one
+		double utilization() const;
+	};
+
+	struct Stats
+	{
+		std::array<Metrics::Histogram,phase_count> phases;
+		std::vector<ThreadStats> threads;
+
+		inline Metrics::Histogram const& phase(Phase p) const { return phases[size_t(p)]; }
+		double utilization() const;
+	};
+
 public:
 	Server();
 	~Server();
@@ -30,6 +71,10 @@ public:
 	void set_thread_context(std::function<UserContext*(std::shared_ptr<UserContext> const&)> && create_context_function);
 	void set_thread_context_tick_interval(std::chrono::seconds duration);
 
+	/// Record requests that exceed the threshold of the log, or stop doing so
+	/// with an empty pointer
+	void set_slow_request_log(std::shared_ptr<SlowRequestLog> log);
+
 	bool initialize(std::string socket_path);
 	bool add_threads(size_t count);
 	void kill_threads();
@@ -37,6 +82,10 @@ public:
 
 	int wait_for_terminate_signal() const;
 
+	/// Phase timings of all worker threads since the server was created,
+	/// also exported on the Metrics endpoint
+	Stats stats() const;
+
 private:
 	static void install_thread_signal_handlers();
 
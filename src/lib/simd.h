@@ -0,0 +1,74 @@
+#ifndef FCGISERVER_SIMD_H
+#define FCGISERVER_SIMD_H
+
+#include "fcgiserver_defs.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Minimal byte classification helpers. The implementation is picked at
+// compile time; the library is built with -march=native so this matches
+// the machine it was built for. Every operation works on a block of
+// simd::width bytes and a Mask has one bit per byte, lowest address first.
+
+namespace fcgiserver
+{
+namespace simd
+{
+
+#if defined(__AVX2__)
+
+using Vector = __m256i;
+using Mask = uint32_t;
+constexpr size_t width = 32;
+
+inline Vector load(void const* ptr) { return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(ptr)); }
+inline Vector splat(char c) { return _mm256_set1_epi8(c); }
+inline Vector eq(Vector a, Vector b) { return _mm256_cmpeq_epi8(a, b); }
+inline Vector either(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+inline Vector below(Vector a, uint8_t limit) { return _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(char(limit - 1))), a); }
+inline Mask mask(Vector a) { return uint32_t(_mm256_movemask_epi8(a)); }
+
+#elif defined(__SSE2__)
+
+using Vector = __m128i;
+using Mask = uint32_t;
+constexpr size_t width = 16;
+
+inline Vector load(void const* ptr) { return _mm_loadu_si128(reinterpret_cast<__m128i const*>(ptr)); }
+inline Vector splat(char c) { return _mm_set1_epi8(c); }
+inline Vector eq(Vector a, Vector b) { return _mm_cmpeq_epi8(a, b); }
+inline Vector either(Vector a, Vector b) { return _mm_or_si128(a, b); }
+inline Vector below(Vector a, uint8_t limit) { return _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(char(limit - 1))), a); }
+inline Mask mask(Vector a) { return uint32_t(_mm_movemask_epi8(a)); }
+
+#else
+
+struct Vector { uint8_t b[8]; };
+using Mask = uint32_t;
+constexpr size_t width = 8;
+
+inline Vector load(void const* ptr) { Vector v; std::memcpy(v.b, ptr, width); return v; }
+inline Vector splat(char c) { Vector v; std::memset(v.b, c, width); return v; }
+inline Vector eq(Vector a, Vector b) { for (size_t i = 0; i < width; ++i) a.b[i] = (a.b[i] == b.b[i]) ? 0xff : 0; return a; }
+inline Vector either(Vector a, Vector b) { for (size_t i = 0; i < width; ++i) a.b[i] |= b.b[i]; return a; }
+inline Vector below(Vector a, uint8_t limit) { for (size_t i = 0; i < width; ++i) a.b[i] = (a.b[i] < limit) ? 0xff : 0; return a; }
+inline Mask mask(Vector a) { Mask m = 0; for (size_t i = 0; i < width; ++i) m |= Mask(a.b[i] >> 7) << i; return m; }
+
+#endif
+
+/// Bytes with the high bit set, i.e. anything that is not ASCII
+inline Mask non_ascii(Vector a) { return mask(a); }
+
+inline unsigned first(Mask m) { return unsigned(__builtin_ctz(m)); }
+
+} // namespace simd
+} // namespace fcgiserver
+
+#endif // FCGISERVER_SIMD_H
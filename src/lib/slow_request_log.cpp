@@ -0,0 +1,194 @@
+#include "slow_request_log.h"
+#include "json_writer.h"
+#include "request.h"
+#include "symbols.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+namespace
+{
+
+constexpr std::string_view redacted = "<redacted>"sv;
+
+}
+
+
+class fcgiserver::SlowRequestLogPrivate
+{
+public:
+	SlowRequestLogPrivate(size_t capacity, std::chrono::nanoseconds threshold)
+	    : capacity(capacity > 0 ? capacity : 1)
+	    , next(0)
+	    , threshold_ns(threshold.count())
+	    , env_filter{ symbols::REMOTE_ADDR, symbols::REMOTE_PORT, symbols::REQUEST_SCHEME, symbols::HTTP_HOST, symbols::HTTP_USER_AGENT, symbols::CONTENT_TYPE, symbols::CONTENT_LENGTH }
+	    , redacted_headers{ symbols::SetCookie }
+	{
+		records.reserve(this->capacity);
+	}
+
+	size_t const capacity;
+
+	// Ring of records, next is where the following one goes
+	mutable std::mutex lock;
+	std::vector<SlowRequestLog::Record> records;
+	size_t next;
+
+	std::atomic<int64_t> threshold_ns;
+	std::vector<Symbol> env_filter;
+	std::vector<Symbol> redacted_headers;
+};
+
+
+SlowRequestLog::SlowRequestLog(size_t capacity, std::chrono::nanoseconds threshold)
+    : m_private(new SlowRequestLogPrivate(capacity, threshold))
+{
+}
+
+SlowRequestLog::~SlowRequestLog()
+{
+	delete m_private;
+}
+
+void SlowRequestLog::set_threshold(std::chrono::nanoseconds threshold)
+{
+	m_private->threshold_ns.store(threshold.count(), std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds SlowRequestLog::threshold() const
+{
+	return std::chrono::nanoseconds(m_private->threshold_ns.load(std::memory_order_relaxed));
+}
+
+bool SlowRequestLog::is_slow(std::chrono::nanoseconds elapsed) const
+{
+	return elapsed.count() >= m_private->threshold_ns.load(std::memory_order_relaxed);
+}
+
+void SlowRequestLog::set_env_filter(std::vector<Symbol> names)
+{
+	std::lock_guard<std::mutex> guard(m_private->lock);
+	m_private->env_filter = std::move(names);
+}
+
+void SlowRequestLog::set_redacted_headers(std::vector<Symbol> names)
+{
+	std::lock_guard<std::mutex> guard(m_private->lock);
+	m_private->redacted_headers = std::move(names);
+}
+
+SlowRequestLog::Record SlowRequestLog::capture(Request const& request) const
+{
+	Record record {};
+	record.time = std::chrono::system_clock::now();
+	record.method = request.request_method_string();
+	record.uri = request.document_uri();
+	record.query = request.query_string();
+	record.status = request.http_status_code();
+
+	{
+		std::lock_guard<std::mutex> guard(m_private->lock);
+		for (Symbol name : m_private->env_filter)
+		{
+			std::string_view value = request.env(name);
+			if (!value.empty())
+				record.env.emplace_back(name.to_string_view(), value);
+		}
+
+		auto const& redacted_headers = m_private->redacted_headers;
+		for (HeaderList::Entry const& header : request.headers())
+		{
+			bool redact = std::find(redacted_headers.begin(), redacted_headers.end(), header.key) != redacted_headers.end();
+			record.response_headers.emplace_back(header.key.to_string_view(), redact ? redacted : header.value());
+		}
+	}
+
+	return record;
+}
+
+void SlowRequestLog::add(Record && record)
+{
+	std::lock_guard<std::mutex> guard(m_private->lock);
+	if (m_private->records.size() < m_private->capacity)
+		m_private->records.push_back(std::move(record));
+	else
+		m_private->records[m_private->next] = std::move(record);
+	m_private->next = (m_private->next + 1) % m_private->capacity;
+}
+
+std::vector<SlowRequestLog::Record> SlowRequestLog::records() const
+{
+	std::vector<Record> result;
+
+	std::lock_guard<std::mutex> guard(m_private->lock);
+	size_t count = m_private->records.size();
+	result.reserve(count);
+	for (size_t idx = 1; idx <= count; ++idx)
+		result.push_back(m_private->records[(m_private->next + count - idx) % count]);
+
+	return result;
+}
+
+size_t SlowRequestLog::capacity() const
+{
+	return m_private->capacity;
+}
+
+void SlowRequestLog::clear()
+{
+	std::lock_guard<std::mutex> guard(m_private->lock);
+	m_private->records.clear();
+	m_private->next = 0;
+}
+
+void SlowRequestLog::write_json(GenericFormatter & output) const
+{
+	auto to_ms = [] (uint64_t nanoseconds) { return double(nanoseconds) / 1e6; };
+
+	JsonWriter json(output);
+	json.begin_array();
+
+	for (Record const& record : records())
+	{
+		auto since_epoch = std::chrono::duration_cast<std::chrono::milliseconds>(record.time.time_since_epoch());
+
+		json.begin_object();
+		json.field("time_ms", int64_t(since_epoch.count()));
+		json.field("thread", uint64_t(record.thread_id));
+		json.field("method", record.method);
+		json.field("uri", record.uri);
+		json.field("query", record.query);
+		json.field("route", record.route);
+		json.field("status", uint32_t(record.status));
+		json.field("duration_ms", to_ms(record.duration_ns));
+
+		json.key("phases_ms").begin_object();
+		for (size_t idx = 0; idx < Server::phase_count; ++idx)
+			json.field(Server::phase_name(Server::Phase(idx)), to_ms(record.phase_ns[idx]));
+		json.end_object();
+
+		json.key("env").begin_object();
+		for (auto const& var : record.env)
+			json.field(var.first, var.second);
+		json.end_object();
+
+		// Keys may repeat, so these are pairs rather than an object
+		json.key("response_headers").begin_array();
+		for (auto const& header : record.response_headers)
+			json.begin_array().value(header.first).value(header.second).end_array();
+		json.end_array();
+
+		json.key("trace");
+		if (record.trace.empty())
+			json.null();
+		else
+			json.raw_value(record.trace);
+
+		json.end_object();
+	}
+
+	json.end_array();
+}
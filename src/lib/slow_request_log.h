@@ -0,0 +1,88 @@
+#ifndef FCGISERVER_SLOW_REQUEST_LOG_H
+#define FCGISERVER_SLOW_REQUEST_LOG_H
+
+#include "fcgiserver_defs.h"
+#include "server.h"
+#include "symbol.h"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fcgiserver
+{
+
+class GenericFormatter;
+class Request;
+class SlowRequestLogPrivate;
+
+/// Keeps the last requests that took at least a threshold to handle, with
+/// enough detail to tell why: route, phase timings, a subset of the request
+/// environment, the response headers and, if the request was traced, its
+/// spans. Install it with Server::set_slow_request_log() and serve it with a
+/// SlowRequestRouter.
+///
+/// The request data is released once the response is finished, so the
+/// Server decides on the time taken up to that point; the final flush is
+/// recorded in the write phase but does not count towards the threshold.
+class DLL_PUBLIC SlowRequestLog
+{
+public:
+	using StringPairs = std::vector<std::pair<std::string,std::string>>;
+
+	struct Record
+	{
+		std::chrono::system_clock::time_point time;
+		size_t thread_id;
+		std::string method;
+		std::string uri;
+		std::string query;
+		std::string route;
+		uint16_t status;
+		uint64_t duration_ns;
+		std::array<uint64_t,Server::phase_count> phase_ns;
+		StringPairs env;
+		StringPairs response_headers;
+		/// Chrome trace JSON, empty if the request was not traced
+		std::string trace;
+	};
+
+	SlowRequestLog(size_t capacity = 64, std::chrono::nanoseconds threshold = std::chrono::seconds(1));
+	SlowRequestLog(SlowRequestLog const& other) = delete;
+	SlowRequestLog & operator= (SlowRequestLog const& other) = delete;
+	~SlowRequestLog();
+
+	void set_threshold(std::chrono::nanoseconds threshold);
+	std::chrono::nanoseconds threshold() const;
+	bool is_slow(std::chrono::nanoseconds elapsed) const;
+
+	/// Environment variables copied into every record, by default the ones
+	/// describing the client and the request body
+	void set_env_filter(std::vector<Symbol> names);
+	/// Response headers whose values are replaced by "<redacted>" in every
+	/// record, by default Set-Cookie
+	void set_redacted_headers(std::vector<Symbol> names);
+
+	/// Copies everything the Request knows into a new record; the caller
+	/// fills in the rest and hands it to add()
+	Record capture(Request const& request) const;
+	void add(Record && record);
+
+	/// Newest first
+	std::vector<Record> records() const;
+	size_t capacity() const;
+	void clear();
+
+	/// All records, newest first, as a JSON array
+	void write_json(GenericFormatter & output) const;
+
+private:
+	SlowRequestLogPrivate * m_private;
+};
+
+}
+
+#endif // FCGISERVER_SLOW_REQUEST_LOG_H
@@ -0,0 +1,49 @@
+#include "slow_request_router.h"
+#include "http_status.h"
+#include "request.h"
+#include "request_context.h"
+#include "slow_request_log.h"
+#include "symbols.h"
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+namespace
+{
+
+constexpr HeaderValue AllowGetDelete{"GET, HEAD, DELETE"sv};
+
+}
+
+SlowRequestRouter::SlowRequestRouter(std::shared_ptr<SlowRequestLog> log, std::string_view const& path)
+    : FixedPathRouter(path)
+    , m_log(std::move(log))
+{
+}
+
+IRouter::RouteResult SlowRequestRouter::handle_path(RequestContext & context)
+{
+	Request & request = context.request();
+
+	RequestMethod method = request.request_method();
+	if (method == RequestMethod::DELETE)
+	{
+		m_log->clear();
+		request.set_http_status(204);
+		return IRouter::RouteResult::Handled;
+	}
+	if (method != RequestMethod::GET && method != RequestMethod::HEAD)
+	{
+		request.set_header(symbols::Allow, AllowGetDelete);
+		return IRouter::RouteResult::InvalidMethod;
+	}
+
+	request.set_http_status(200);
+	request.set_content_type(header_values::ApplicationJson);
+	request.set_header(symbols::CacheControl, header_values::NoStore);
+
+	RequestStream stream = request.write_stream();
+	stream.set_generic_format(GenericFormat::Verbatim);
+	m_log->write_json(stream);
+	return IRouter::RouteResult::Handled;
+}
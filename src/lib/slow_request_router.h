@@ -0,0 +1,32 @@
+#ifndef FCGISERVER_SLOW_REQUEST_ROUTER_H
+#define FCGISERVER_SLOW_REQUEST_ROUTER_H
+
+#include "fcgiserver_defs.h"
+#include "fixed_path_router.h"
+#include <memory>
+#include <string_view>
+
+namespace fcgiserver
+{
+
+class SlowRequestLog;
+
+/// Serves a SlowRequestLog as JSON on GET of a single path, relative to
+/// where the router is mounted, and empties it on DELETE. Any other path is
+/// NotFound so it can sit next to a MetricsRouter.
+class DLL_PUBLIC SlowRequestRouter : public FixedPathRouter
+{
+public:
+	SlowRequestRouter(std::shared_ptr<SlowRequestLog> log, std::string_view const& path = "/slow-requests");
+	~SlowRequestRouter() = default;
+
+protected:
+	IRouter::RouteResult handle_path(RequestContext & context) override;
+
+private:
+	std::shared_ptr<SlowRequestLog> m_log;
+};
+
+}
+
+#endif // FCGISERVER_SLOW_REQUEST_ROUTER_H
@@ -13,6 +13,9 @@ namespace symbols
 DLL_PUBLIC Symbol Status("Status");
 DLL_PUBLIC Symbol ContentLength("Content-Length");
 DLL_PUBLIC Symbol ContentType("Content-Type");
+DLL_PUBLIC Symbol SetCookie("Set-Cookie");
+DLL_PUBLIC Symbol CacheControl("Cache-Control");
+DLL_PUBLIC Symbol Allow("Allow");
 
 // Common Environment/Request symbols
 DLL_PUBLIC Symbol CONTENT_TYPE("CONTENT_TYPE");
@@ -25,6 +28,7 @@ DLL_PUBLIC Symbol DOCUMENT_URI("DOCUMENT_URI");
 DLL_PUBLIC Symbol PATH_INFO("PATH_INFO");
 DLL_PUBLIC Symbol REMOTE_ADDR("REMOTE_ADDR");
 DLL_PUBLIC Symbol REMOTE_PORT("REMOTE_PORT");
+DLL_PUBLIC Symbol HTTP_HOST("HTTP_HOST");
 DLL_PUBLIC Symbol HTTP_USER_AGENT("HTTP_USER_AGENT");
 DLL_PUBLIC Symbol HTTP_DNT("HTTP_DNT");
 
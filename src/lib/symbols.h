@@ -13,6 +13,9 @@ namespace symbols
 extern Symbol const Status;
 extern Symbol const ContentLength;
 extern Symbol const ContentType;
+extern Symbol const SetCookie;
+extern Symbol const CacheControl;
+extern Symbol const Allow;
 
 // Common Environment/Request symbols
 extern Symbol const CONTENT_TYPE;
@@ -25,6 +28,7 @@ extern Symbol const DOCUMENT_URI;
 extern Symbol const PATH_INFO;
 extern Symbol const REMOTE_ADDR;
 extern Symbol const REMOTE_PORT;
+extern Symbol const HTTP_HOST;
 extern Symbol const HTTP_USER_AGENT;
 extern Symbol const HTTP_DNT;
 
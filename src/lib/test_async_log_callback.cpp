@@ -0,0 +1,150 @@
+#include "async_log_callback.h"
+#include "logger.h"
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using namespace fcgiserver;
+
+#include <catch2/catch_test_macros.hpp>
+
+namespace
+{
+
+size_t count(std::string const& haystack, std::string const& needle)
+{
+	size_t result = 0;
+	for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1))
+		++result;
+	return result;
+}
+
+// Collects everything written to a pipe until its write end is closed
+class PipeReader
+{
+public:
+	PipeReader()
+	{
+		REQUIRE( ::pipe(m_fds) == 0 );
+	}
+
+	~PipeReader()
+	{
+		close_write();
+		if (m_thread.joinable())
+			m_thread.join();
+		::close(m_fds[0]);
+	}
+
+	int fd() const { return m_fds[1]; }
+
+	void start()
+	{
+		m_thread = std::thread([this] ()
+		{
+			char buffer[4096];
+			ssize_t size;
+			while ((size = ::read(m_fds[0], buffer, sizeof(buffer))) > 0)
+				m_output.append(buffer, size);
+		});
+	}
+
+	std::string const& finish()
+	{
+		close_write();
+		m_thread.join();
+		return m_output;
+	}
+
+private:
+	void close_write()
+	{
+		if (m_fds[1] >= 0)
+			::close(m_fds[1]);
+		m_fds[1] = -1;
+	}
+
+	int m_fds[2];
+	std::thread m_thread;
+	std::string m_output;
+};
+
+}
+
+TEST_CASE("AsyncLogCallback-Output", "[async_log_callback]")
+{
+	PipeReader out;
+	PipeReader err;
+	out.start();
+	err.start();
+
+	constexpr size_t num_threads = 4;
+	constexpr size_t num_lines = 2000;
+
+	{
+		Logger logger(std::make_unique<AsyncLogCallback>(AsyncLogCallback::OverflowPolicy::Block, 1024, out.fd(), err.fd()));
+
+		logger.info() << "first";
+		static_cast<AsyncLogCallback*>(logger.log_callback())->flush();
+
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < num_threads; ++t)
+		{
+			threads.emplace_back([&logger, t] ()
+			{
+				for (size_t i = 0; i < num_lines; ++i)
+					logger.debug() << "thread " << t << " line " << i;
+			});
+		}
+		for (auto & thread : threads)
+			thread.join();
+
+		logger.error() << "an error";
+		logger.info() << std::string(2000, 'x');
+		REQUIRE( static_cast<AsyncLogCallback*>(logger.log_callback())->dropped() == 0 );
+	}
+
+	std::string const& output = out.finish();
+	REQUIRE( output.find("[INFO] first\n") == 0 );
+	REQUIRE( count(output, "[DEBUG] thread ") == num_threads * num_lines );
+
+	// Lines of one thread stay in order
+	REQUIRE( output.find("[DEBUG] thread 2 line 99\n") < output.find("[DEBUG] thread 2 line 100\n") );
+	REQUIRE( output.find("[DEBUG] thread 2 line 1999\n") != std::string::npos );
+
+	// Overly long lines are truncated to fit the ring
+	size_t long_line = output.find("[INFO] xxx");
+	REQUIRE( long_line != std::string::npos );
+	REQUIRE( output.find('\n', long_line) - long_line < 256 );
+
+	REQUIRE( err.finish() == "[ERROR] an error\n" );
+}
+
+TEST_CASE("AsyncLogCallback-Dropping", "[async_log_callback]")
+{
+	PipeReader out;
+
+	constexpr size_t num_lines = 10000;
+	uint64_t dropped;
+
+	{
+		Logger logger(std::make_unique<AsyncLogCallback>(AsyncLogCallback::OverflowPolicy::Drop, 1024, out.fd(), out.fd()));
+
+		// Nobody reads the pipe yet, so the writer stalls and the ring fills up
+		std::string padding(80, '.');
+		for (size_t i = 0; i < num_lines; ++i)
+			logger.info() << "line " << i << padding;
+
+		dropped = static_cast<AsyncLogCallback*>(logger.log_callback())->dropped();
+		REQUIRE( dropped > 0 );
+		REQUIRE( dropped < num_lines );
+
+		out.start();
+	}
+
+	std::string const& output = out.finish();
+	REQUIRE( count(output, "[INFO] line ") == num_lines - dropped );
+	REQUIRE( output.find("log lines dropped\n") != std::string::npos );
+}
@@ -0,0 +1,63 @@
+#include "header_list.h"
+#include "symbols.h"
+#include <catch2/catch_test_macros.hpp>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+TEST_CASE("HeaderList", "[request]")
+{
+	HeaderList headers;
+	Symbol custom("X-Custom-Header");
+
+	SECTION("Initially empty")
+	{
+		REQUIRE( headers.empty() );
+		REQUIRE( headers.get(symbols::ContentType).empty() );
+		REQUIRE( !headers.contains(symbols::ContentType) );
+	}
+
+	SECTION("Set replaces existing values")
+	{
+		headers.set(symbols::ContentType, "text/plain");
+		headers.set(custom, "1");
+		headers.set(symbols::ContentType, "text/html");
+
+		REQUIRE( headers.size() == 2 );
+		REQUIRE( headers.get(symbols::ContentType) == "text/html"sv );
+		REQUIRE( headers.get(custom) == "1"sv );
+	}
+
+	SECTION("Add keeps multiple values")
+	{
+		headers.add(symbols::SetCookie, "a=1");
+		headers.add(symbols::SetCookie, "b=2");
+		headers.add(custom, "x");
+		headers.add(symbols::SetCookie, "c=3");
+
+		REQUIRE( headers.size() == 4 );
+		REQUIRE( headers.count(symbols::SetCookie) == 3 );
+		REQUIRE( headers.get(symbols::SetCookie) == "a=1"sv );
+
+		headers.set(symbols::SetCookie, "d=4");
+		REQUIRE( headers.size() == 2 );
+		REQUIRE( headers.count(symbols::SetCookie) == 1 );
+		REQUIRE( headers.get(symbols::SetCookie) == "d=4"sv );
+
+		REQUIRE( headers.remove(symbols::SetCookie) );
+		REQUIRE( !headers.remove(symbols::SetCookie) );
+		REQUIRE( headers.size() == 1 );
+	}
+
+	SECTION("Rendering keeps insertion order")
+	{
+		headers.set(symbols::Status, "200");
+		headers.add(symbols::SetCookie, "a=1");
+		headers.set(symbols::ContentType, "text/html");
+		headers.add(symbols::SetCookie, "b=2");
+
+		std::string output;
+		headers.render(output);
+		REQUIRE( output == "Status: 200\r\nSet-Cookie: a=1\r\nContent-Type: text/html\r\nSet-Cookie: b=2\r\n\r\n" );
+	}
+}
@@ -0,0 +1,142 @@
+#include "host_router.h"
+#include "request.h"
+#include "request_context.h"
+#include "router.h"
+#include "test_mock_cgi_data.h"
+#include "test_mock_logger.h"
+#include <memory>
+#include <string>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+#include <catch2/catch_test_macros.hpp>
+
+namespace
+{
+
+struct HostMarker : public IRouter
+{
+	HostMarker(int id, int & hit) : id(id), hit(hit) {}
+
+	RouteResult handle_request(RequestContext &) override
+	{
+		hit = id;
+		return RouteResult::Handled;
+	}
+
+	int id;
+	int & hit;
+};
+
+}
+
+TEST_CASE("HostRouter-Matching", "[router]")
+{
+	int hit = 0;
+	auto marker = [&hit] (int id) { return std::make_shared<HostMarker>(id, hit); };
+
+	HostRouter router;
+	REQUIRE( router.add_host("example.com", marker(1)) );
+	REQUIRE( router.add_host("*.example.com", marker(2)) );
+	REQUIRE( router.add_host("*.api.example.com", marker(3)) );
+	REQUIRE( router.add_host("Other.ORG.", marker(4)) );
+	REQUIRE( router.add_host("[::1]", marker(5)) );
+
+	Logger logger = MockLogger::create();
+	const char *envp[] = { nullptr, nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	auto route = [&] (char const* host) -> int
+	{
+		hit = 0;
+		envp[0] = host;
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		auto result = router.handle_request(context);
+		if (result != IRouter::RouteResult::Handled)
+			return -1;
+		return hit;
+	};
+
+	SECTION("Exact hosts")
+	{
+		REQUIRE( route("HTTP_HOST=example.com") == 1 );
+		REQUIRE( route("HTTP_HOST=EXAMPLE.com") == 1 );
+		REQUIRE( route("HTTP_HOST=example.com:8080") == 1 );
+		REQUIRE( route("HTTP_HOST=example.com.") == 1 );
+		REQUIRE( route("HTTP_HOST=other.org") == 4 );
+		REQUIRE( route("HTTP_HOST=[::1]:443") == 5 );
+	}
+
+	SECTION("Wildcard suffixes")
+	{
+		REQUIRE( route("HTTP_HOST=www.example.com") == 2 );
+		REQUIRE( route("HTTP_HOST=a.b.example.com") == 2 );
+		REQUIRE( route("HTTP_HOST=v1.API.example.com") == 3 );
+		REQUIRE( route("HTTP_HOST=api.example.com") == 2 );
+		REQUIRE( route("HTTP_HOST=www.example.com.evil") == -1 );
+		REQUIRE( route("HTTP_HOST=wwwexample.com") == -1 );
+	}
+
+	SECTION("Unknown hosts")
+	{
+		REQUIRE( route("HTTP_HOST=example.org") == -1 );
+		REQUIRE( route(nullptr) == -1 );
+
+		REQUIRE( router.add_host("*", marker(6)) );
+		REQUIRE( route("HTTP_HOST=example.org") == 6 );
+		REQUIRE( route(nullptr) == 6 );
+		REQUIRE( route("HTTP_HOST=example.com") == 1 );
+	}
+
+	SECTION("Removing hosts")
+	{
+		REQUIRE( router.remove_host("*.EXAMPLE.com") );
+		REQUIRE( !router.remove_host("*.example.com") );
+		REQUIRE( route("HTTP_HOST=www.example.com") == -1 );
+		REQUIRE( route("HTTP_HOST=v1.api.example.com") == 3 );
+	}
+
+	SECTION("Invalid patterns")
+	{
+		REQUIRE( !router.add_host("", marker(7)) );
+		REQUIRE( !router.add_host("*.", marker(7)) );
+		REQUIRE( !router.add_host("www.*.com", marker(7)) );
+		REQUIRE( !router.add_host("example.com:80", marker(7)) );
+		REQUIRE( !router.add_host("a..b", marker(7)) );
+		REQUIRE( !router.add_host(".example.com", marker(7)) );
+		REQUIRE( !router.remove_host(".example.com") );
+		REQUIRE( !router.add_host("example.net", nullptr) );
+	}
+}
+
+TEST_CASE("HostRouter-Path routing", "[router]")
+{
+	int called = 0;
+	auto site = std::make_shared<Router>();
+	site->add_route([&called] (RequestContext &) { ++called; }, "/index", RequestMethod::GET);
+
+	HostRouter router;
+	router.add_host("*.example.com", site);
+
+	Logger logger = MockLogger::create();
+	const char *envp[] = { "HTTP_HOST=www.example.com", "REQUEST_METHOD=GET", nullptr, nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	envp[2] = "DOCUMENT_URI=/index";
+	{
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		REQUIRE( router.handle_request(context) == IRouter::RouteResult::Handled );
+	}
+
+	envp[2] = "DOCUMENT_URI=/missing";
+	{
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		REQUIRE( router.handle_request(context) == IRouter::RouteResult::NotFound );
+	}
+
+	REQUIRE( called == 1 );
+}
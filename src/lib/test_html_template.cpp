@@ -0,0 +1,74 @@
+#include "html_template.h"
+#include "line_formatter.h"
+#include <catch2/catch_test_macros.hpp>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+TEST_CASE("HtmlTemplate", "[template]")
+{
+	LineFormatter lf;
+
+	SECTION("Slots and segments")
+	{
+		HtmlTemplate page("<h1>{{title}}</h1><p>{{ count }} items, {{ratio}} full</p><title>{{title}}</title>");
+		REQUIRE( page.is_valid() );
+		REQUIRE( page.slot_count() == 3 );
+		REQUIRE( page.slot_index("title") == 0 );
+		REQUIRE( page.slot_index("count") == 1 );
+		REQUIRE( page.slot_index("missing") == HtmlTemplate::npos );
+		REQUIRE( page.slot_name(2) == "ratio"sv );
+
+		REQUIRE( page.render(lf, { "Fish & <Chips>", 12, 0.5 }) );
+		REQUIRE( lf.buffer() == "<h1>Fish &amp; &lt;Chips&rt;</h1><p>12 items, 0.5 full</p><title>Fish &amp; &lt;Chips&rt;</title>"sv );
+	}
+
+	SECTION("Static segments are not escaped")
+	{
+		lf.set_generic_format(GenericFormat::HTMLContent);
+
+		HtmlTemplate page("<a href=\"?a=1&b=2\">\xe2\x84\xa2 {{name}}</a>");
+		REQUIRE( page.render(lf, { "\xe2\x84\xa2"sv }) );
+		REQUIRE( lf.buffer() == "<a href=\"?a=1&b=2\">\xe2\x84\xa2 &#x2122;</a>"sv );
+		REQUIRE( lf.generic_format() == GenericFormat::HTMLContent );
+	}
+
+	SECTION("No slots")
+	{
+		HtmlTemplate page("<hr/>");
+		REQUIRE( page.slot_count() == 0 );
+		REQUIRE( page.render(lf, {}) );
+		REQUIRE( lf.buffer() == "<hr/>"sv );
+
+		HtmlTemplate empty("");
+		REQUIRE( empty.render(lf, {}) );
+		REQUIRE( lf.buffer() == "<hr/>"sv );
+	}
+
+	SECTION("Invalid templates")
+	{
+		for (std::string_view source : { "{{unterminated"sv, "{{}}"sv, "a {{  }} b"sv })
+		{
+			HtmlTemplate page{std::string(source)};
+			REQUIRE( !page.is_valid() );
+			REQUIRE( page.slot_count() == 0 );
+			REQUIRE( !page.render(lf, { "x" }) );
+		}
+		REQUIRE( lf.empty() );
+	}
+
+	SECTION("Too few values")
+	{
+		HtmlTemplate page("{{a}}{{b}}");
+		REQUIRE( !page.render(lf, { "x" }) );
+		REQUIRE( lf.empty() );
+	}
+
+	SECTION("Moved templates keep working")
+	{
+		HtmlTemplate original("<i>{{x}}</i>");
+		HtmlTemplate page(std::move(original));
+		REQUIRE( page.render(lf, { uint64_t(7) }) );
+		REQUIRE( lf.buffer() == "<i>7</i>"sv );
+	}
+}
@@ -0,0 +1,120 @@
+#include "http_status.h"
+#include "json_writer.h"
+#include "line_formatter.h"
+#include "request.h"
+#include "request_stream.h"
+#include "test_mock_cgi_data.h"
+#include "test_mock_logger.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cmath>
+#include <limits>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+TEST_CASE("JsonWriter", "[json]")
+{
+	LineFormatter lf;
+	JsonWriter json(lf);
+
+	SECTION("Scalars")
+	{
+		json.value(42);
+		REQUIRE( lf.buffer() == "42"sv );
+		REQUIRE( json.complete() );
+	}
+
+	SECTION("Objects and arrays")
+	{
+		REQUIRE( !json.complete() );
+
+		json.begin_object();
+		json.field("id", 42).field("name", "x").field("ok", true).field("big", uint64_t(18446744073709551615ull));
+		json.key("nothing").null();
+		json.key("list").begin_array().value(-1).value(1.5).begin_object().end_object().begin_array().end_array().end_array();
+		REQUIRE( !json.complete() );
+		json.end_object();
+
+		REQUIRE( json.complete() );
+		REQUIRE( lf.buffer() == R"({"id":42,"name":"x","ok":true,"big":18446744073709551615,"nothing":null,"list":[-1,1.5,{},[]]})"sv );
+	}
+
+	SECTION("Doubles")
+	{
+		json.begin_array().value(0.1).value(1e300).value(std::nan("")).value(std::numeric_limits<double>::infinity()).end_array();
+		REQUIRE( lf.buffer() == "[0.1,1e+300,null,null]"sv );
+	}
+
+	SECTION("String escaping")
+	{
+		json.begin_array();
+		json.value("quote\" backslash\\ slash/"sv);
+		json.value("\n\r\t\x01\x1f"sv);
+		json.value("nul\0byte"sv);
+		json.value("caf\xc3\xa9 \xe2\x84\xa2 <&>"sv);
+		json.value("bad \xe2\xf4\xa2 utf8"sv);
+		json.end_array();
+
+		REQUIRE( lf.buffer() == "[\"quote\\\" backslash\\\\ slash/\","
+		                        "\"\\n\\r\\t\\u0001\\u001f\","
+		                        "\"nul\\u0000byte\","
+		                        "\"caf\xc3\xa9 \xe2\x84\xa2 <&>\","
+		                        "\"bad \xef\xbf\xbd utf8\"]"sv );
+	}
+
+	SECTION("Long strings")
+	{
+		std::string input;
+		std::string expected = "\"";
+		for (int i = 0; i < 200; ++i)
+		{
+			input += "abcdefghij\"";
+			expected += "abcdefghij\\\"";
+		}
+		expected += '"';
+
+		json.value(input);
+		REQUIRE( lf.buffer() == expected );
+	}
+
+	SECTION("Output format is left alone")
+	{
+		lf.set_generic_format(GenericFormat::HTMLContent);
+		json.begin_object().field("a<b", "&").key("raw").raw_value("[1,2]").end_object();
+		REQUIRE( lf.buffer() == R"({"a<b":"&","raw":[1,2]})"sv );
+		REQUIRE( lf.generic_format() == GenericFormat::HTMLContent );
+	}
+
+	SECTION("Format mode")
+	{
+		lf.set_generic_format(GenericFormat::JSON);
+		lf << "say \"hi\"\n"sv << U"\u2122\""sv;
+		REQUIRE( lf.buffer() == "say \\\"hi\\\"\\n\xe2\x84\xa2\\\""sv );
+	}
+}
+
+TEST_CASE("JsonWriter-RequestStream", "[json]")
+{
+	const char *envp[] = { "REQUEST_METHOD=GET", nullptr };
+
+	MockCgiData cgidata(std::string(), envp);
+	Logger logger = MockLogger::create();
+	Request request(cgidata, logger);
+	request.set_content_type(header_values::ApplicationJson);
+
+	{
+		auto stream = request.write_stream();
+		JsonWriter json(stream);
+
+		json.begin_array();
+		for (int i = 0; i < 100; ++i)
+			json.begin_object().field("id", i).field("name", "item").end_object();
+		json.end_array();
+	}
+
+	std::string_view body = cgidata.m_writebuf;
+	body = body.substr(body.find("\r\n\r\n") + 4);
+	REQUIRE( body.substr(0, 29) == R"([{"id":0,"name":"item"},{"id")"sv );
+	REQUIRE( body.back() == ']' );
+	REQUIRE( cgidata.m_write_count == 2 );
+}
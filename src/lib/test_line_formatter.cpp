@@ -1,7 +1,10 @@
 #include "line_formatter.h"
 #include "symbols.h"
+#include "utils.h"
 #include <catch2/catch_test_macros.hpp>
 #include <climits>
+#include <cstdio>
+#include <random>
 
 using namespace fcgiserver;
 using namespace std::literals::string_view_literals;
@@ -165,3 +168,125 @@ TEST_CASE("LineFormatter", "[logger]")
 		}
 	}
 }
+
+namespace
+{
+
+// The byte at a time conversion, to check the scanning version against
+std::string reference_format(GenericFormat format, std::string_view s)
+{
+	std::string result;
+	utils::convert_state mbstate;
+
+	for (char c : s)
+	{
+		char32_t glyph = utils::utf8_to_32(c, mbstate);
+		if (glyph == 0)
+			continue;
+
+		if (format == GenericFormat::UTF8)
+		{
+			uint8_t tmp[4];
+			result.append(reinterpret_cast<char*>(tmp), utils::utf32_to_8(glyph, tmp));
+		}
+		else if (glyph < 0x80)
+		{
+			if (c == '<' && format == GenericFormat::HTMLContent)
+				result += "&lt;";
+			else if (c == '>' && format == GenericFormat::HTMLContent)
+				result += "&rt;";
+			else if (c == '&')
+				result += "&amp;";
+			else
+				result += c;
+		}
+		else
+		{
+			char tmp[16];
+			result.append(tmp, std::snprintf(tmp, sizeof(tmp), "&#x%x;", glyph));
+		}
+	}
+
+	return result;
+}
+
+}
+
+TEST_CASE("LineFormatter-Escaping", "[logger]")
+{
+	constexpr std::string_view alphabet = "abcdefghijklmnop <>&\"'\0\x7f\x80\xa2\xbf\xc3\xe2\x84\xed\xf0\xf4\xff"sv;
+
+	std::mt19937 rng(2468);
+	std::uniform_int_distribution<size_t> length_dist(0, 400);
+	std::uniform_int_distribution<size_t> char_dist(0, alphabet.size() - 1);
+
+	for (GenericFormat format : { GenericFormat::UTF8, GenericFormat::HTML, GenericFormat::HTMLContent })
+	{
+		LineFormatter lf(format);
+		for (int i = 0; i < 500; ++i)
+		{
+			std::string input(length_dist(rng), ' ');
+			for (char & c : input)
+				c = alphabet[char_dist(rng)];
+
+			lf.clear();
+			lf << input;
+			REQUIRE( lf.buffer() == reference_format(format, input) );
+		}
+
+		// Long clean runs bypass the staging buffer
+		std::string clean(1000, 'x');
+		clean[500] = '&';
+		lf.clear();
+		lf << clean;
+		REQUIRE( lf.buffer() == reference_format(format, clean) );
+	}
+}
+
+TEST_CASE("LineFormatter-Format", "[logger]")
+{
+	static_assert(format_string::summarize("a{}b{}"sv).arguments == 2);
+	static_assert(format_string::summarize("{{}}"sv).literal_size == 2);
+	static_assert(format_string::summarize("{{}}"sv).arguments == 0);
+	static_assert(!format_string::summarize("{"sv).valid);
+	static_assert(!format_string::summarize("a}b"sv).valid);
+	static_assert(!format_string::summarize("{x}"sv).valid);
+
+	LineFormatter lf;
+
+	SECTION("Arguments and literals")
+	{
+		lf.format(FCGISERVER_FORMAT("{} + {} = {}, {}!"), 1, 2u, int64_t(3), "done"sv);
+		REQUIRE( lf.buffer() == "1 + 2 = 3, done!"sv );
+	}
+
+	SECTION("Escaped braces")
+	{
+		lf.format(FCGISERVER_FORMAT("{{{}}} {{}}"), std::string("x"));
+		REQUIRE( lf.buffer() == "{x} {}"sv );
+	}
+
+	SECTION("No arguments")
+	{
+		lf.format(FCGISERVER_FORMAT(""));
+		REQUIRE( lf.empty() );
+
+		lf.format(FCGISERVER_FORMAT("plain"));
+		REQUIRE( lf.buffer() == "plain"sv );
+	}
+
+	SECTION("Literals are verbatim, arguments are encoded")
+	{
+		lf.set_generic_format(GenericFormat::HTMLContent);
+		lf.format(FCGISERVER_FORMAT("<b>{}</b>"), "a<b"sv);
+		REQUIRE( lf.buffer() == "<b>a&lt;b</b>"sv );
+	}
+
+	SECTION("Space is reserved once")
+	{
+		std::string long_argument(300, 'x');
+		lf.format(FCGISERVER_FORMAT("[{}] [{}]"), long_argument, 42);
+		REQUIRE( lf.buffer().size() == 307 );
+		REQUIRE( lf.buffer().capacity() >= 313 );
+	}
+}
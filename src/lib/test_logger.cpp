@@ -82,6 +82,15 @@ TEST_CASE("Logger", "[logger]")
 		REQUIRE( mock_logger->log_error == std::vector<std::string>{ expected } );
 	}
 
+	SECTION("Compile time formatting")
+	{
+		logger.log(LogLevel::Debug, FCGISERVER_FORMAT("A {} and a {}"), "string", 43);
+		REQUIRE( mock_logger->log_debug == std::vector<std::string>{ "A string and a 43" } );
+
+		logger.log(LogLevel::Info, FCGISERVER_FORMAT("No arguments"));
+		REQUIRE( mock_logger->log_info == std::vector<std::string>{ "No arguments" } );
+	}
+
 	SECTION("Newline splitting")
 	{
 		logger.log(LogLevel::Info, "");
@@ -110,6 +119,52 @@ TEST_CASE("Logger", "[logger]")
 		REQUIRE( new_mock_logger->log_info == std::vector<std::string>{ "New logger test"} );
 	}
 
+	SECTION("Minimum level")
+	{
+		REQUIRE( logger.min_level() == LogLevel::Debug );
+		logger.set_min_level(LogLevel::Info);
+		REQUIRE( !logger.enabled(LogLevel::Debug) );
+		REQUIRE( logger.enabled(LogLevel::Info) );
+		REQUIRE( logger.enabled(LogLevel::Error) );
+
+		logger.log(LogLevel::Debug, "Filtered");
+		logger.logf(LogLevel::Debug, "Filtered %d", 1);
+		logger.log(LogLevel::Debug, FCGISERVER_FORMAT("Filtered {}"), 2);
+		logger.debug() << "Filtered " << 3;
+		logger.info() << "Passed";
+		REQUIRE( mock_logger->log_debug.empty() );
+		REQUIRE( mock_logger->log_info == std::vector<std::string>{ "Passed" } );
+
+		{
+			LogStream stream = logger.debug();
+			REQUIRE( !stream.enabled() );
+			stream << "Nothing" << 42;
+			stream.printf("%s", "at all");
+			REQUIRE( stream.empty() );
+		}
+		REQUIRE( mock_logger->log_debug.empty() );
+
+		// Arguments are not even evaluated
+		int evaluated = 0;
+		FCGISERVER_LOG_DEBUG(logger) << "Filtered " << ++evaluated;
+		REQUIRE( evaluated == 0 );
+		FCGISERVER_LOG_ERROR(logger) << "Passed " << ++evaluated;
+		REQUIRE( evaluated == 1 );
+		REQUIRE( mock_logger->log_error == std::vector<std::string>{ "Passed 1" } );
+
+		// The logger expression is evaluated once, enabled or not
+		int fetched = 0;
+		auto get_logger = [&] () -> Logger & { ++fetched; return logger; };
+		FCGISERVER_LOG_DEBUG(get_logger()) << "Filtered";
+		FCGISERVER_LOG_ERROR(get_logger()) << "Fetched once";
+		REQUIRE( fetched == 2 );
+		REQUIRE( mock_logger->log_error.back() == "Fetched once" );
+
+		logger.set_min_level(LogLevel::Debug);
+		FCGISERVER_LOG_DEBUG(logger) << "Passed";
+		REQUIRE( mock_logger->log_debug == std::vector<std::string>{ "Passed" } );
+	}
+
 	SECTION("Dont crash when there is no callback")
 	{
 		std::unique_ptr<MockLogger> no_mock_logger;
@@ -0,0 +1,274 @@
+#include "host_router.h"
+#include "line_formatter.h"
+#include "metrics.h"
+#include "metrics_router.h"
+#include "request.h"
+#include "request_context.h"
+#include "router.h"
+#include "server.h"
+#include "test_mock_cgi_data.h"
+#include "test_mock_logger.h"
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("Metrics-Buckets", "[metrics]")
+{
+	for (uint64_t us = 0; us < 8; ++us)
+	{
+		REQUIRE( Metrics::bucket_index(us) == us );
+		REQUIRE( Metrics::bucket_upper_bound(us) == us + 1 );
+	}
+
+	// Every value lands in a bucket that contains it, within 25%
+	size_t previous = 0;
+	for (uint64_t us = 8; us < (uint64_t(1) << 40); us += us / 7 + 1)
+	{
+		size_t index = Metrics::bucket_index(us);
+		REQUIRE( index >= previous );
+		REQUIRE( index < Metrics::bucket_count );
+		REQUIRE( Metrics::bucket_upper_bound(index) > us );
+		REQUIRE( Metrics::bucket_upper_bound(index) <= us + us / 4 + 1 );
+		previous = index;
+	}
+
+	REQUIRE( Metrics::bucket_index(UINT64_MAX) == Metrics::bucket_count - 1 );
+}
+
+TEST_CASE("Metrics-Recording", "[metrics]")
+{
+	Metrics & metrics = Metrics::instance();
+	uint32_t id = metrics.route_id("/test/recording");
+	REQUIRE( id != Metrics::unmatched );
+	REQUIRE( metrics.route_id("/test/recording") == id );
+
+	constexpr size_t num_threads = 4;
+	constexpr size_t num_requests = 1000;
+
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < num_threads; ++t)
+	{
+		threads.emplace_back([&metrics, id] ()
+		{
+			for (size_t i = 0; i < num_requests; ++i)
+			{
+				metrics.request_started(id);
+				metrics.request_finished(id, i % 10 == 0 ? 500 : 200, std::chrono::microseconds(100), 10);
+			}
+		});
+	}
+	for (auto & thread : threads)
+		thread.join();
+
+	metrics.request_started(id);
+
+	Metrics::RouteSnapshot snapshot = metrics.snapshot(id);
+	REQUIRE( snapshot.label == "/test/recording" );
+	REQUIRE( snapshot.requests == num_threads * num_requests );
+	REQUIRE( snapshot.in_flight == 1 );
+	REQUIRE( snapshot.status_classes[2] == num_threads * num_requests * 9 / 10 );
+	REQUIRE( snapshot.status_classes[5] == num_threads * num_requests / 10 );
+	REQUIRE( snapshot.bytes_out == num_threads * num_requests * 10 );
+	REQUIRE( snapshot.latency.sum_ns == num_threads * num_requests * 100000 );
+	REQUIRE( snapshot.latency.percentile(0.5) == Metrics::bucket_upper_bound(Metrics::bucket_index(100)) );
+
+	metrics.request_finished(id, 204, std::chrono::milliseconds(50), 0);
+	snapshot = metrics.snapshot(id);
+	REQUIRE( snapshot.in_flight == 0 );
+	REQUIRE( snapshot.latency.percentile(1.0) >= 50000 );
+	REQUIRE( snapshot.latency.percentile(0.99) < 50000 );
+}
+
+TEST_CASE("Metrics-Routes", "[metrics]")
+{
+	auto router = std::make_shared<Router>();
+	router->add_route([] (RequestContext & context) { context.request().write("hello"); }, "/metrics-test/{id:int}", RequestMethod::GET);
+	router->add_route([] (RequestContext & context) { context.request().set_http_status(404); }, "/metrics-test/missing", RequestMethod::GET);
+	router->add_route([] (RequestContext &) { throw std::runtime_error("oops"); }, "/metrics-test/throws", RequestMethod::GET);
+	router->add_prefix_route([] (RequestContext &) {}, "/metrics-prefix/");
+	router->add_route(std::make_shared<MetricsRouter>("/internal/metrics"), "/");
+
+	Metrics & metrics = Metrics::instance();
+	Logger logger = MockLogger::create();
+	const char *envp[] = { "REQUEST_METHOD=GET", nullptr, nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	auto route = [&] (char const* uri)
+	{
+		envp[1] = uri;
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		return router->handle_request(context);
+	};
+
+	REQUIRE( route("DOCUMENT_URI=/metrics-test/1") == IRouter::RouteResult::Handled );
+	REQUIRE( route("DOCUMENT_URI=/metrics-test/2") == IRouter::RouteResult::Handled );
+	REQUIRE( route("DOCUMENT_URI=/metrics-test/missing") == IRouter::RouteResult::Handled );
+	REQUIRE_THROWS( route("DOCUMENT_URI=/metrics-test/throws") );
+	REQUIRE( route("DOCUMENT_URI=/metrics-prefix/a/b") == IRouter::RouteResult::Handled );
+
+	Metrics::RouteSnapshot snapshot = metrics.snapshot(metrics.route_id("/metrics-test/{id:int}"));
+	REQUIRE( snapshot.requests == 2 );
+	REQUIRE( snapshot.status_classes[2] == 2 );
+	REQUIRE( snapshot.bytes_out == 10 );
+
+	REQUIRE( metrics.snapshot(metrics.route_id("/metrics-test/missing")).status_classes[4] == 1 );
+	REQUIRE( metrics.snapshot(metrics.route_id("/metrics-test/throws")).status_classes[5] == 1 );
+	REQUIRE( metrics.snapshot(metrics.route_id("/metrics-test/throws")).in_flight == 0 );
+	REQUIRE( metrics.snapshot(metrics.route_id("/metrics-prefix/*")).requests == 1 );
+
+	cgidata.m_writebuf.clear();
+	REQUIRE( route("DOCUMENT_URI=/internal/metrics") == IRouter::RouteResult::Handled );
+
+	std::string const& output = cgidata.m_writebuf;
+	REQUIRE( output.find("Content-Type: text/plain; version=0.0.4") != std::string::npos );
+	REQUIRE( output.find("# TYPE fcgiserver_requests_total counter\n") != std::string::npos );
+	REQUIRE( output.find("fcgiserver_requests_total{route=\"/metrics-test/{id:int}\",status=\"2xx\"} 2\n") != std::string::npos );
+	REQUIRE( output.find("fcgiserver_requests_total{route=\"/metrics-test/throws\",status=\"5xx\"} 1\n") != std::string::npos );
+	REQUIRE( output.find("fcgiserver_response_bytes_total{route=\"/metrics-test/{id:int}\"} 10\n") != std::string::npos );
+	REQUIRE( output.find("fcgiserver_request_duration_seconds_bucket{route=\"/metrics-test/{id:int}\",le=\"+Inf\"} 2\n") != std::string::npos );
+	REQUIRE( output.find("fcgiserver_request_duration_seconds_count{route=\"/metrics-test/{id:int}\"} 2\n") != std::string::npos );
+}
+
+TEST_CASE("Metrics-Route prefixes", "[metrics]")
+{
+	auto hello = [] (RequestContext & context) { context.request().write("hello"); };
+
+	// The same paths in different routers are counted apart
+	auto v1 = std::make_shared<Router>();
+	v1->add_route(hello, "/prefixed");
+	auto v2 = std::make_shared<Router>();
+	v2->add_route(hello, "/prefixed");
+	auto own = std::make_shared<Router>("own");
+	own->add_route(hello, "/prefixed");
+
+	auto api = std::make_shared<Router>();
+	api->add_route(v1, "/v1");
+	api->add_route(v2, "v2/");
+	api->add_route(own, "/own");
+	REQUIRE( v1->metrics_prefix() == "/v1" );
+	REQUIRE( own->metrics_prefix() == "own" );
+
+	HostRouter hosts;
+	hosts.add_host("prefix.example.com", api);
+	REQUIRE( api->metrics_prefix() == "prefix.example.com" );
+	REQUIRE( v1->metrics_prefix() == "prefix.example.com/v1" );
+	REQUIRE( v2->metrics_prefix() == "prefix.example.com/v2" );
+	REQUIRE( own->metrics_prefix() == "own" );
+
+	Metrics & metrics = Metrics::instance();
+	Logger logger = MockLogger::create();
+	const char *envp[] = { "HTTP_HOST=prefix.example.com", nullptr, nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	auto route = [&] (char const* uri)
+	{
+		envp[1] = uri;
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		return hosts.handle_request(context);
+	};
+
+	REQUIRE( route("DOCUMENT_URI=/v1/prefixed") == IRouter::RouteResult::Handled );
+	REQUIRE( route("DOCUMENT_URI=/v2/prefixed") == IRouter::RouteResult::Handled );
+	REQUIRE( route("DOCUMENT_URI=/v2/prefixed") == IRouter::RouteResult::Handled );
+	REQUIRE( route("DOCUMENT_URI=/own/prefixed") == IRouter::RouteResult::Handled );
+	REQUIRE( metrics.snapshot(metrics.route_id("prefix.example.com/v1/prefixed")).requests == 1 );
+	REQUIRE( metrics.snapshot(metrics.route_id("prefix.example.com/v2/prefixed")).requests == 2 );
+	REQUIRE( metrics.snapshot(metrics.route_id("own/prefixed")).requests == 1 );
+
+	// An explicit prefix sticks and is passed on to the nested routers
+	api->set_metrics_prefix("/api");
+	hosts.add_host("other.example.com", api);
+	REQUIRE( api->metrics_prefix() == "/api" );
+	REQUIRE( v1->metrics_prefix() == "/api/v1" );
+
+	REQUIRE( route("DOCUMENT_URI=/v1/prefixed") == IRouter::RouteResult::Handled );
+	REQUIRE( metrics.snapshot(metrics.route_id("/api/v1/prefixed")).requests == 1 );
+}
+
+TEST_CASE("Metrics-Label escaping", "[metrics]")
+{
+	Metrics & metrics = Metrics::instance();
+	uint32_t id = metrics.route_id("/quote\"back\\slash");
+	metrics.request_started(id);
+	metrics.request_finished(id, 200, std::chrono::microseconds(1), 0);
+
+	LineFormatter output;
+	metrics.write_prometheus(output);
+	REQUIRE( output.buffer().find("route=\"/quote\\\"back\\\\slash\"") != std::string::npos );
+}
+
+TEST_CASE("Metrics-Answered by the router", "[metrics]")
+{
+	Router router;
+	router.add_route([] (RequestContext &) {}, "/metrics-methods", RequestMethod::GET);
+
+	Metrics & metrics = Metrics::instance();
+	uint32_t id = metrics.route_id("/metrics-methods");
+	Metrics::RouteSnapshot before = metrics.snapshot(id);
+
+	Logger logger = MockLogger::create();
+	const char *envp[] = { nullptr, "DOCUMENT_URI=/metrics-methods", nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	auto route = [&] (char const* method)
+	{
+		envp[0] = method;
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		return router.handle_request(context);
+	};
+
+	// Automatic OPTIONS and rejected methods count towards the matched route
+	REQUIRE( route("REQUEST_METHOD=OPTIONS") == IRouter::RouteResult::Handled );
+	REQUIRE( route("REQUEST_METHOD=DELETE") == IRouter::RouteResult::InvalidMethod );
+
+	Metrics::RouteSnapshot after = metrics.snapshot(id);
+	REQUIRE( after.requests == before.requests + 2 );
+	REQUIRE( after.status_classes[2] == before.status_classes[2] + 1 );
+	REQUIRE( after.status_classes[4] == before.status_classes[4] + 1 );
+	REQUIRE( after.in_flight == 0 );
+}
+
+TEST_CASE("Metrics-Histogram totals", "[metrics]")
+{
+	// A count read while a request finishes may lag behind the buckets
+	Metrics::Histogram histogram {};
+	histogram.buckets[Metrics::bucket_index(5)] = 2;
+	histogram.buckets[Metrics::bucket_count - 1] = 1;
+	histogram.count = 2;
+
+	LineFormatter output;
+	Metrics::write_histogram(output, "test_seconds"sv, "route"sv, "/x"sv, histogram);
+	std::string const& text = output.buffer();
+	REQUIRE( text.find("test_seconds_bucket{route=\"/x\",le=\"+Inf\"} 3\n") != std::string::npos );
+	REQUIRE( text.find("test_seconds_count{route=\"/x\"} 3\n") != std::string::npos );
+}
+
+TEST_CASE("Metrics-Server stats", "[metrics]")
+{
+	{
+		Server server;
+		Server::Stats stats = server.stats();
+		REQUIRE( stats.threads.empty() );
+		REQUIRE( stats.phase(Server::Phase::Handler).count == 0 );
+		REQUIRE( stats.utilization() == 0.0 );
+
+		LineFormatter output;
+		Metrics::instance().write_prometheus(output);
+		REQUIRE( output.buffer().find("# TYPE fcgiserver_phase_duration_seconds histogram\n") != std::string::npos );
+		REQUIRE( output.buffer().find("fcgiserver_phase_duration_seconds_count{phase=\"handler\"} 0\n") != std::string::npos );
+	}
+
+	LineFormatter output;
+	Metrics::instance().write_prometheus(output);
+	REQUIRE( output.buffer().find("fcgiserver_phase_duration_seconds") == std::string::npos );
+}
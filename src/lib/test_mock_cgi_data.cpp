@@ -2,6 +2,7 @@
 
 MockCgiData::MockCgiData(std::string inbuf, const char **envp)
     : m_envp(envp)
+    , m_write_count(0)
 {
 	m_readbuf.swap(inbuf);
 }
@@ -35,6 +36,7 @@ int MockCgiData::read(uint8_t * buffer, size_t bufsize)
 int MockCgiData::write(const uint8_t * buffer, size_t bufsize)
 {
 	m_writebuf.append(reinterpret_cast<const char *>(buffer), bufsize);
+	++m_write_count;
 	return bufsize;
 }
 
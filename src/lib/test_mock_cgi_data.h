@@ -21,6 +21,7 @@ public:
 	std::string m_writebuf;
 	std::string m_errorbuf;
 	const char **m_envp;
+	size_t m_write_count;
 };
 
 
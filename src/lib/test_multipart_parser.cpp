@@ -0,0 +1,238 @@
+#include "multipart_form.h"
+#include "multipart_parser.h"
+#include "request.h"
+#include "test_mock_cgi_data.h"
+#include "test_mock_logger.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+namespace
+{
+
+struct RecordingHandler : public IMultipartHandler
+{
+	struct Part
+	{
+		std::string name;
+		std::string filename;
+		std::string content_type;
+		std::string data;
+		bool ended = false;
+	};
+
+	bool part_begin(MultipartPart const& part) override
+	{
+		parts.push_back(Part{std::string(part.name), std::string(part.filename), std::string(part.content_type), std::string()});
+		return true;
+	}
+
+	bool part_data(std::string_view const& data) override
+	{
+		parts.back().data.append(data);
+		++data_calls;
+		return true;
+	}
+
+	bool part_end() override
+	{
+		parts.back().ended = true;
+		return true;
+	}
+
+	std::vector<Part> parts;
+	size_t data_calls = 0;
+};
+
+const std::string_view g_boundary = "----Boundary7MA4YWxkTrZu0gW"sv;
+const std::string_view g_body =
+        "This is the preamble\r\n"
+        "------Boundary7MA4YWxkTrZu0gW\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n"
+        "\r\n"
+        "A title with\r\nnewlines and ------Boundary7MA4 near misses\r\n"
+        "------Boundary7MA4YWxkTrZu0gW  \r\n"
+        "Content-Disposition: form-data; name=\"upload\"; filename=\"data; file.bin\"\r\n"
+        "content-type: application/octet-stream\r\n"
+        "\r\n"
+        "\r\n\r\n--\r\n-\0binary\r\n"
+        "------Boundary7MA4YWxkTrZu0gW\r\n"
+        "\r\n"
+        "no headers\r\n"
+        "------Boundary7MA4YWxkTrZu0gW--\r\n"
+        "This is the epilogue"sv;
+
+void check_parts(RecordingHandler const& handler)
+{
+	REQUIRE( handler.parts.size() == 3 );
+
+	REQUIRE( handler.parts[0].name == "title" );
+	REQUIRE( handler.parts[0].filename.empty() );
+	REQUIRE( handler.parts[0].data == "A title with\r\nnewlines and ------Boundary7MA4 near misses" );
+	REQUIRE( handler.parts[0].ended );
+
+	REQUIRE( handler.parts[1].name == "upload" );
+	REQUIRE( handler.parts[1].filename == "data; file.bin" );
+	REQUIRE( handler.parts[1].content_type == "application/octet-stream" );
+	REQUIRE( handler.parts[1].data == "\r\n\r\n--\r\n-\0binary"sv );
+	REQUIRE( handler.parts[1].ended );
+
+	REQUIRE( handler.parts[2].name.empty() );
+	REQUIRE( handler.parts[2].data == "no headers" );
+	REQUIRE( handler.parts[2].ended );
+}
+
+}
+
+TEST_CASE("MultipartParser", "[multipart]")
+{
+	RecordingHandler handler;
+
+	SECTION("Boundary from content type")
+	{
+		REQUIRE( MultipartParser::boundary_from_content_type("multipart/form-data; boundary=abc") == "abc"sv );
+		REQUIRE( MultipartParser::boundary_from_content_type("multipart/form-data; charset=utf-8; BOUNDARY=\"a;b c\"") == "a;b c"sv );
+		REQUIRE( MultipartParser::boundary_from_content_type("multipart/form-data").empty() );
+	}
+
+	SECTION("Single chunk")
+	{
+		MultipartParser parser(handler, g_boundary);
+		REQUIRE( parser.feed(g_body) );
+		REQUIRE( parser.finish() );
+		check_parts(handler);
+	}
+
+	SECTION("Every possible split into two chunks")
+	{
+		for (size_t split = 0; split <= g_body.size(); ++split)
+		{
+			RecordingHandler split_handler;
+			MultipartParser parser(split_handler, g_boundary);
+			REQUIRE( parser.feed(g_body.substr(0, split)) );
+			REQUIRE( parser.feed(g_body.substr(split)) );
+			REQUIRE( parser.finish() );
+			check_parts(split_handler);
+		}
+	}
+
+	SECTION("Byte by byte")
+	{
+		MultipartParser parser(handler, g_boundary);
+		for (char c : g_body)
+			REQUIRE( parser.feed(std::string_view(&c, 1)) );
+		REQUIRE( parser.finish() );
+		check_parts(handler);
+	}
+
+	SECTION("Large parts are streamed without buffering")
+	{
+		std::string payload(100000, 'x');
+		std::string body;
+		body.append("--abc\r\nContent-Disposition: form-data; name=\"big\"; filename=\"big.txt\"\r\n\r\n");
+		body.append(payload);
+		body.append("\r\n--abc--");
+
+		MultipartParser parser(handler, "abc");
+		std::string_view remaining = body;
+		while (!remaining.empty())
+		{
+			REQUIRE( parser.feed(remaining.substr(0, 4096)) );
+			remaining.remove_prefix(std::min<size_t>(4096, remaining.size()));
+		}
+		REQUIRE( parser.finish() );
+		REQUIRE( handler.parts.size() == 1 );
+		REQUIRE( handler.parts[0].data == payload );
+		REQUIRE( handler.data_calls < 60 );
+	}
+
+	SECTION("Truncated body")
+	{
+		MultipartParser parser(handler, g_boundary);
+		REQUIRE( parser.feed(g_body.substr(0, 150)) );
+		REQUIRE( !parser.finish() );
+		REQUIRE( parser.state() == MultipartParser::State::Error );
+	}
+
+	SECTION("Oversized headers")
+	{
+		std::string body = "--abc\r\nX-Header: " + std::string(MultipartParser::max_header_size, 'h');
+		MultipartParser parser(handler, "abc");
+		REQUIRE( !parser.feed(body) );
+		REQUIRE( handler.parts.empty() );
+	}
+
+	SECTION("Invalid boundary")
+	{
+		MultipartParser parser(handler, "");
+		REQUIRE( !parser.feed(g_body) );
+	}
+}
+
+TEST_CASE("MultipartForm", "[multipart]")
+{
+	std::string content_type = "CONTENT_TYPE=multipart/form-data; boundary=" + std::string(g_boundary);
+	const char *envp[] = {
+	    "REQUEST_METHOD=POST",
+	    content_type.c_str(),
+	    nullptr
+	};
+
+	MockCgiData cgidata(std::string(g_body), envp);
+	Logger logger = MockLogger::create();
+	Request request(cgidata, logger);
+
+	SECTION("Fields and files")
+	{
+		std::string spooled_path;
+		{
+			MultipartForm form;
+			MultipartParser parser(form, MultipartParser::boundary_from_content_type(request.request_content_type()));
+			REQUIRE( parser.parse(request) );
+
+			REQUIRE( form.fields().size() == 2 );
+			REQUIRE( form.field("title").first );
+			REQUIRE( form.field("title").second == "A title with\r\nnewlines and ------Boundary7MA4 near misses"sv );
+			REQUIRE( !form.field("upload").first );
+
+			REQUIRE( form.files().size() == 1 );
+			auto const& file = form.files().front();
+			REQUIRE( file.name == "upload" );
+			REQUIRE( file.filename == "data; file.bin" );
+			REQUIRE( file.size == 16 );
+
+			std::ifstream input(file.path, std::ios::binary);
+			std::stringstream contents;
+			contents << input.rdbuf();
+			REQUIRE( contents.str() == "\r\n\r\n--\r\n-\0binary"sv );
+
+			spooled_path = file.path;
+		}
+
+		// Untaken files are cleaned up
+		REQUIRE( std::fopen(spooled_path.c_str(), "r") == nullptr );
+	}
+
+	SECTION("Too many parts")
+	{
+		MultipartForm form("/tmp", 65536, 2);
+		MultipartParser parser(form, MultipartParser::boundary_from_content_type(request.request_content_type()));
+		REQUIRE( !parser.parse(request) );
+		REQUIRE( form.fields().size() + form.files().size() == 2 );
+	}
+
+	SECTION("Too many file bytes")
+	{
+		MultipartForm form("/tmp", 65536, 256, 15);
+		MultipartParser parser(form, MultipartParser::boundary_from_content_type(request.request_content_type()));
+		REQUIRE( !parser.parse(request) );
+		REQUIRE( form.files().size() == 1 );
+		REQUIRE( form.files().front().size < 16 );
+	}
+}
@@ -1,7 +1,9 @@
+#include "http_status.h"
 #include "request.h"
 #include "test_mock_cgi_data.h"
 #include "test_mock_logger.h"
 #include "symbols.h"
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
 
 using namespace fcgiserver;
@@ -652,4 +654,428 @@ TEST_CASE("Request-Route", "[request]")
 		REQUIRE( route[1] == "dead"sv );
 		REQUIRE( route[2] == "beef"sv );
 	}
+
+	SECTION("Relative route is a view on the full route")
+	{
+		envp[0] = "DOCUMENT_URI=/foobar/dead/beef/";
+		REQUIRE( request.relative_route().size() == 3 );
+		REQUIRE( request.relative_route().begin() == request.full_route().data() );
+
+		request.set_relative_route_offset(2);
+		auto route = request.relative_route();
+		REQUIRE( route.size() == 1 );
+		REQUIRE( route[0] == "beef"sv );
+		REQUIRE( route.begin() == request.full_route().data() + 2 );
+
+		request.set_relative_route_offset(5);
+		REQUIRE( request.relative_route().empty() );
+	}
+}
+
+TEST_CASE("Request-Reset", "[request]")
+{
+	const char *envp1[] = {
+	    "REQUEST_METHOD=GET",
+	    "DOCUMENT_URI=/first/request",
+	    "QUERY_STRING=foo=bar&test=1",
+	    nullptr
+	};
+	const char *envp2[] = {
+	    "REQUEST_METHOD=POST",
+	    "DOCUMENT_URI=/second",
+	    "QUERY_STRING=beef=dead",
+	    "HTTP_DNT=1",
+	    nullptr
+	};
+
+	MockCgiData cgidata(std::string(), envp1);
+	Logger logger = MockLogger::create();
+	MockLogger * mock_logger = static_cast<MockLogger*>(logger.log_callback());
+	Request request(cgidata, logger);
+
+	REQUIRE( request.request_method() == RequestMethod::GET );
+	REQUIRE( request.full_route().size() == 2 );
+	REQUIRE( request.query().size() == 2 );
+	request.set_http_status(404);
+	request.set_content_type("text/html");
+	request.write("first");
+
+	auto const* query_data = request.query().data();
+	auto const* route_data = request.full_route().data();
+
+	// Attempt to modify headers once to trigger the warning
+	request.set_http_status(500);
+	REQUIRE( mock_logger->log_error.size() == 1 );
+
+	cgidata.m_envp = envp2;
+	cgidata.m_writebuf.clear();
+	request.reset();
+
+	SECTION("Request state is cleared")
+	{
+		REQUIRE( !request.headers_sent() );
+		REQUIRE( request.http_status().empty() );
+		REQUIRE( request.content_type().empty() );
+		REQUIRE( request.encoding() == ContentEncoding::Verbatim );
+	}
+
+	SECTION("Environment is reloaded")
+	{
+		REQUIRE( request.env_map().size() == 4 );
+		REQUIRE( request.request_method() == RequestMethod::POST );
+		REQUIRE( request.document_uri() == "/second"sv );
+		REQUIRE( request.do_not_track() );
+	}
+
+	SECTION("Storage is reused")
+	{
+		REQUIRE( request.query().size() == 1 );
+		REQUIRE( request.query().data() == query_data );
+		REQUIRE( request.query("beef").second == "dead"sv );
+
+		REQUIRE( request.full_route().size() == 1 );
+		REQUIRE( request.full_route().data() == route_data );
+		REQUIRE( request.relative_route().size() == 1 );
+	}
+
+	SECTION("Headers can be sent again")
+	{
+		request.set_http_status(200);
+		request.write("second");
+		REQUIRE( request.headers_sent() );
+		REQUIRE( cgidata.m_writebuf.find("Status: 200") != std::string::npos );
+		REQUIRE( cgidata.m_writebuf.find("second") != std::string::npos );
+
+		request.set_http_status(500);
+		REQUIRE( mock_logger->log_error.size() == 2 );
+	}
+}
+
+TEST_CASE("Request-Headers", "[request]")
+{
+	const char *envp[] = {
+	    nullptr
+	};
+
+	MockCgiData cgidata(std::string(), envp);
+	Logger logger = MockLogger::create();
+	Request request(cgidata, logger);
+
+	SECTION("Setting a header twice replaces it")
+	{
+		request.set_content_type("text/plain");
+		request.set_content_type("text/html");
+		REQUIRE( request.content_type() == "text/html"sv );
+		REQUIRE( request.headers().size() == 1 );
+	}
+
+	SECTION("Multi valued headers")
+	{
+		REQUIRE( request.add_header(symbols::SetCookie, "a=1") );
+		REQUIRE( request.add_header(symbols::SetCookie, "b=2") );
+		request.send_headers();
+
+		REQUIRE( cgidata.m_writebuf.find("Set-Cookie: a=1\r\n") != std::string::npos );
+		REQUIRE( cgidata.m_writebuf.find("Set-Cookie: b=2\r\n") != std::string::npos );
+		REQUIRE( !request.add_header(symbols::SetCookie, "c=3") );
+	}
+
+	SECTION("Headers are sent in a single write")
+	{
+		request.set_http_status(404);
+		request.set_content_type("text/html");
+		request.set_header(symbols::ContentLength, 12);
+		request.send_headers();
+
+		REQUIRE( cgidata.m_write_count == 1 );
+		REQUIRE( cgidata.m_writebuf == "Status: 404 Not Found\r\nContent-Type: text/html\r\nContent-Length: 12\r\n\r\n" );
+	}
+
+	SECTION("Status codes")
+	{
+		REQUIRE( request.http_status_code() == 0 );
+		REQUIRE( request.http_status().empty() );
+
+		request.set_http_status(404);
+		REQUIRE( request.http_status_code() == 404 );
+		REQUIRE( request.http_status() == "404 Not Found"sv );
+
+		request.set_http_status(799);
+		REQUIRE( request.http_status_code() == 799 );
+		REQUIRE( request.http_status() == "799"sv );
+
+		request.set_header(symbols::Status, "302 Found");
+		REQUIRE( request.http_status_code() == 302 );
+
+		request.set_header(symbols::Status, HeaderValue("201 Created"sv));
+		REQUIRE( request.http_status_code() == 201 );
+	}
+
+	SECTION("Default status")
+	{
+		request.send_headers();
+		REQUIRE( request.http_status_code() == 200 );
+		REQUIRE( cgidata.m_writebuf == "Status: 200 OK\r\n\r\n" );
+	}
+
+	SECTION("Static header values")
+	{
+		auto is_static = [&request] (Symbol key)
+		{
+			for (HeaderList::Entry const& entry : request.headers())
+				if (entry.key == key)
+					return entry.is_static();
+			return false;
+		};
+
+		REQUIRE( request.set_content_type(header_values::TextHtml) );
+		REQUIRE( request.encoding() == ContentEncoding::HTML );
+		REQUIRE( request.content_type() == header_values::TextHtml.value );
+		REQUIRE( is_static(symbols::ContentType) );
+
+		REQUIRE( request.set_content_type(std::string("text/html")) );
+		REQUIRE( !is_static(symbols::ContentType) );
+
+		REQUIRE( request.set_content_type(header_values::ApplicationJson) );
+		REQUIRE( request.encoding() == ContentEncoding::Verbatim );
+
+		REQUIRE( request.set_header(symbols::CacheControl, header_values::NoCache) );
+		REQUIRE( request.header(symbols::CacheControl) == "no-cache"sv );
+	}
+}
+
+TEST_CASE("Request-Form", "[request]")
+{
+	const char *envp[] = {
+	    "REQUEST_METHOD=POST",
+	    "CONTENT_TYPE=application/x-www-form-urlencoded",
+	    "CONTENT_LENGTH=37",
+	    nullptr
+	};
+
+	SECTION("Urlencoded body")
+	{
+		MockCgiData cgidata("name=Foo+Bar&age=42&city=New%20York", envp);
+		Logger logger = MockLogger::create();
+		Request request(cgidata, logger);
+
+		auto const& form = request.form();
+		REQUIRE( form.size() == 3 );
+		REQUIRE( form[0].first == "name"sv );
+		REQUIRE( form[0].second == "Foo+Bar"sv );
+		REQUIRE( form[2].second == "New%20York"sv );
+		REQUIRE( Request::query_decode(form[2].second) == "New York" );
+
+		// Parsed only once
+		REQUIRE( &request.form() == &form );
+		REQUIRE( request.form().size() == 3 );
+	}
+
+	SECTION("Other content types are ignored")
+	{
+		envp[1] = "CONTENT_TYPE=text/plain";
+		MockCgiData cgidata("name=Foo", envp);
+		Logger logger = MockLogger::create();
+		Request request(cgidata, logger);
+
+		REQUIRE( request.form().empty() );
+		REQUIRE( cgidata.m_readbuf == "name=Foo" );
+	}
+
+	SECTION("Oversized body")
+	{
+		MockCgiData cgidata("big=" + std::string(Request::max_form_size, 'x'), envp);
+		Logger logger = MockLogger::create();
+		MockLogger * mock_logger = static_cast<MockLogger*>(logger.log_callback());
+		Request request(cgidata, logger);
+
+		REQUIRE( request.form().empty() );
+		REQUIRE( mock_logger->log_error.size() == 1 );
+	}
+}
+
+TEST_CASE("Request-QueryIndex", "[request]")
+{
+	const char *envp[] = {
+	    "QUERY_STRING=id=42&name=J%C3%B6rg%20B&tag=a&verbose&tag=b%2Cc&n%5B%5D=1,2,,3&neg=-7&bad=12x&flag=off&raw=plain",
+	    nullptr
+	};
+
+	MockCgiData cgidata(std::string(), envp);
+	Logger logger = MockLogger::create();
+	Request request(cgidata, logger);
+
+	SECTION("Decoded values")
+	{
+		REQUIRE( request.query_value("name").first );
+		REQUIRE( request.query_value("name").second == "J\xc3\xb6rg B"sv );
+		REQUIRE( request.query_value("n[]").second == "1,2,,3"sv );
+		REQUIRE( !request.query_value("n%5B%5D").first );
+		REQUIRE( !request.query_value("missing").first );
+	}
+
+	SECTION("Values are decoded only once")
+	{
+		std::string_view first = request.query_value("name").second;
+		std::string_view second = request.query_value("name").second;
+		REQUIRE( first.data() == second.data() );
+
+		// Values without escapes refer to the query string itself
+		REQUIRE( request.query_value("raw").second.data() == request.query("raw").second.data() );
+	}
+
+	SECTION("Multiple values")
+	{
+		std::vector<std::string_view> values;
+		REQUIRE( request.query_values("tag", values) == 2 );
+		REQUIRE( values == std::vector<std::string_view>{ "a"sv, "b,c"sv } );
+
+		values.clear();
+		REQUIRE( request.query_list("tag", values) == 3 );
+		REQUIRE( values == std::vector<std::string_view>{ "a"sv, "b"sv, "c"sv } );
+
+		values.clear();
+		REQUIRE( request.query_list("n[]", values) == 3 );
+		REQUIRE( values == std::vector<std::string_view>{ "1"sv, "2"sv, "3"sv } );
+	}
+
+	SECTION("Typed accessors")
+	{
+		REQUIRE( request.query_int("id") == std::make_pair(true, int64_t(42)) );
+		REQUIRE( request.query_int("neg") == std::make_pair(true, int64_t(-7)) );
+		REQUIRE( !request.query_int("bad").first );
+		REQUIRE( !request.query_int("missing").first );
+
+		REQUIRE( request.query_bool("verbose") == std::make_pair(true, true) );
+		REQUIRE( request.query_bool("flag") == std::make_pair(true, false) );
+		REQUIRE( request.query_bool("id") == std::make_pair(false, false) );
+	}
+
+	SECTION("Index is rebuilt after reset")
+	{
+		REQUIRE( request.query_int("id").second == 42 );
+
+		envp[0] = "QUERY_STRING=id=43";
+		request.reset();
+		REQUIRE( request.query_int("id").second == 43 );
+		REQUIRE( !request.query_value("name").first );
+	}
+}
+
+TEST_CASE("Request-Stream", "[request]")
+{
+	MockCgiData cgidata(std::string(), g_envp);
+	Logger logger = MockLogger::create();
+	Request request(cgidata, logger);
+
+	std::string expected;
+	for (int i = 0; i < 500; ++i)
+		expected += "<li>" + std::to_string(i) + "</li>";
+
+	SECTION("Fragments are batched")
+	{
+		{
+			auto stream = request.write_stream();
+			for (int i = 0; i < 500; ++i)
+				stream << "<li>" << i << "</li>";
+
+			// Nothing is passed on yet, not even the headers
+			REQUIRE( cgidata.m_write_count == 0 );
+		}
+
+		REQUIRE( cgidata.m_write_count == 2 );
+		REQUIRE( cgidata.m_writebuf.substr(cgidata.m_writebuf.find("\r\n\r\n") + 4) == expected );
+	}
+
+	SECTION("Explicit flush")
+	{
+		auto stream = request.write_stream();
+		stream << "hello";
+		REQUIRE( stream.flush() == 5 );
+		REQUIRE( cgidata.m_writebuf.substr(cgidata.m_writebuf.find("\r\n\r\n") + 4) == "hello" );
+		REQUIRE( stream.flush() == 0 );
+	}
+
+	SECTION("Flush on threshold")
+	{
+		request.set_stream_buffer_size(64);
+		{
+			auto stream = request.write_stream();
+			for (int i = 0; i < 500; ++i)
+				stream << "<li>" << i << "</li>";
+		}
+
+		REQUIRE( cgidata.m_write_count > 10 );
+		REQUIRE( cgidata.m_writebuf.substr(cgidata.m_writebuf.find("\r\n\r\n") + 4) == expected );
+
+		request.reset();
+		REQUIRE( request.stream_buffer_size() == Request::default_stream_buffer_size );
+	}
+
+	SECTION("Large fragments bypass the buffer")
+	{
+		request.set_stream_buffer_size(16);
+		std::string large(100, 'x');
+
+		auto stream = request.write_stream();
+		stream << "abc";
+		stream << large;
+		REQUIRE( cgidata.m_writebuf.substr(cgidata.m_writebuf.find("\r\n\r\n") + 4) == "abc" + large );
+	}
+
+	SECTION("Unbuffered")
+	{
+		request.set_stream_buffer_size(0);
+		auto stream = request.write_stream();
+		for (int i = 0; i < 500; ++i)
+			stream << "<li>" << i << "</li>";
+
+		REQUIRE( cgidata.m_write_count == 1501 );
+		REQUIRE( cgidata.m_writebuf.substr(cgidata.m_writebuf.find("\r\n\r\n") + 4) == expected );
+	}
+
+	SECTION("Direct output keeps its order with live streams")
+	{
+		auto stream = request.write_stream();
+		auto errors = request.error_stream();
+		stream << "first ";
+		errors << "logged ";
+		request.write("second ");
+		stream << "third";
+		request.flush_write();
+		REQUIRE( cgidata.m_writebuf.substr(cgidata.m_writebuf.find("\r\n\r\n") + 4) == "first second third" );
+
+		// Streams of the other channel are left alone
+		REQUIRE( cgidata.m_errorbuf.empty() );
+		request.error("reported");
+		REQUIRE( cgidata.m_errorbuf == "logged reported" );
+		REQUIRE( stream.flush() == 0 );
+	}
+}
+
+TEST_CASE("Request-Stream-Benchmark", "[request][!benchmark]")
+{
+	MockCgiData cgidata(std::string(), g_envp);
+	Logger logger = MockLogger::create();
+	Request request(cgidata, logger);
+
+	auto render = [&] (size_t buffer_size)
+	{
+		cgidata.m_writebuf.clear();
+		request.set_stream_buffer_size(buffer_size);
+
+		auto stream = request.write_stream();
+		for (int i = 0; i < 500; ++i)
+			stream << "<li>" << i << "</li>";
+	};
+
+	BENCHMARK("Unbuffered")
+	{
+		return render(0);
+	};
+
+	BENCHMARK("Buffered")
+	{
+		return render(Request::default_stream_buffer_size);
+	};
 }
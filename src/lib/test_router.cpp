@@ -1,14 +1,18 @@
 #include "router.h"
 #include "request.h"
 #include "request_context.h"
+#include "symbols.h"
 #include "test_mock_cgi_data.h"
 #include "test_mock_logger.h"
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
 
 namespace
 {
@@ -22,7 +26,8 @@ struct DummyRoutes
 	{
 		return [this,index](RequestContext & context)
 		{
-			calls.push_back({index, context.request().relative_route()});
+			Request::RouteView route = context.request().relative_route();
+			calls.push_back({index, Request::Route(route.begin(), route.end())});
 		};
 	}
 
@@ -287,7 +292,79 @@ TEST_CASE("Router-Single router", "[router]")
 
 	SECTION("Wildcards")
 	{
-		// TODO
+		router.add_route(dummy_routes[7], "/users/*");
+		router.add_route(dummy_routes[8], "/users/*/posts");
+		router.add_route(dummy_routes[9], "/users/me");
+
+		{
+			envp[0] = "DOCUMENT_URI=/users/WakeOfLuna";
+			envp[1] = nullptr;
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			IRouter::RouteResult result = router.handle_request(context);
+			REQUIRE( result == IRouter::RouteResult::Handled );
+			REQUIRE( dummy_routes.calls == check(7, {"users","WakeOfLuna"}) );
+		}
+
+		dummy_routes.clear();
+
+		{
+			envp[0] = "DOCUMENT_URI=/users/WakeOfLuna/posts";
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			IRouter::RouteResult result = router.handle_request(context);
+			REQUIRE( result == IRouter::RouteResult::Handled );
+			REQUIRE( dummy_routes.calls == check(8, {"users","WakeOfLuna","posts"}) );
+		}
+
+		dummy_routes.clear();
+
+		{
+			envp[0] = "DOCUMENT_URI=/users/me";
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			IRouter::RouteResult result = router.handle_request(context);
+			REQUIRE( result == IRouter::RouteResult::Handled );
+			REQUIRE( dummy_routes.calls == check(9, {"users","me"}) );
+		}
+
+		dummy_routes.clear();
+
+		{
+			// Exact matches win and are not backtracked
+			envp[0] = "DOCUMENT_URI=/users/me/posts";
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			IRouter::RouteResult result = router.handle_request(context);
+			REQUIRE( result == IRouter::RouteResult::NotFound );
+			REQUIRE( dummy_routes.calls.empty() );
+		}
+	}
+
+	SECTION("Removing routes")
+	{
+		REQUIRE( router.remove_route("/foo") );
+		REQUIRE( !router.remove_route("/foo") );
+		REQUIRE( !router.remove_route("/does/not/exist") );
+
+		{
+			envp[0] = "DOCUMENT_URI=/foo";
+			envp[1] = nullptr;
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			IRouter::RouteResult result = router.handle_request(context);
+			REQUIRE( result == IRouter::RouteResult::NotFound );
+			REQUIRE( dummy_routes.calls.empty() );
+		}
+
+		{
+			envp[0] = "DOCUMENT_URI=/bar";
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			IRouter::RouteResult result = router.handle_request(context);
+			REQUIRE( result == IRouter::RouteResult::Handled );
+			REQUIRE( dummy_routes.calls == check(3, {"bar"}) );
+		}
 	}
 
 	SECTION("Catchalls")
@@ -518,3 +595,400 @@ TEST_CASE("Router-Multiple routers", "[router]")
 		// TODO
 	}
 }
+
+TEST_CASE("Router-Live updates", "[router]")
+{
+	Logger logger = MockLogger::create();
+
+	SECTION("Handlers can change routes")
+	{
+		Router router;
+		int calls = 0;
+
+		router.add_route([&] (RequestContext &)
+		{
+			++calls;
+			router.add_route([&] (RequestContext &) { calls += 10; }, "/next");
+			REQUIRE( router.remove_route("/first") );
+		}, "/first");
+
+		const char *envp[] = { "DOCUMENT_URI=/first", nullptr };
+		MockCgiData cgidata(std::string(), envp);
+
+		{
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			REQUIRE( router.handle_request(context) == IRouter::RouteResult::Handled );
+			REQUIRE( calls == 1 );
+		}
+
+		{
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			REQUIRE( router.handle_request(context) == IRouter::RouteResult::NotFound );
+		}
+
+		envp[0] = "DOCUMENT_URI=/next";
+		{
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			REQUIRE( router.handle_request(context) == IRouter::RouteResult::Handled );
+			REQUIRE( calls == 11 );
+		}
+	}
+
+	SECTION("Concurrent requests and updates")
+	{
+		Router router;
+		std::atomic<int> stable_calls(0);
+		router.add_route([&] (RequestContext &) { ++stable_calls; }, "/stable");
+
+		std::atomic<bool> done(false);
+		std::atomic<int> failures(0);
+
+		auto reader = [&] ()
+		{
+			const char *envp[] = { "DOCUMENT_URI=/stable", nullptr };
+			MockCgiData cgidata(std::string(), envp);
+			Request request(cgidata, logger);
+
+			for (int i = 0; i < 2000; ++i)
+			{
+				request.reset();
+				RequestContext context(request);
+				if (router.handle_request(context) != IRouter::RouteResult::Handled)
+					++failures;
+			}
+		};
+
+		std::thread writer([&] ()
+		{
+			for (int i = 0; !done; ++i)
+			{
+				std::string route = "/volatile/" + std::to_string(i % 50);
+				router.add_route([] (RequestContext &) {}, route);
+				router.remove_route(route);
+			}
+		});
+
+		std::vector<std::thread> readers;
+		for (int i = 0; i < 4; ++i)
+			readers.emplace_back(reader);
+		for (auto & thread : readers)
+			thread.join();
+
+		done = true;
+		writer.join();
+
+		REQUIRE( failures == 0 );
+		REQUIRE( stable_calls == 8000 );
+	}
+}
+
+TEST_CASE("Router-Path parameters", "[router]")
+{
+	Logger logger = MockLogger::create();
+
+	std::vector<std::string> calls;
+	auto record = [&calls] (std::string name)
+	{
+		return [&calls,name] (RequestContext & context)
+		{
+			std::string call = name;
+			for (auto key : { "id"sv, "slug"sv, "name"sv, "page"sv })
+			{
+				std::string_view value = context.path_param(key);
+				if (!value.empty())
+				{
+					call += ' ';
+					call += key;
+					call += '=';
+					call += value;
+				}
+			}
+			calls.push_back(call);
+		};
+	};
+
+	auto users = std::make_shared<Router>();
+	users->add_route(record("posts"), "/{id:int}/posts/{slug}");
+	users->add_route(record("by-name"), "/{name}");
+	users->add_route(record("me"), "/me");
+	users->add_route(record("page"), "/list/{page:uint}");
+
+	Router root;
+	root.add_route(users, "/users");
+	root.add_route(record("fallback"), "/users/*/posts/*/*");
+
+	const char *envp[] = { nullptr, nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	auto handle = [&] (char const* uri)
+	{
+		envp[0] = uri;
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		IRouter::RouteResult result = root.handle_request(context);
+		if (result == IRouter::RouteResult::Handled && calls.back().substr(0, 5) == "posts")
+		{
+			REQUIRE( context.path_param_count() == 2 );
+			REQUIRE( context.path_param_int("id").first );
+			REQUIRE( !context.path_param_int("slug").first );
+		}
+		return result;
+	};
+
+	SECTION("Typed and untyped captures")
+	{
+		REQUIRE( handle("DOCUMENT_URI=/users/42/posts/hello-world") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "posts id=42 slug=hello-world" );
+
+		REQUIRE( handle("DOCUMENT_URI=/users/-7/posts/x") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "posts id=-7 slug=x" );
+
+		REQUIRE( handle("DOCUMENT_URI=/users/WakeOfLuna") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "by-name name=WakeOfLuna" );
+
+		REQUIRE( handle("DOCUMENT_URI=/users/me") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "me" );
+
+		REQUIRE( handle("DOCUMENT_URI=/users/list/3") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "page page=3" );
+	}
+
+	SECTION("Type mismatches")
+	{
+		// "abc" is not an int, so it is captured as a name which has no posts
+		REQUIRE( handle("DOCUMENT_URI=/users/abc/posts/x") == IRouter::RouteResult::NotFound );
+		REQUIRE( calls.empty() );
+
+		REQUIRE( handle("DOCUMENT_URI=/users/list/-3") == IRouter::RouteResult::NotFound );
+		REQUIRE( handle("DOCUMENT_URI=/users/list/3x") == IRouter::RouteResult::NotFound );
+		REQUIRE( calls.empty() );
+	}
+
+	SECTION("Captures of abandoned routes are dropped")
+	{
+		REQUIRE( handle("DOCUMENT_URI=/users/42/posts/x/y") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "fallback" );
+	}
+
+	SECTION("Recursive catch-alls only see the captures up to their own route")
+	{
+		root.add_route(record("api"), "/api", RequestMethod::CatchAllRecursive);
+		root.add_route(record("api-x"), "/api/{id:int}/x");
+		root.add_route(record("page-all"), "/pages/{page:uint}", RequestMethod::CatchAllRecursive);
+		root.add_route(record("page-edit"), "/pages/{page:uint}/{slug}/edit");
+
+		REQUIRE( handle("DOCUMENT_URI=/api/5/x") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "api-x id=5" );
+		REQUIRE( handle("DOCUMENT_URI=/api/5/y") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "api" );
+
+		REQUIRE( handle("DOCUMENT_URI=/pages/3/intro/view") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "page-all page=3" );
+
+		// Regardless of whether there are pattern routes to try first
+		root.add_prefix_route(record("prefix"), "/elsewhere/");
+		REQUIRE( handle("DOCUMENT_URI=/pages/3/intro/view") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "page-all page=3" );
+		REQUIRE( handle("DOCUMENT_URI=/api/5/y") == IRouter::RouteResult::Handled );
+		REQUIRE( calls.back() == "api" );
+	}
+}
+
+TEST_CASE("Router-Method dispatch", "[router]")
+{
+	DummyRoutes dummy_routes;
+	Logger logger = MockLogger::create();
+
+	Router router;
+	router.add_route(dummy_routes[1], "/items", RequestMethod::GET);
+	router.add_route(dummy_routes[2], "/items", RequestMethod::POST);
+	router.add_route(dummy_routes[3], "/custom", RequestMethod::OPTIONS);
+	router.add_route(dummy_routes[4], "/custom", RequestMethod::HEAD);
+	router.add_route(dummy_routes[5], "/custom", RequestMethod::GET);
+
+	const char *envp[] = { nullptr, nullptr, nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	SECTION("Invalid methods advertise the allowed ones")
+	{
+		envp[0] = "DOCUMENT_URI=/items";
+		envp[1] = "REQUEST_METHOD=DELETE";
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		REQUIRE( router.handle_request(context) == IRouter::RouteResult::InvalidMethod );
+		REQUIRE( request.header(symbols::Allow) == "GET, HEAD, POST, OPTIONS"sv );
+		REQUIRE( dummy_routes.calls.empty() );
+	}
+
+	SECTION("Automatic OPTIONS")
+	{
+		envp[0] = "DOCUMENT_URI=/items";
+		envp[1] = "REQUEST_METHOD=OPTIONS";
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		REQUIRE( router.handle_request(context) == IRouter::RouteResult::Handled );
+		REQUIRE( request.http_status_code() == 204 );
+		REQUIRE( request.header(symbols::Allow) == "GET, HEAD, POST, OPTIONS"sv );
+		REQUIRE( dummy_routes.calls.empty() );
+	}
+
+	SECTION("HEAD falls back to GET")
+	{
+		envp[0] = "DOCUMENT_URI=/items";
+		envp[1] = "REQUEST_METHOD=HEAD";
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		REQUIRE( router.handle_request(context) == IRouter::RouteResult::Handled );
+		REQUIRE( dummy_routes.calls == check(1, {"items"}) );
+	}
+
+	SECTION("Explicit handlers win")
+	{
+		for (auto method : { "REQUEST_METHOD=OPTIONS", "REQUEST_METHOD=HEAD" })
+		{
+			envp[0] = "DOCUMENT_URI=/custom";
+			envp[1] = method;
+			Request request(cgidata, logger);
+			RequestContext context(request);
+			REQUIRE( router.handle_request(context) == IRouter::RouteResult::Handled );
+		}
+		REQUIRE( dummy_routes.calls.size() == 2 );
+		REQUIRE( dummy_routes.calls[0].first == 3 );
+		REQUIRE( dummy_routes.calls[1].first == 4 );
+	}
+
+	SECTION("Allow of a nested router does not leak into other routes")
+	{
+		auto nested = std::make_shared<Router>();
+		nested->add_route(dummy_routes[6], "/items", RequestMethod::PUT);
+		router.add_route(nested, "/");
+
+		envp[0] = "DOCUMENT_URI=/items";
+		envp[1] = "REQUEST_METHOD=POST";
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		REQUIRE( router.handle_request(context) == IRouter::RouteResult::Handled );
+		REQUIRE( dummy_routes.calls == check(2, {"items"}) );
+		REQUIRE( request.header(symbols::Allow).empty() );
+
+		envp[0] = "DOCUMENT_URI=/items";
+		envp[1] = "REQUEST_METHOD=DELETE";
+		Request rejected(cgidata, logger);
+		RequestContext rejected_context(rejected);
+		REQUIRE( router.handle_request(rejected_context) == IRouter::RouteResult::InvalidMethod );
+		REQUIRE( rejected.header(symbols::Allow) == "GET, HEAD, POST, OPTIONS"sv );
+	}
+}
+
+TEST_CASE("Router-Pattern routes", "[router]")
+{
+	DummyRoutes dummy_routes;
+	Logger logger = MockLogger::create();
+
+	Router router;
+	router.add_route(dummy_routes[1], "/legacy/exact", RequestMethod::GET);
+	router.add_route(dummy_routes[11], "/{name}/detail");
+	router.add_prefix_route(dummy_routes[2], "/legacy/");
+	router.add_prefix_route(dummy_routes[3], "legacy/old/");
+	router.add_prefix_route(dummy_routes[4], "/static", RequestMethod::GET);
+	REQUIRE( router.add_regex_route(dummy_routes[5], "/item-([0-9]+)\\.html") );
+	REQUIRE( router.add_regex_route(dummy_routes[6], "/(cat|dog)s?/(.*)") );
+	REQUIRE( router.add_regex_route(dummy_routes[7], "/[a-z]+/.*") );
+
+	REQUIRE( !router.add_regex_route(dummy_routes[8], "/(unbalanced") );
+	REQUIRE( !router.add_regex_route(dummy_routes[8], "/(a)\\1") );
+
+	const char *envp[] = { nullptr, "REQUEST_METHOD=GET", nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	size_t param_count = 0;
+	auto route = [&] (char const* uri) -> int
+	{
+		envp[0] = uri;
+		dummy_routes.clear();
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		if (router.handle_request(context) != IRouter::RouteResult::Handled)
+			return -1;
+		REQUIRE( dummy_routes.calls.size() == 1 );
+		param_count = context.path_param_count();
+		return dummy_routes.calls.front().first;
+	};
+
+	SECTION("Component routes take precedence")
+	{
+		REQUIRE( route("DOCUMENT_URI=/legacy/exact") == 1 );
+	}
+
+	SECTION("Longest prefix wins")
+	{
+		REQUIRE( route("DOCUMENT_URI=/legacy/exact/more") == 2 );
+		REQUIRE( route("DOCUMENT_URI=/legacy/page.php") == 2 );
+		REQUIRE( route("DOCUMENT_URI=/legacy/old/page.php") == 3 );
+		REQUIRE( route("DOCUMENT_URI=/static") == 4 );
+		REQUIRE( route("DOCUMENT_URI=/staticfiles/x.css") == 4 );
+		REQUIRE( route("DOCUMENT_URI=/legacy") == -1 );
+	}
+
+	SECTION("First matching regex wins")
+	{
+		REQUIRE( route("DOCUMENT_URI=/item-42.html") == 5 );
+		REQUIRE( route("DOCUMENT_URI=/item-x.html") == -1 );
+		REQUIRE( route("DOCUMENT_URI=/dogs/rex") == 6 );
+		REQUIRE( param_count == 0 );
+		REQUIRE( route("DOCUMENT_URI=/dogs/detail") == 11 );
+		REQUIRE( param_count == 1 );
+		REQUIRE( route("DOCUMENT_URI=/cat/") == -1 );
+		REQUIRE( route("DOCUMENT_URI=/cat/tom") == 6 );
+		REQUIRE( route("DOCUMENT_URI=/birds/tweety") == 7 );
+		REQUIRE( route("DOCUMENT_URI=/") == -1 );
+	}
+
+	SECTION("Regexes skip overly long paths")
+	{
+		std::string uri = "DOCUMENT_URI=/birds/";
+		uri.resize(13 + Router::max_regex_path_length, 'x');
+		REQUIRE( route(uri.c_str()) == 7 );
+
+		uri.push_back('x');
+		REQUIRE( route(uri.c_str()) == -1 );
+
+		uri.resize(13 + 100000, 'x');
+		REQUIRE( route(uri.c_str()) == -1 );
+	}
+
+	SECTION("Methods are dispatched as usual")
+	{
+		envp[1] = "REQUEST_METHOD=POST";
+		REQUIRE( route("DOCUMENT_URI=/static/x.css") == -1 );
+		REQUIRE( route("DOCUMENT_URI=/legacy/page.php") == 2 );
+	}
+
+	SECTION("Removing pattern routes")
+	{
+		REQUIRE( router.remove_prefix_route("/legacy/old/") );
+		REQUIRE( !router.remove_prefix_route("/legacy/old/") );
+		REQUIRE( route("DOCUMENT_URI=/legacy/old/page.php") == 2 );
+
+		REQUIRE( router.remove_regex_route("/item-([0-9]+)\\.html") );
+		REQUIRE( !router.remove_regex_route("/item-([0-9]+)\\.html") );
+		REQUIRE( route("DOCUMENT_URI=/item-42.html") == -1 );
+		REQUIRE( route("DOCUMENT_URI=/dogs/rex") == 6 );
+	}
+
+	SECTION("Nested routers match their relative path")
+	{
+		auto inner = std::make_shared<Router>();
+		inner->add_prefix_route(dummy_routes[9], "/files/");
+		inner->add_route(dummy_routes[10], "/{id:int}");
+		router.add_route(inner, "/v1");
+
+		REQUIRE( route("DOCUMENT_URI=/v1/files/a/b") == 9 );
+		REQUIRE( dummy_routes.calls == check(9, {"files", "a", "b"}) );
+		REQUIRE( route("DOCUMENT_URI=/v1/files") == -1 );
+		REQUIRE( route("DOCUMENT_URI=/v1/12") == 10 );
+	}
+}
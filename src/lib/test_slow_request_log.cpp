@@ -0,0 +1,154 @@
+#include "line_formatter.h"
+#include "request.h"
+#include "request_context.h"
+#include "slow_request_log.h"
+#include "slow_request_router.h"
+#include "symbols.h"
+#include "test_mock_cgi_data.h"
+#include "test_mock_logger.h"
+#include <chrono>
+#include <memory>
+#include <string>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("SlowRequestLog-Threshold", "[slow_request_log]")
+{
+	SlowRequestLog log(4, std::chrono::milliseconds(100));
+	REQUIRE( log.capacity() == 4 );
+	REQUIRE( log.threshold() == std::chrono::milliseconds(100) );
+	REQUIRE( !log.is_slow(std::chrono::milliseconds(99)) );
+	REQUIRE( log.is_slow(std::chrono::milliseconds(100)) );
+
+	log.set_threshold(std::chrono::seconds(2));
+	REQUIRE( !log.is_slow(std::chrono::seconds(1)) );
+	REQUIRE( log.is_slow(std::chrono::seconds(3)) );
+}
+
+TEST_CASE("SlowRequestLog-Ring", "[slow_request_log]")
+{
+	SlowRequestLog log(3);
+	REQUIRE( log.records().empty() );
+
+	for (uint16_t status = 1; status <= 5; ++status)
+	{
+		SlowRequestLog::Record record {};
+		record.status = status;
+		log.add(std::move(record));
+	}
+
+	auto records = log.records();
+	REQUIRE( records.size() == 3 );
+	REQUIRE( records[0].status == 5 );
+	REQUIRE( records[1].status == 4 );
+	REQUIRE( records[2].status == 3 );
+
+	log.clear();
+	REQUIRE( log.records().empty() );
+
+	SlowRequestLog::Record record {};
+	record.status = 6;
+	log.add(std::move(record));
+	REQUIRE( log.records().size() == 1 );
+	REQUIRE( log.records()[0].status == 6 );
+}
+
+TEST_CASE("SlowRequestLog-Capture", "[slow_request_log]")
+{
+	Logger logger = MockLogger::create();
+	const char *envp[] = { "REQUEST_METHOD=POST", "DOCUMENT_URI=/upload", "QUERY_STRING=a=1&b=2", "REMOTE_ADDR=10.0.0.1", "HTTP_COOKIE=secret", nullptr };
+	MockCgiData cgidata(std::string(), envp);
+	Request request(cgidata, logger);
+	request.set_http_status(503);
+	request.add_header(symbols::SetCookie, "x=1");
+	request.add_header(symbols::SetCookie, "y=2");
+
+	SlowRequestLog log;
+	SlowRequestLog::Record record = log.capture(request);
+	REQUIRE( record.method == "POST" );
+	REQUIRE( record.uri == "/upload" );
+	REQUIRE( record.query == "a=1&b=2" );
+	REQUIRE( record.status == 503 );
+
+	// Only the filtered environment is kept
+	REQUIRE( record.env.size() == 1 );
+	REQUIRE( record.env[0].first == "REMOTE_ADDR" );
+	REQUIRE( record.env[0].second == "10.0.0.1" );
+
+	// Cookies set by the response are not kept
+	REQUIRE( record.response_headers.size() == 3 );
+	REQUIRE( record.response_headers[1].first == "Set-Cookie" );
+	REQUIRE( record.response_headers[1].second == "<redacted>" );
+	REQUIRE( record.response_headers[2].second == "<redacted>" );
+
+	log.set_redacted_headers({ symbols::Status });
+	record = log.capture(request);
+	REQUIRE( record.response_headers[0].first == "Status" );
+	REQUIRE( record.response_headers[0].second == "<redacted>" );
+	REQUIRE( record.response_headers[2].second == "y=2" );
+
+	log.set_env_filter({ Symbol("HTTP_COOKIE") });
+	log.set_redacted_headers({ symbols::SetCookie });
+	record = log.capture(request);
+	REQUIRE( record.env.size() == 1 );
+	REQUIRE( record.env[0].second == "secret" );
+
+	record.route = "/upload";
+	record.phase_ns[size_t(Server::Phase::Handler)] = 1500000;
+	record.trace = "{\"traceEvents\":[]}";
+	log.add(std::move(record));
+
+	LineFormatter output;
+	log.write_json(output);
+	std::string const& json = output.buffer();
+	REQUIRE( json.front() == '[' );
+	REQUIRE( json.back() == ']' );
+	REQUIRE( json.find("\"route\":\"/upload\"") != std::string::npos );
+	REQUIRE( json.find("\"status\":503") != std::string::npos );
+	REQUIRE( json.find("\"handler\":1.5") != std::string::npos );
+	REQUIRE( json.find("[\"Set-Cookie\",\"<redacted>\"]") != std::string::npos );
+	REQUIRE( json.find("x=1") == std::string::npos );
+	REQUIRE( json.find("\"trace\":{\"traceEvents\":[]}") != std::string::npos );
+}
+
+TEST_CASE("SlowRequestLog-Router", "[slow_request_log]")
+{
+	auto log = std::make_shared<SlowRequestLog>();
+	SlowRequestLog::Record record {};
+	record.uri = "/slow/page";
+	log->add(std::move(record));
+
+	SlowRequestRouter router(log, "/admin/slow");
+	Logger logger = MockLogger::create();
+	const char *envp[] = { nullptr, nullptr, nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	auto route = [&] (char const* method, char const* uri)
+	{
+		envp[0] = method;
+		envp[1] = uri;
+		cgidata.m_writebuf.clear();
+		Request request(cgidata, logger);
+		RequestContext context(request);
+		IRouter::RouteResult result = router.handle_request(context);
+		if (!request.headers_sent())
+			request.send_headers();
+		return result;
+	};
+
+	REQUIRE( route("REQUEST_METHOD=GET", "DOCUMENT_URI=/admin") == IRouter::RouteResult::NotFound );
+	REQUIRE( route("REQUEST_METHOD=GET", "DOCUMENT_URI=/admin/slow/x") == IRouter::RouteResult::NotFound );
+
+	REQUIRE( route("REQUEST_METHOD=GET", "DOCUMENT_URI=/admin/slow") == IRouter::RouteResult::Handled );
+	REQUIRE( cgidata.m_writebuf.find("Content-Type: application/json") != std::string::npos );
+	REQUIRE( cgidata.m_writebuf.find("\"uri\":\"/slow/page\"") != std::string::npos );
+
+	REQUIRE( route("REQUEST_METHOD=POST", "DOCUMENT_URI=/admin/slow") == IRouter::RouteResult::InvalidMethod );
+	REQUIRE( cgidata.m_writebuf.find("Allow: GET, HEAD, DELETE") != std::string::npos );
+
+	REQUIRE( route("REQUEST_METHOD=DELETE", "DOCUMENT_URI=/admin/slow") == IRouter::RouteResult::Handled );
+	REQUIRE( log->records().empty() );
+}
@@ -0,0 +1,160 @@
+#include "line_formatter.h"
+#include "request.h"
+#include "request_context.h"
+#include "router.h"
+#include "test_mock_cgi_data.h"
+#include "test_mock_logger.h"
+#include "tracing.h"
+#include <string>
+#include <thread>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+#include <catch2/catch_test_macros.hpp>
+
+namespace
+{
+
+size_t count(std::string const& haystack, std::string_view const& needle)
+{
+	size_t result = 0;
+	for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1))
+		++result;
+	return result;
+}
+
+}
+
+TEST_CASE("Tracing-Spans", "[tracing]")
+{
+	Tracer & tracer = Tracer::instance();
+	tracer.clear();
+	tracer.set_sample_rate(0.0);
+
+	SECTION("Nothing is recorded outside of traced requests")
+	{
+		{
+			TRACE_SCOPE("untraced");
+		}
+		REQUIRE( !tracer.begin_request() );
+		{
+			TRACE_SCOPE("unsampled");
+		}
+		tracer.end_request();
+
+		LineFormatter output;
+		tracer.write_chrome_trace(output);
+		REQUIRE( output.buffer() == "{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}" );
+	}
+
+	SECTION("Traced requests")
+	{
+		REQUIRE( tracer.begin_request(true) );
+		REQUIRE( Tracer::active() );
+		{
+			TRACE_SCOPE("outer");
+			TRACE_SCOPE("inner");
+		}
+		tracer.end_request();
+		REQUIRE( !Tracer::active() );
+
+		LineFormatter output;
+		tracer.write_chrome_trace(output);
+		std::string const& json = output.buffer();
+		REQUIRE( json.find("{\"name\":\"inner\",\"ph\":\"X\",\"ts\":") != std::string::npos );
+		REQUIRE( json.find("{\"name\":\"outer\",\"ph\":\"X\",\"ts\":") != std::string::npos );
+		REQUIRE( json.find("{\"name\":\"request\",\"ph\":\"X\",\"ts\":") != std::string::npos );
+		REQUIRE( json.find("inner") < json.find("outer") );
+
+		// The trace of a single request can be handed out as well
+		std::string request_trace;
+		REQUIRE( tracer.begin_request(true) );
+		{
+			TRACE_SCOPE("single");
+		}
+		tracer.end_request(&request_trace);
+		REQUIRE( count(request_trace, "\"ph\"") == 2 );
+		REQUIRE( request_trace.find("\"single\"") != std::string::npos );
+
+		tracer.clear();
+		output.clear();
+		tracer.write_chrome_trace(output);
+		REQUIRE( count(output.buffer(), "\"ph\"") == 0 );
+	}
+
+	SECTION("Rings wrap around")
+	{
+		REQUIRE( tracer.begin_request(true) );
+		for (size_t i = 0; i < Tracer::ring_capacity + 10; ++i)
+		{
+			TRACE_SCOPE("span");
+		}
+		tracer.end_request();
+
+		LineFormatter output;
+		tracer.write_chrome_trace(output);
+		REQUIRE( count(output.buffer(), "\"name\":\"span\"") == Tracer::ring_capacity - 1 );
+		REQUIRE( count(output.buffer(), "\"name\":\"request\"") == 1 );
+	}
+
+	SECTION("Sampling")
+	{
+		tracer.set_sample_rate(1.0);
+		REQUIRE( tracer.sample_rate() == 1.0 );
+		REQUIRE( tracer.begin_request() );
+		tracer.end_request();
+
+		tracer.set_sample_rate(0.25);
+		size_t traced = 0;
+		for (size_t i = 0; i < 10000; ++i)
+		{
+			traced += tracer.begin_request() ? 1 : 0;
+			tracer.end_request();
+		}
+		REQUIRE( traced > 2000 );
+		REQUIRE( traced < 3000 );
+
+		tracer.set_sample_rate(0.0);
+	}
+
+	tracer.clear();
+}
+
+TEST_CASE("Tracing-Library spans", "[tracing]")
+{
+	Tracer & tracer = Tracer::instance();
+	tracer.clear();
+
+	std::string slow_trace;
+	tracer.set_slow_request_trigger(std::chrono::nanoseconds(1), [&slow_trace] (std::string && json) { slow_trace = std::move(json); });
+
+	Router router;
+	router.add_route([] (RequestContext & context)
+	{
+		TRACE_SCOPE("render");
+		context.request().write_stream() << "traced";
+	}, "/page");
+
+	Logger logger = MockLogger::create();
+	const char *envp[] = { "DOCUMENT_URI=/page", nullptr };
+	MockCgiData cgidata(std::string(), envp);
+
+	{
+		Request request(cgidata, logger);
+		RequestContext context(request);
+
+		tracer.begin_request(true);
+		REQUIRE( router.handle_request(context) == IRouter::RouteResult::Handled );
+		tracer.end_request();
+	}
+
+	tracer.set_slow_request_trigger(std::chrono::nanoseconds(0), nullptr);
+
+	for (auto name : { "\"route\""sv, "\"render\""sv, "\"flush\""sv, "\"send_headers\""sv, "\"request\""sv })
+		REQUIRE( slow_trace.find(name) != std::string::npos );
+	REQUIRE( slow_trace.front() == '{' );
+	REQUIRE( slow_trace.back() == '}' );
+
+	tracer.clear();
+}
@@ -0,0 +1,254 @@
+#include "utils.h"
+#include <catch2/catch_test_macros.hpp>
+#include <random>
+#include <string>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+namespace
+{
+
+// Straightforward implementations to check the optimized ones against
+
+utils::ParamList reference_split_params(std::string_view input)
+{
+	utils::ParamList params;
+	while (!input.empty())
+	{
+		size_t split = input.find('&');
+
+		std::string_view element = input.substr(0, split);
+		input = split == std::string_view::npos ? std::string_view() : input.substr(split+1);
+
+		split = element.find('=');
+		std::string_view key = element.substr(0, split);
+		std::string_view value = split == std::string_view::npos ? std::string_view() : element.substr(split+1);
+		params.emplace_back(key, value);
+	}
+	return params;
+}
+
+std::string reference_percent_decode(std::string_view value, bool plus_as_space)
+{
+	std::string result;
+	for (size_t idx = 0; idx < value.size(); ++idx)
+	{
+		char c = value[idx];
+		if (c == '%' && idx + 2 < value.size())
+		{
+			auto chr = utils::unhex(value.data() + idx + 1);
+			if (chr.first)
+			{
+				result.push_back(chr.second);
+				idx += 2;
+				continue;
+			}
+		}
+		result.push_back(plus_as_space && c == '+' ? ' ' : c);
+	}
+	return result;
+}
+
+std::string random_string(std::mt19937 & rng, std::string_view alphabet, size_t max_length)
+{
+	std::uniform_int_distribution<size_t> length_dist(0, max_length);
+	std::uniform_int_distribution<size_t> char_dist(0, alphabet.size() - 1);
+
+	std::string result(length_dist(rng), ' ');
+	for (char & c : result)
+		c = alphabet[char_dist(rng)];
+	return result;
+}
+
+}
+
+TEST_CASE("Utils-SplitParams", "[utils]")
+{
+	SECTION("Edge cases")
+	{
+		for (std::string_view input : { ""sv, "&"sv, "&&"sv, "="sv, "a"sv, "a&"sv, "&a"sv, "a=&=b"sv, "a==b&c=d=e"sv })
+		{
+			utils::ParamList params;
+			utils::split_params(input, params);
+			REQUIRE( params == reference_split_params(input) );
+		}
+	}
+
+	SECTION("Matches reference on random input")
+	{
+		std::mt19937 rng(1234);
+		for (int i = 0; i < 2000; ++i)
+		{
+			std::string input = random_string(rng, "ab=&%", 100);
+			utils::ParamList params;
+			utils::split_params(input, params);
+			REQUIRE( params == reference_split_params(input) );
+		}
+	}
+
+	SECTION("Appends to existing params")
+	{
+		utils::ParamList params;
+		utils::split_params("a=1", params);
+		utils::split_params("b=2", params);
+		REQUIRE( params.size() == 2 );
+		REQUIRE( params[1].first == "b"sv );
+	}
+}
+
+TEST_CASE("Utils-PercentDecode", "[utils]")
+{
+	SECTION("Plus handling")
+	{
+		std::string input = "a+b%2Bc+";
+		std::string output(input.size(), '\0');
+
+		output.resize(utils::percent_decode(input, output.data(), false));
+		REQUIRE( output == "a+b+c+" );
+
+		output.resize(input.size());
+		output.resize(utils::percent_decode(input, output.data(), true));
+		REQUIRE( output == "a b+c " );
+	}
+
+	SECTION("In place")
+	{
+		std::string buffer = "a%20long%20enough%20string%20to%20cross%20several%20vector%20blocks%21";
+		buffer.resize(utils::percent_decode(buffer, buffer.data()));
+		REQUIRE( buffer == "a long enough string to cross several vector blocks!" );
+	}
+
+	SECTION("Matches reference on random input")
+	{
+		std::mt19937 rng(5678);
+		for (int i = 0; i < 2000; ++i)
+		{
+			std::string input = random_string(rng, "abcXYZ012%%+fF", 120);
+			bool plus_as_space = (i & 1) != 0;
+
+			std::string output(input.size(), '\0');
+			output.resize(utils::percent_decode(input, output.data(), plus_as_space));
+			REQUIRE( output == reference_percent_decode(input, plus_as_space) );
+
+			std::string in_place = input;
+			in_place.resize(utils::percent_decode(in_place, in_place.data(), plus_as_space));
+			REQUIRE( in_place == output );
+		}
+	}
+}
+
+namespace
+{
+
+std::u32string reference_utf8_decode(std::string_view input)
+{
+	std::u32string result;
+	utils::convert_state state;
+	for (char c : input)
+	{
+		char32_t glyph = utils::utf8_to_32(c, state);
+		if (glyph != 0)
+			result.push_back(glyph);
+	}
+	return result;
+}
+
+size_t reference_utf8_clean_prefix(std::string_view input)
+{
+	size_t idx = 0;
+	while (idx < input.size())
+	{
+		utils::convert_state state;
+		size_t end = idx;
+		char32_t glyph = 0;
+		while (end < input.size() && glyph == 0)
+		{
+			glyph = utils::utf8_to_32(input[end++], state);
+			if (state.remaining == 0)
+				break;
+		}
+
+		if (glyph == 0 || !state.valid)
+			break;
+
+		uint8_t tmp[4];
+		size_t len = utils::utf32_to_8(glyph, tmp);
+		if (std::string_view(reinterpret_cast<char*>(tmp), len) != input.substr(idx, end - idx))
+			break;
+
+		idx = end;
+	}
+	return idx;
+}
+
+// Mostly ASCII with a good helping of lead, continuation and out of range bytes
+constexpr std::string_view utf8_alphabet = "abcdefgh<>&\0\x7f\x80\x8f\x90\x9f\xa0\xbf\xc0\xc1\xc2\xdf\xe0\xed\xef\xf0\xf4\xf5\xf8\xff"sv;
+
+}
+
+TEST_CASE("Utils-Utf8", "[utils]")
+{
+	SECTION("Edge cases")
+	{
+		for (std::string_view input : { ""sv, "plain ascii"sv, "nul\0byte"sv, "caf\xc3\xa9"sv, "\xe2\x82\xac"sv, "\xf0\x9f\x98\x80"sv,
+		                                "\xc0\x80"sv, "\xc1\x81"sv, "\xe0\x80\xaf"sv, "\xed\xa0\x80"sv, "\xf4\x90\x80\x80"sv,
+		                                "\xe2\xf4\xa2"sv, "\xe2" "abc"sv, "trailing\xe2\x82"sv, "\xff"sv })
+		{
+			std::u32string decoded;
+			utils::utf8_decode(input, decoded);
+			REQUIRE( decoded == reference_utf8_decode(input) );
+			REQUIRE( utils::utf8_clean_prefix(input) == reference_utf8_clean_prefix(input) );
+		}
+
+		REQUIRE( utils::utf8_validate("caf\xc3\xa9 \xf0\x9f\x98\x80"sv) );
+		REQUIRE( !utils::utf8_validate("nul\0byte"sv) );
+		REQUIRE( !utils::utf8_validate("\xc1\x81"sv) );
+		REQUIRE( !utils::utf8_validate("trailing\xe2\x82"sv) );
+	}
+
+	SECTION("Appends to existing output")
+	{
+		std::u32string decoded = U"x";
+		utils::utf8_decode("y\xc3\xa9"sv, decoded);
+		REQUIRE( decoded == U"xyé" );
+	}
+
+	SECTION("Matches reference on random input")
+	{
+		std::mt19937 rng(4321);
+		for (int i = 0; i < 2000; ++i)
+		{
+			std::string input = random_string(rng, utf8_alphabet, 100);
+
+			std::u32string decoded;
+			utils::utf8_decode(input, decoded);
+			REQUIRE( decoded == reference_utf8_decode(input) );
+			REQUIRE( utils::utf8_clean_prefix(input) == reference_utf8_clean_prefix(input) );
+		}
+	}
+
+	SECTION("Matches reference on long valid input")
+	{
+		std::mt19937 rng(5678);
+		std::uniform_int_distribution<uint32_t> glyph_dist(1, 0x10ffff);
+		std::uniform_int_distribution<int> ascii_dist(0, 3);
+
+		for (int i = 0; i < 200; ++i)
+		{
+			std::string input;
+			for (int j = 0; j < 100; ++j)
+			{
+				uint8_t tmp[4];
+				char32_t glyph = ascii_dist(rng) ? U'a' + j % 26 : glyph_dist(rng);
+				input.append(reinterpret_cast<char*>(tmp), utils::utf32_to_8(glyph, tmp));
+			}
+
+			REQUIRE( utils::utf8_clean_prefix(input) == input.size() );
+
+			std::u32string decoded;
+			utils::utf8_decode(input, decoded);
+			REQUIRE( decoded == reference_utf8_decode(input) );
+		}
+	}
+}
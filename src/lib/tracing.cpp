@@ -0,0 +1,353 @@
+#include "tracing.h"
+#include "cycle_clock.h"
+#include "json_writer.h"
+#include "line_formatter.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+using namespace fcgiserver;
+using namespace std::literals::string_view_literals;
+
+namespace
+{
+
+struct Span
+{
+	// 2 * index + 1 while the span at index is being written, 2 * index + 2
+	// once it is complete
+	std::atomic<uint64_t> sequence {0};
+	std::atomic<char const*> name {nullptr};
+	std::atomic<uint64_t> start {0};
+	std::atomic<uint64_t> end {0};
+	std::atomic<uint64_t> request {0};
+};
+
+struct SpanCopy
+{
+	char const* name;
+	uint64_t start;
+	uint64_t end;
+	uint64_t request;
+};
+
+// Spans of one thread. The owner writes a slot and then publishes it by
+// advancing head; every slot carries a sequence number so readers can tell
+// whether they copied the span they wanted, rather than one that was being
+// overwritten meanwhile.
+struct Ring
+{
+	void push(char const* name, uint64_t start, uint64_t end)
+	{
+		uint64_t index = head.load(std::memory_order_relaxed);
+		Span & span = spans[index % Tracer::ring_capacity];
+		span.sequence.store(2 * index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		span.name.store(name, std::memory_order_relaxed);
+		span.start.store(start, std::memory_order_relaxed);
+		span.end.store(end, std::memory_order_relaxed);
+		span.request.store(request, std::memory_order_relaxed);
+		span.sequence.store(2 * index + 2, std::memory_order_release);
+		head.store(index + 1, std::memory_order_release);
+	}
+
+	// Spans from the given request onwards, oldest first
+	void copy(std::vector<SpanCopy> & output, uint64_t from_request = 0) const
+	{
+		uint64_t last = head.load(std::memory_order_acquire);
+		uint64_t first = last > Tracer::ring_capacity ? last - Tracer::ring_capacity : 0;
+		first = std::max(first, std::min(cleared.load(std::memory_order_relaxed), last));
+
+		for (uint64_t index = first; index < last; ++index)
+		{
+			Span const& span = spans[index % Tracer::ring_capacity];
+			uint64_t sequence = span.sequence.load(std::memory_order_acquire);
+			SpanCopy copy {
+			    span.name.load(std::memory_order_relaxed),
+			    span.start.load(std::memory_order_relaxed),
+			    span.end.load(std::memory_order_relaxed),
+			    span.request.load(std::memory_order_relaxed)
+			};
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			// Overwritten by a later span, possibly halfway
+			if (sequence != 2 * index + 2 || span.sequence.load(std::memory_order_relaxed) != sequence)
+				continue;
+
+			if (copy.request >= from_request)
+				output.push_back(copy);
+		}
+	}
+
+	Span spans[Tracer::ring_capacity];
+	std::atomic<uint64_t> head {0};
+	std::atomic<uint64_t> cleared {0};
+	std::atomic<bool> in_use {false};
+	uint32_t thread_number = 0;
+	Ring * next = nullptr;
+
+	// Only touched by the owning thread
+	uint64_t request = 0;
+	uint64_t request_start = 0;
+};
+
+// Per thread state, the ring is only allocated once a request is traced
+struct ThreadState
+{
+	~ThreadState()
+	{
+		if (ring)
+			ring->in_use.store(false, std::memory_order_release);
+	}
+
+	Ring * ring = nullptr;
+	uint64_t random = 0;
+	bool in_request = false;
+	bool traced = false;
+};
+
+thread_local ThreadState g_thread_state;
+
+void write_events(JsonWriter & json, std::vector<SpanCopy> const& spans, uint32_t thread_number)
+{
+	static const int pid = ::getpid();
+
+	for (SpanCopy const& span : spans)
+	{
+		uint64_t start_ns = CycleClock::to_nanoseconds(span.start);
+		uint64_t duration_ns = CycleClock::to_nanoseconds(span.end - span.start);
+
+		json.begin_object();
+		json.field("name", span.name);
+		json.field("ph", "X");
+		json.field("ts", double(start_ns) / 1000.0);
+		json.field("dur", double(duration_ns) / 1000.0);
+		json.field("pid", pid);
+		json.field("tid", thread_number);
+		json.key("args").begin_object().field("request", span.request).end_object();
+		json.end_object();
+	}
+}
+
+}
+
+
+class fcgiserver::TracerPrivate
+{
+public:
+	TracerPrivate()
+	    : sample_threshold(0)
+	    , slow_threshold_ns(0)
+	    , rings(nullptr)
+	    , ring_count(0)
+	{
+	}
+
+	~TracerPrivate()
+	{
+		Ring * ring = rings.load();
+		while (ring)
+		{
+			Ring * next = ring->next;
+			delete ring;
+			ring = next;
+		}
+	}
+
+	Ring * acquire_ring()
+	{
+		for (Ring * ring = rings.load(); ring; ring = ring->next)
+		{
+			bool expected = false;
+			if (!ring->in_use.load(std::memory_order_relaxed) && ring->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+				return ring;
+		}
+
+		// Rings are never removed, so pushing to the front is all it takes
+		Ring * ring = new Ring;
+		ring->in_use.store(true);
+		ring->thread_number = ++ring_count;
+		ring->next = rings.load();
+		while (!rings.compare_exchange_weak(ring->next, ring))
+			;
+		return ring;
+	}
+
+	bool sample(ThreadState & state)
+	{
+		uint64_t threshold = sample_threshold.load(std::memory_order_relaxed);
+		if (threshold == 0)
+			return false;
+
+		if (state.random == 0)
+			state.random = reinterpret_cast<uintptr_t>(&state) ^ CycleClock::now() ^ 0x9e3779b97f4a7c15ull;
+
+		// xorshift64
+		state.random ^= state.random << 13;
+		state.random ^= state.random >> 7;
+		state.random ^= state.random << 17;
+		return state.random <= threshold;
+	}
+
+	std::atomic<uint64_t> sample_threshold;
+	std::atomic<uint64_t> slow_threshold_ns;
+	std::mutex slow_mutex;
+	Tracer::SlowRequestCallback slow_callback;
+
+	std::atomic<Ring*> rings;
+	std::atomic<uint32_t> ring_count;
+};
+
+
+thread_local bool Tracer::t_active = false;
+
+Tracer & Tracer::instance()
+{
+	static Tracer tracer;
+	return tracer;
+}
+
+Tracer::Tracer()
+    : m_private(new TracerPrivate)
+{
+}
+
+Tracer::~Tracer()
+{
+	delete m_private;
+}
+
+void Tracer::set_sample_rate(double fraction)
+{
+	uint64_t threshold;
+	if (!(fraction > 0.0))
+		threshold = 0;
+	else if (fraction >= 1.0)
+		threshold = UINT64_MAX;
+	else
+		threshold = std::max<uint64_t>(1, uint64_t(fraction * 18446744073709551616.0));
+
+	m_private->sample_threshold.store(threshold, std::memory_order_relaxed);
+}
+
+double Tracer::sample_rate() const
+{
+	uint64_t threshold = m_private->sample_threshold.load(std::memory_order_relaxed);
+	return threshold == UINT64_MAX ? 1.0 : double(threshold) / 18446744073709551616.0;
+}
+
+void Tracer::set_slow_request_trigger(std::chrono::nanoseconds threshold, SlowRequestCallback callback)
+{
+	std::lock_guard<std::mutex> guard(m_private->slow_mutex);
+	m_private->slow_callback = std::move(callback);
+	m_private->slow_threshold_ns.store(m_private->slow_callback ? std::max<int64_t>(threshold.count(), 1) : 0, std::memory_order_relaxed);
+}
+
+bool Tracer::begin_request(bool force)
+{
+	ThreadState & state = g_thread_state;
+	state.in_request = true;
+	state.traced = force || m_private->sample(state);
+	t_active = state.traced;
+
+	if (!state.traced)
+		return false;
+
+	if (!state.ring)
+	{
+		state.ring = m_private->acquire_ring();
+		CycleClock::nanoseconds_per_tick();
+	}
+
+	state.ring->request += 1;
+	state.ring->request_start = CycleClock::now();
+	return true;
+}
+
+void Tracer::end_request(std::string * trace_json)
+{
+	ThreadState & state = g_thread_state;
+	if (!state.in_request)
+		return;
+
+	bool traced = state.traced;
+	state.in_request = false;
+	state.traced = false;
+	t_active = false;
+
+	if (!traced)
+		return;
+
+	Ring & ring = *state.ring;
+	uint64_t end = CycleClock::now();
+	ring.push("request", ring.request_start, end);
+
+	uint64_t slow_threshold = m_private->slow_threshold_ns.load(std::memory_order_relaxed);
+	bool slow = slow_threshold != 0 && CycleClock::to_nanoseconds(end - ring.request_start) >= slow_threshold;
+	if (!slow && !trace_json)
+		return;
+
+	std::vector<SpanCopy> spans;
+	ring.copy(spans, ring.request);
+
+	LineFormatter output(GenericFormat::Verbatim);
+	JsonWriter json(output);
+	json.begin_object();
+	json.key("traceEvents").begin_array();
+	write_events(json, spans, ring.thread_number);
+	json.end_array();
+	json.end_object();
+
+	if (trace_json)
+		*trace_json = output.buffer();
+	if (!slow)
+		return;
+
+	SlowRequestCallback callback;
+	{
+		std::lock_guard<std::mutex> guard(m_private->slow_mutex);
+		callback = m_private->slow_callback;
+	}
+	if (callback)
+		callback(std::move(output.buffer()));
+}
+
+void Tracer::write_chrome_trace(GenericFormatter & output) const
+{
+	JsonWriter json(output);
+	json.begin_object();
+	json.key("traceEvents").begin_array();
+
+	std::vector<SpanCopy> spans;
+	for (Ring * ring = m_private->rings.load(); ring; ring = ring->next)
+	{
+		spans.clear();
+		ring->copy(spans);
+		write_events(json, spans, ring->thread_number);
+	}
+
+	json.end_array();
+	json.field("displayTimeUnit", "ns");
+	json.end_object();
+}
+
+void Tracer::clear()
+{
+	// The owners keep writing, readers merely skip what came before
+	for (Ring * ring = m_private->rings.load(); ring; ring = ring->next)
+		ring->cleared.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+uint64_t Tracer::span_begin()
+{
+	return CycleClock::now();
+}
+
+void Tracer::span_end(char const* name, uint64_t start)
+{
+	ThreadState & state = g_thread_state;
+	if (state.traced)
+		state.ring->push(name, start, CycleClock::now());
+}
@@ -0,0 +1,108 @@
+#ifndef FCGISERVER_TRACING_H
+#define FCGISERVER_TRACING_H
+
+#include "fcgiserver_defs.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Records a span from here to the end of the enclosing scope when the current
+// request is being traced. The name must be a string literal or otherwise
+// outlive the trace.
+//
+//   TRACE_SCOPE("render");
+#define FCGISERVER_TRACE_CONCAT_INNER(a, b) a ## b
+#define FCGISERVER_TRACE_CONCAT(a, b) FCGISERVER_TRACE_CONCAT_INNER(a, b)
+#define FCGISERVER_TRACE_SCOPE(name) ::fcgiserver::TraceScope FCGISERVER_TRACE_CONCAT(fcgiserver_trace_scope_, __LINE__)(name)
+
+#ifndef TRACE_SCOPE
+#define TRACE_SCOPE(name) FCGISERVER_TRACE_SCOPE(name)
+#endif
+
+namespace fcgiserver
+{
+
+class GenericFormatter;
+class TracerPrivate;
+
+/// Opt-in request tracing. The Server asks the tracer for every request
+/// whether to trace it; for a traced request all spans are written into a
+/// ring buffer of the worker thread, which only that thread writes to. The
+/// rings can be dumped at any time as Chrome trace JSON, viewable in
+/// chrome://tracing or Perfetto.
+///
+/// When tracing is off, or the request was not sampled, a span costs a check
+/// of a thread local flag.
+class DLL_PUBLIC Tracer
+{
+public:
+	/// Spans kept per thread, older ones are overwritten
+	static constexpr size_t ring_capacity = 4096;
+
+	using SlowRequestCallback = std::function<void(std::string && trace_json)>;
+
+	static Tracer & instance();
+	Tracer(Tracer const& other) = delete;
+	Tracer & operator= (Tracer const& other) = delete;
+
+	/// Fraction (0..1) of requests to trace, 0 turns tracing off (default)
+	void set_sample_rate(double fraction);
+	double sample_rate() const;
+
+	/// Called with the trace of every traced request that took at least the
+	/// threshold, on the thread that handled it. An empty callback disables.
+	void set_slow_request_trigger(std::chrono::nanoseconds threshold, SlowRequestCallback callback);
+
+	/// Brackets a request on the current thread; begin_request() decides
+	/// whether it will be traced, or always traces it when forced. If the
+	/// request was traced, end_request() can hand out its Chrome trace JSON.
+	bool begin_request(bool force = false);
+	void end_request(std::string * trace_json = nullptr);
+
+	inline static bool active() { return t_active; }
+
+	/// All spans still in the rings as a Chrome trace JSON document
+	void write_chrome_trace(GenericFormatter & output) const;
+	void clear();
+
+	// Used by TraceScope
+	static uint64_t span_begin();
+	static void span_end(char const* name, uint64_t start);
+
+private:
+	Tracer();
+	~Tracer();
+
+	static thread_local bool t_active;
+
+	TracerPrivate * m_private;
+};
+
+class DLL_PUBLIC TraceScope
+{
+public:
+	explicit inline TraceScope(char const* name)
+	    : m_name(name)
+	    , m_start(Tracer::active() ? Tracer::span_begin() : 0)
+	{
+	}
+
+	inline ~TraceScope()
+	{
+		if (m_start)
+			Tracer::span_end(m_name, m_start);
+	}
+
+	TraceScope(TraceScope const& other) = delete;
+	TraceScope & operator= (TraceScope const& other) = delete;
+
+private:
+	char const* m_name;
+	uint64_t m_start;
+};
+
+}
+
+#endif // FCGISERVER_TRACING_H
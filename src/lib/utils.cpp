@@ -1,10 +1,90 @@
 #include "utils.h"
+#include "simd.h"
+#include <cstring>
 
 namespace fcgiserver
 {
 namespace utils
 {
 
+namespace
+{
+
+// Index of the first occurrence of either byte, or size if there is none
+size_t find_either(char const* data, size_t size, char a, char b)
+{
+	size_t idx = 0;
+
+	const simd::Vector va = simd::splat(a);
+	const simd::Vector vb = simd::splat(b);
+	for (; idx + simd::width <= size; idx += simd::width)
+	{
+		simd::Vector block = simd::load(data + idx);
+		simd::Mask found = simd::mask(simd::either(simd::eq(block, va), simd::eq(block, vb)));
+		if (found)
+			return idx + simd::first(found);
+	}
+
+	for (; idx < size; ++idx)
+		if (data[idx] == a || data[idx] == b)
+			return idx;
+
+	return size;
+}
+
+// Index of the first byte that is NUL or not ASCII, or size if there is none
+size_t plain_ascii_run(uint8_t const* data, size_t size)
+{
+	size_t idx = 0;
+
+	const simd::Vector zero = simd::splat(0);
+	for (; idx + simd::width <= size; idx += simd::width)
+	{
+		simd::Vector block = simd::load(data + idx);
+		simd::Mask found = simd::non_ascii(block) | simd::mask(simd::eq(block, zero));
+		if (found)
+			return idx + simd::first(found);
+	}
+
+	for (; idx < size; ++idx)
+		if (data[idx] == 0 || data[idx] >= 0x80)
+			return idx;
+
+	return size;
+}
+
+// Length of the well-formed, shortest form multibyte sequence at data, or 0
+size_t multibyte_length(uint8_t const* data, size_t size)
+{
+	auto continuation = [] (uint8_t c) { return (c & 0xc0) == 0x80; };
+
+	uint8_t lead = data[0];
+	if (lead >= 0xc2 && lead <= 0xdf)
+	{
+		return (size >= 2 && continuation(data[1])) ? 2 : 0;
+	}
+	else if (lead >= 0xe0 && lead <= 0xef)
+	{
+		if (size < 3 || !continuation(data[1]) || !continuation(data[2]))
+			return 0;
+		return (lead == 0xe0 && data[1] < 0xa0) ? 0 : 3;
+	}
+	else if (lead >= 0xf0 && lead <= 0xf4)
+	{
+		if (size < 4 || !continuation(data[1]) || !continuation(data[2]) || !continuation(data[3]))
+			return 0;
+		if (lead == 0xf0 && data[1] < 0x90)
+			return 0;
+		if (lead == 0xf4 && data[1] >= 0x90)
+			return 0;
+		return 4;
+	}
+
+	return 0;
+}
+
+}
+
 std::pair<bool,uint8_t> unhex(char const* ch)
 {
 	uint8_t v = 0;
@@ -32,6 +112,108 @@ std::pair<bool,uint8_t> unhex(char const* ch)
 	return {true, v};
 }
 
+void split_params(std::string_view input, ParamList & params)
+{
+	char const* data = input.data();
+	size_t const size = input.size();
+	size_t element_start = 0;
+	size_t equals = std::string_view::npos;
+
+	auto emit = [&] (size_t element_end)
+	{
+		if (equals == std::string_view::npos)
+			params.emplace_back(input.substr(element_start, element_end - element_start), std::string_view());
+		else
+			params.emplace_back(input.substr(element_start, equals - element_start), input.substr(equals + 1, element_end - equals - 1));
+	};
+
+	auto delimiter = [&] (size_t idx)
+	{
+		if (data[idx] == '&')
+		{
+			emit(idx);
+			element_start = idx + 1;
+			equals = std::string_view::npos;
+		}
+		else if (equals == std::string_view::npos)
+		{
+			equals = idx;
+		}
+	};
+
+	// Find all delimiters of a block at once and walk the bits
+	size_t idx = 0;
+	const simd::Vector amp = simd::splat('&');
+	const simd::Vector eq = simd::splat('=');
+	for (; idx + simd::width <= size; idx += simd::width)
+	{
+		simd::Vector block = simd::load(data + idx);
+		simd::Mask found = simd::mask(simd::either(simd::eq(block, amp), simd::eq(block, eq)));
+		while (found)
+		{
+			delimiter(idx + simd::first(found));
+			found &= found - 1;
+		}
+	}
+
+	for (; idx < size; ++idx)
+	{
+		if (data[idx] == '&' || data[idx] == '=')
+			delimiter(idx);
+	}
+
+	// A trailing '&' does not start a new element
+	if (element_start < size)
+		emit(size);
+}
+
+size_t percent_decode(std::string_view input, char * output, bool plus_as_space)
+{
+	char const* src = input.data();
+	char const* const end = src + input.size();
+	char * dst = output;
+
+	// '%' is always special; searching for it twice is cheaper than a branch per block
+	const char plus = plus_as_space ? '+' : '%';
+
+	while (src < end)
+	{
+		size_t run = find_either(src, end - src, '%', plus);
+		if (dst != src)
+			std::memmove(dst, src, run);
+		dst += run;
+		src += run;
+
+		if (src == end)
+			break;
+
+		if (*src == '+')
+		{
+			*dst++ = ' ';
+			++src;
+		}
+		else if (end - src >= 3)
+		{
+			auto chr = unhex(src + 1);
+			if (chr.first)
+			{
+				*dst++ = char(chr.second);
+				src += 3;
+			}
+			else
+			{
+				*dst++ = *src++;
+			}
+		}
+		else
+		{
+			*dst++ = *src++;
+		}
+	}
+
+	return dst - output;
+}
+
 char32_t utf8_to_32(uint8_t next, convert_state & state)
 {
 	if (state.remaining > 0)
@@ -89,6 +271,60 @@ char32_t utf8_to_32(uint8_t next, convert_state & state)
 		return 65533; // replacement character
 }
 
+size_t utf8_clean_prefix(std::string_view input)
+{
+	uint8_t const* data = reinterpret_cast<uint8_t const*>(input.data());
+	size_t const size = input.size();
+	size_t idx = 0;
+
+	while (idx < size)
+	{
+		idx += plain_ascii_run(data + idx, size - idx);
+		if (idx == size || data[idx] == 0)
+			break;
+
+		size_t len = multibyte_length(data + idx, size - idx);
+		if (len == 0)
+			break;
+
+		idx += len;
+	}
+
+	return idx;
+}
+
+void utf8_decode(std::string_view input, std::u32string & output)
+{
+	uint8_t const* src = reinterpret_cast<uint8_t const*>(input.data());
+	uint8_t const* const end = src + input.size();
+
+	output.reserve(output.size() + input.size());
+
+	convert_state state;
+	while (src < end)
+	{
+		// Between glyphs the decoder has no state, so ASCII can be widened directly
+		if (state.remaining == 0)
+		{
+			size_t run = plain_ascii_run(src, end - src);
+			size_t offset = output.size();
+			output.resize(offset + run);
+
+			char32_t * dst = output.data() + offset;
+			for (size_t idx = 0; idx < run; ++idx)
+				dst[idx] = src[idx];
+
+			src += run;
+			if (src == end)
+				break;
+		}
+
+		char32_t glyph = utf8_to_32(*src++, state);
+		if (glyph != 0)
+			output.push_back(glyph);
+	}
+}
+
 size_t utf32_to_8(char32_t glyph, uint8_t * buf)
 {
 	if (glyph < 0x80)
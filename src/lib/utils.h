@@ -6,6 +6,7 @@
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 namespace fcgiserver
 {
@@ -14,6 +15,16 @@ namespace utils
 
 std::pair<bool,uint8_t> DLL_PUBLIC unhex(char const* ch);
 
+using ParamList = std::vector<std::pair<std::string_view,std::string_view>>;
+
+/// Split a query string or urlencoded form into raw key/value views, appending to params
+void DLL_PUBLIC split_params(std::string_view input, ParamList & params);
+
+/// Decode %XX escapes (and optionally '+' as space) into output, which must
+/// hold at least input.size() bytes and may be input.data() itself to decode
+/// in place. Invalid escapes are copied as-is. Returns the decoded size.
+std::size_t DLL_PUBLIC percent_decode(std::string_view input, char * output, bool plus_as_space = false);
+
 struct convert_state
 {
 	std::uint32_t glyph = 0;
@@ -25,6 +36,16 @@ struct convert_state
 char32_t DLL_PUBLIC utf8_to_32(std::uint8_t next, convert_state & state);
 std::size_t DLL_PUBLIC utf32_to_8(char32_t glyph, std::uint8_t * buf);
 
+/// Length of the longest prefix that utf8_to_32 followed by utf32_to_8 would
+/// reproduce byte for byte: ASCII except NUL and well-formed shortest form
+/// sequences up to U+10FFFF.
+std::size_t DLL_PUBLIC utf8_clean_prefix(std::string_view input);
+inline bool utf8_validate(std::string_view input) { return utf8_clean_prefix(input) == input.size(); }
+
+/// Decode input appending to output, with the same results as feeding every
+/// byte through utf8_to_32 and dropping the zeroes
+void DLL_PUBLIC utf8_decode(std::string_view input, std::u32string & output);
+
 } // namespace utils
 } // namespace fcgiserver
 
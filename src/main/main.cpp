@@ -1,3 +1,4 @@
+#include "html_template.h"
 #include "request.h"
 #include "router.h"
 #include "server.h"
@@ -6,58 +7,59 @@
 namespace
 {
 
+// Parsed once at startup, rendered for every request
+const fcgiserver::HtmlTemplate page_header(
+    "<!DOCTYPE html>\n"
+    "<html><body>\n"
+    "<h1>Hello world!</h1>\n");
+
+const fcgiserver::HtmlTemplate table_header(
+    "<h2>{{title}}</h2>"
+    "<table>\n"
+    "<thead><th>Key</th><th>Value</th></thead>\n"
+    "<tbody>\n");
+
+const fcgiserver::HtmlTemplate table_row(
+    "<tr><td>{{key}}</td><td>{{value}}</td></tr>\n");
+
+const fcgiserver::HtmlTemplate table_footer(
+    "</tbody>\n"
+    "</table>\n");
+
+const fcgiserver::HtmlTemplate page_footer(
+    "</body></html>\n");
+
 void hello_world(fcgiserver::RequestContext & context)
 {
 	fcgiserver::Request & request = context.request();
 	request.set_content_type("text/html");
 
 	auto stream = request.write_stream();
-	stream << "<!DOCTYPE html>\n";
-	stream << "<html><body>\n";
-	stream << "<h1>Hello world!</h1>\n";
+	page_header.render(stream, {});
 
 	auto const& params = request.query();
 	if (!params.empty())
 	{
-		stream << "<h2>Query</h2>";
-		stream << "<table>\n";
-		stream << "<thead><th>Key</th><th>Value</th></thead>\n";
-		stream << "<tbody>\n";
+		table_header.render(stream, { "Query" });
 
 		for (auto const& entry : params)
 		{
 			std::string lhs = request.query_decode(entry.first);
 			std::string rhs = request.query_decode(entry.second);
-
-			stream << "<tr><td>";
-			stream << fcgiserver::HTMLContent(lhs);
-			stream << "</td><td>";
-			stream << fcgiserver::HTMLContent(rhs);
-			stream << "</td></tr>\n";
+			table_row.render(stream, { lhs, rhs });
 		}
 
-		stream << "</tbody>\n";
-		stream << "</table>\n";
+		table_footer.render(stream, {});
 	}
 
-	stream << "<h2>Environment</h2>";
-	stream << "<table>\n";
-	stream << "<thead><th>Key</th><th>Value</th></thead>\n";
-	stream << "<tbody>\n";
+	table_header.render(stream, { "Environment" });
 
 	auto const& env_map = request.env_map();
 	for (auto & entry : env_map)
-	{
-		stream << "<tr><td>";
-		stream << fcgiserver::HTMLContent(entry.first);
-		stream << "</td><td>";
-		stream << fcgiserver::HTMLContent(entry.second);
-		stream << "</td></tr>\n";
-	}
+		table_row.render(stream, { entry.first, entry.second });
 
-	stream << "</tbody>\n";
-	stream << "</table>\n";
-	stream << "</body></html>\n";
+	table_footer.render(stream, {});
+	page_footer.render(stream, {});
 }
 
 }